@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "wfs.h"
+#include "wfs_io.h"
+
+// compares the io backends on a scratch image: random block reads,
+// a sequential scan and random block writes through wfs_io.
+// USAGE: ./bench_io scratch_image num_blocks [ops] [cache_blocks] [mmap|pread|direct|uring]
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// lays out a superblock with no inodes so the whole image is data blocks
+static int format_scratch(const char *path, size_t num_blocks)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    struct wfs_sb sb = {0};
+    sb.num_inodes = 0;
+    sb.num_data_blocks = num_blocks;
+    sb.i_bitmap_ptr = sizeof(struct wfs_sb);
+    sb.d_bitmap_ptr = sb.i_bitmap_ptr;
+    sb.i_blocks_ptr = sb.d_bitmap_ptr + num_blocks / 8;
+    sb.d_blocks_ptr = sb.i_blocks_ptr;
+    off_t size = sb.d_blocks_ptr + (off_t)num_blocks * BLOCK_SIZE;
+
+    // fill the data region so reads hit real extents, not holes
+    char block[BLOCK_SIZE];
+    memset(block, 'A', sizeof(block));
+    if (ftruncate(fd, size) != 0 || pwrite(fd, &sb, sizeof(sb), 0) != sizeof(sb))
+    {
+        close(fd);
+        return -1;
+    }
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+        if (pwrite(fd, block, BLOCK_SIZE, sb.d_blocks_ptr + (off_t)i * BLOCK_SIZE) != BLOCK_SIZE)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    fsync(fd);
+    close(fd);
+    return 0;
+}
+
+// pushes the scratch image out of the page cache so runs start cold
+static void drop_cache(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static void run(const char *path, const char *name, struct wfs_io_opts *opts, size_t num_blocks, size_t ops)
+{
+    drop_cache(path);
+    struct wfs_io *io = wfs_io_open(path, opts);
+    if (io == NULL)
+    {
+        perror(name);
+        return;
+    }
+    struct wfs_sb *sb = wfs_io_pin(io, 0, sizeof(struct wfs_sb));
+    off_t data = sb->d_blocks_ptr;
+    char block[BLOCK_SIZE];
+    unsigned long sum = 0;
+
+    srand(537);
+    double start = now();
+    for (size_t i = 0; i < ops; i++)
+    {
+        wfs_io_read(io, data + (off_t)(rand() % num_blocks) * BLOCK_SIZE, block, BLOCK_SIZE);
+        sum += block[0];
+    }
+    double rand_read = ops / (now() - start);
+
+    // the same random reads handed over 32 at a time, what a multi-block
+    // fuse read does through prefetch_range
+    off_t batch[32];
+    start = now();
+    for (size_t i = 0; i < ops; i += 32)
+    {
+        for (int j = 0; j < 32; j++)
+            batch[j] = data + (off_t)(rand() % num_blocks) * BLOCK_SIZE;
+        wfs_io_prefetch(io, batch, 32);
+        for (int j = 0; j < 32; j++)
+        {
+            wfs_io_read(io, batch[j], block, BLOCK_SIZE);
+            sum += block[0];
+        }
+    }
+    double batch_read = ops / (now() - start);
+
+    start = now();
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+        wfs_io_read(io, data + (off_t)i * BLOCK_SIZE, block, BLOCK_SIZE);
+        sum += block[0];
+    }
+    double seq_read = num_blocks / (now() - start);
+
+    memset(block, 'B', sizeof(block));
+    start = now();
+    for (size_t i = 0; i < ops; i++)
+    {
+        wfs_io_write(io, data + (off_t)(rand() % num_blocks) * BLOCK_SIZE, block, BLOCK_SIZE);
+    }
+    wfs_io_sync(io);
+    double rand_write = ops / (now() - start);
+
+    struct wfs_io_stats stats;
+    wfs_io_get_stats(io, &stats);
+    wfs_io_unpin(io, sb, 0);
+    wfs_io_close(io);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-14s rand_read=%.0f batch_read=%.0f seq_read=%.0f rand_write=%.0f ops/s hits=%lu misses=%lu maxrss_kb=%ld (%lu)\n",
+           name, rand_read, batch_read, seq_read, rand_write, stats.hits, stats.misses, usage.ru_maxrss, sum % 2);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "USAGE: %s scratch_image num_blocks [ops] [cache_blocks] [mmap|pread|direct|uring]\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+    size_t num_blocks = strtoul(argv[2], NULL, 10);
+    size_t ops = (argc > 3) ? strtoul(argv[3], NULL, 10) : 100000;
+    size_t cache_blocks = (argc > 4) ? strtoul(argv[4], NULL, 10) : WFS_IO_DEFAULT_CACHE_BLOCKS;
+    num_blocks -= num_blocks % 8;
+    if (num_blocks == 0)
+    {
+        fprintf(stderr, "num_blocks must be at least 8\n");
+        return 1;
+    }
+
+    if (format_scratch(path, num_blocks) != 0)
+    {
+        perror("format scratch image");
+        return 1;
+    }
+
+    // maxrss is per process, name a single backend to measure it alone
+    struct wfs_io_opts mmap_opts = {WFS_IO_MMAP, 0, 0};
+    struct wfs_io_opts pread_opts = {WFS_IO_PREAD, cache_blocks, 0};
+    struct wfs_io_opts direct_opts = {WFS_IO_PREAD, cache_blocks, 1};
+    struct wfs_io_opts uring_opts = {WFS_IO_URING, cache_blocks, 0};
+    if (argc > 5 && strcmp(argv[5], "mmap") == 0)
+        run(path, "mmap", &mmap_opts, num_blocks, ops);
+    else if (argc > 5 && strcmp(argv[5], "pread") == 0)
+        run(path, "pread", &pread_opts, num_blocks, ops);
+    else if (argc > 5 && strcmp(argv[5], "direct") == 0)
+        run(path, "pread+direct", &direct_opts, num_blocks, ops);
+    else if (argc > 5 && strcmp(argv[5], "uring") == 0)
+        run(path, "uring", &uring_opts, num_blocks, ops);
+    else
+    {
+        run(path, "mmap", &mmap_opts, num_blocks, ops);
+        run(path, "pread", &pread_opts, num_blocks, ops);
+        run(path, "pread+direct", &direct_opts, num_blocks, ops);
+        run(path, "uring", &uring_opts, num_blocks, ops);
+    }
+    return 0;
+}
@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "libwfs.h"
+#include "wfs_stats.h"
+
+// mdtest style metadata benchmark: builds a tree of directories with the
+// given fan-out and depth, creates n files spread over its leaves, stats
+// them, lists every leaf, removes the files and then the tree. each
+// phase prints one key=value line:
+//   phase=<name> ops=.. ops_s=.. p50_ns=.. p90_ns=.. p99_ns=.. max_ns=..
+// it runs in-process against an image through libwfs, or through a
+// mounted wfs, or any other directory, with plain system calls.
+// -r repeats the whole run and reports each phase's best round, by
+// ops_s. given a second image with -i the rounds alternate between the
+// two, and one more line per phase gives the second image's cost relative
+// to the first, the median of what it was within each round:
+//   overhead phase=<name> ops_s=..% p50=..%
+// USAGE: ./bench_md (-i image [-i image] | -m dir) [-n files] [-b fanout] [-z depth] [-r rounds]
+
+#define DIR_MAX_ENTRIES (112) // 7 direct blocks of 16 entries, no indirect
+
+// the six calls the phases make, one set per backend
+struct md_ops
+{
+    int (*mkdir)(const char *path);
+    int (*create)(const char *path);
+    int (*stat)(const char *path);
+    int (*list)(const char *path); // returns the entries, negative errno
+    int (*unlink)(const char *path);
+    int (*rmdir)(const char *path);
+};
+
+#define PHASES (6)
+
+struct result
+{
+    size_t ops;
+    double ops_s;
+    uint64_t p50, p90, p99, max;
+};
+
+static struct wfs_fs *fs;
+static char root[4096]; // prefix of every path, "" in-process
+static uint64_t *lat;
+// every round of each phase, per image
+static const char *phase_names[PHASES];
+static struct result *results[2][PHASES];
+static int nresults[2][PHASES];
+
+static int lib_mkdir(const char *path)
+{
+    return wfs_fs_mkdir(fs, path, 0755);
+}
+
+static int lib_create(const char *path)
+{
+    return wfs_fs_mknod(fs, path, S_IFREG | 0644);
+}
+
+static int lib_stat(const char *path)
+{
+    struct stat st;
+    return wfs_fs_getattr(fs, path, &st);
+}
+
+static int count_entry(void *ctx, const char *name, const struct stat *st)
+{
+    (*(int *)ctx)++;
+    return 0;
+}
+
+static int lib_list(const char *path)
+{
+    int n = 0;
+    int err = wfs_fs_readdir(fs, path, count_entry, &n);
+    return (err < 0) ? err : n;
+}
+
+static int lib_unlink(const char *path)
+{
+    return wfs_fs_unlink(fs, path);
+}
+
+static int lib_rmdir(const char *path)
+{
+    return wfs_fs_rmdir(fs, path);
+}
+
+static const struct md_ops lib_ops = {lib_mkdir, lib_create, lib_stat, lib_list, lib_unlink, lib_rmdir};
+
+static int sys_mkdir(const char *path)
+{
+    return mkdir(path, 0755) == 0 ? 0 : -errno;
+}
+
+static int sys_create(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return -errno;
+    close(fd);
+    return 0;
+}
+
+static int sys_stat(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? 0 : -errno;
+}
+
+static int sys_list(const char *path)
+{
+    DIR *d = opendir(path);
+    if (d == NULL)
+        return -errno;
+    int n = 0;
+    while (readdir(d) != NULL)
+        n++;
+    closedir(d);
+    return n;
+}
+
+static int sys_unlink(const char *path)
+{
+    return unlink(path) == 0 ? 0 : -errno;
+}
+
+static int sys_rmdir(const char *path)
+{
+    return rmdir(path) == 0 ? 0 : -errno;
+}
+
+static const struct md_ops sys_ops = {sys_mkdir, sys_create, sys_stat, sys_list, sys_unlink, sys_rmdir};
+
+// the path of directory d of the tree, numbered level by level from the
+// top directory 0, written as one path component per level
+static void dir_path(char *path, size_t cap, int d, int fanout)
+{
+    int parts[64], depth = 0;
+    // directory d's parent is (d - 1) / fanout, its slot (d - 1) % fanout
+    while (d > 0)
+    {
+        parts[depth++] = (d - 1) % fanout;
+        d = (d - 1) / fanout;
+    }
+    int len = snprintf(path, cap, "%s/md", root);
+    while (depth > 0)
+        len += snprintf(path + len, cap - len, "/%d", parts[--depth]);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// keeps a round of a phase, results has room for every round
+static void record(int img, int phase, const char *name, size_t n, uint64_t total)
+{
+    if (n == 0)
+        return;
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+    struct result r = {n, n / (total / 1e9), lat[n / 2], lat[(size_t)(n * 0.9)], lat[(size_t)(n * 0.99)], lat[n - 1]};
+    phase_names[phase] = name;
+    results[img][phase][nresults[img][phase]++] = r;
+}
+
+// the best round of a phase, NULL if it never ran. the machine only ever
+// adds time to a round, and the short phases are a few dozen calls, so the
+// fastest round is the one closest to what the calls themselves cost.
+static const struct result *best(int img, int phase)
+{
+    const struct result *r = NULL;
+    for (int i = 0; i < nresults[img][phase]; i++)
+    {
+        if (r == NULL || results[img][phase][i].ops_s > r->ops_s)
+            r = &results[img][phase][i];
+    }
+    return r;
+}
+
+// the second image's cost relative to the first in a phase, in percent,
+// the median over rounds of the two runs each round made back to back.
+// both halves of a pair see the machine in the same mood, which the best
+// rounds of each, taken apart, do not.
+static double overhead(int phase, int p50)
+{
+    int n = nresults[0][phase] < nresults[1][phase] ? nresults[0][phase] : nresults[1][phase];
+    double ratios[n];
+    for (int i = 0; i < n; i++)
+    {
+        const struct result *a = &results[0][phase][i], *b = &results[1][phase][i];
+        ratios[i] = p50 ? (double)b->p50 / a->p50 : b->ops_s / a->ops_s;
+    }
+    qsort(ratios, n, sizeof(double), cmp_double);
+    return (ratios[n / 2] - 1) * 100;
+}
+
+static void report(int img)
+{
+    for (int p = 0; p < PHASES; p++)
+    {
+        const struct result *r = best(img, p);
+        if (r == NULL)
+            continue;
+        printf("phase=%s ops=%zu ops_s=%.0f p50_ns=%lu p90_ns=%lu p99_ns=%lu max_ns=%lu\n", phase_names[p], r->ops, r->ops_s, r->p50,
+               r->p90, r->p99, r->max);
+    }
+    fflush(stdout);
+}
+
+// runs op on every path the generator gives for i in [from, to) and
+// records it as one phase. stops the whole run on the first error.
+#define PHASE(img, phase, name, from, to, make_path, op)                           \
+    do                                                                             \
+    {                                                                              \
+        uint64_t total = 0;                                                        \
+        size_t n = 0;                                                              \
+        for (long i = (from); i != (to); i += ((from) < (to)) ? 1 : -1)            \
+        {                                                                          \
+            make_path;                                                             \
+            uint64_t start = wfs_stats_now();                                      \
+            int err = (op);                                                        \
+            lat[n] = wfs_stats_now() - start;                                      \
+            total += lat[n++];                                                     \
+            if (err < 0)                                                           \
+            {                                                                      \
+                fprintf(stderr, "bench_md: %s %s: %s\n", name, path, strerror(-err)); \
+                exit(1);                                                           \
+            }                                                                      \
+        }                                                                          \
+        record(img, phase, name, n, total);                                        \
+    } while (0)
+
+// one round: builds the tree, fills, stats, lists and empties it, and
+// removes it again
+static void run(int img, const struct md_ops *ops, long files, int fanout, long dirs, long leaves)
+{
+    long first_leaf = dirs - leaves;
+    char path[8192];
+    int len;
+    PHASE(img, 0, "dir_create", 0, dirs, dir_path(path, sizeof(path), i, fanout), ops->mkdir(path));
+    // file i lives in leaf i % leaves, consecutive files in different leaves
+#define FILE_PATH                                                       \
+    dir_path(path, sizeof(path), first_leaf + i % leaves, fanout);      \
+    len = strlen(path);                                                 \
+    snprintf(path + len, sizeof(path) - len, "/f%ld", i / leaves)
+    PHASE(img, 1, "file_create", 0, files, FILE_PATH, ops->create(path));
+    PHASE(img, 2, "file_stat", 0, files, FILE_PATH, ops->stat(path));
+    PHASE(img, 3, "dir_list", first_leaf, dirs, dir_path(path, sizeof(path), i, fanout), ops->list(path));
+    PHASE(img, 4, "file_remove", 0, files, FILE_PATH, ops->unlink(path));
+    // children before their parents
+    PHASE(img, 5, "dir_remove", dirs - 1, -1, dir_path(path, sizeof(path), i, fanout), ops->rmdir(path));
+#undef FILE_PATH
+}
+
+static struct wfs_fs *open_image(const char *image)
+{
+    struct wfs_io_opts opts = {WFS_IO_MMAP, WFS_IO_DEFAULT_CACHE_BLOCKS, 0, 0};
+    struct wfs_fs *img = wfs_fs_open_image(image, &opts);
+    if (img == NULL)
+    {
+        perror(image);
+        exit(1);
+    }
+    return img;
+}
+
+int main(int argc, char **argv)
+{
+    const char *images[2] = {NULL, NULL}, *mount = NULL;
+    int nimages = 0;
+    long files = 1000;
+    int fanout = 10, depth = 1, rounds = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-i") == 0 && nimages < 2)
+            images[nimages++] = argv[i + 1];
+        else if (strcmp(argv[i], "-m") == 0)
+            mount = argv[i + 1];
+        else if (strcmp(argv[i], "-n") == 0)
+            files = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-b") == 0)
+            fanout = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-z") == 0)
+            depth = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-r") == 0)
+            rounds = atoi(argv[i + 1]);
+    }
+    if ((nimages == 0) == (mount == NULL) || files <= 0 || fanout <= 0 || depth < 0 || rounds <= 0)
+    {
+        fprintf(stderr, "USAGE: %s (-i image [-i image] | -m dir) [-n files] [-b fanout] [-z depth] [-r rounds]\n", argv[0]);
+        return 1;
+    }
+
+    // the tree has 1 + b + b^2 + .. + b^z directories, files go to the
+    // b^z leaves, which are the last ones in level order
+    long dirs = 1, leaves = 1;
+    for (int z = 0; z < depth; z++)
+    {
+        leaves *= fanout;
+        dirs += leaves;
+    }
+    long per_leaf = (files + leaves - 1) / leaves;
+    if (fanout > DIR_MAX_ENTRIES || per_leaf > DIR_MAX_ENTRIES)
+    {
+        fprintf(stderr, "bench_md: %ld files per leaf or a fan-out of %d is more than a directory holds (%d), "
+                        "raise -b or -z\n", per_leaf, fanout, DIR_MAX_ENTRIES);
+        return 1;
+    }
+
+    const struct md_ops *ops = &lib_ops;
+    struct wfs_fs *fss[2] = {NULL, NULL};
+    for (int k = 0; k < nimages; k++)
+        fss[k] = open_image(images[k]);
+    if (mount != NULL)
+    {
+        ops = &sys_ops;
+        snprintf(root, sizeof(root), "%s", mount);
+        nimages = 1;
+    }
+    lat = malloc((files > dirs ? files : dirs) * sizeof(uint64_t));
+    int nomem = lat == NULL;
+    for (int k = 0; k < 2; k++)
+    {
+        for (int p = 0; p < PHASES; p++)
+        {
+            results[k][p] = malloc(rounds * sizeof(struct result));
+            nomem |= results[k][p] == NULL;
+        }
+    }
+    if (nomem)
+    {
+        perror("malloc");
+        return 1;
+    }
+    fprintf(stderr, "bench_md: %ld files in %ld leaves, %ld directories, %s, %d rounds\n", files, leaves, dirs,
+            mount ? "mount" : "in-process", rounds);
+
+    for (int r = 0; r < rounds; r++)
+    {
+        // every other round the second image goes first, whichever runs
+        // after the other inherits its caches and would look slower
+        for (int i = 0; i < nimages; i++)
+        {
+            int k = (r % 2) ? nimages - 1 - i : i;
+            fs = fss[k];
+            run(k, ops, files, fanout, dirs, leaves);
+        }
+    }
+    for (int k = 0; k < nimages; k++)
+    {
+        if (nimages > 1)
+            printf("image=%s\n", images[k]);
+        report(k);
+    }
+    for (int p = 0; nimages > 1 && p < PHASES; p++)
+    {
+        if (nresults[0][p] == 0 || nresults[1][p] == 0)
+            continue;
+        printf("overhead phase=%s ops_s=%+.1f%% p50=%+.1f%%\n", phase_names[p], overhead(p, 0), overhead(p, 1));
+    }
+
+    for (int k = 0; k < 2; k++)
+    {
+        if (fss[k] != NULL)
+            wfs_fs_close_image(fss[k]);
+    }
+    for (int k = 0; k < 2; k++)
+    {
+        for (int p = 0; p < PHASES; p++)
+            free(results[k][p]);
+    }
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# sequential throughput of a mounted wfs, default profile against --large-io.
+# each file is written with one dd of the given request size, then read
+# back after a remount so the reads come from the daemon, not the page cache.
+# USAGE: ./bench_seq.sh [num_files] [request_size]
+
+FILES=${1:-64}
+BS=${2:-32k}
+IMG=bench_seq.img
+MNT=bench_mnt
+
+run()
+{
+    rm -f $IMG
+    dd if=/dev/zero of=$IMG bs=1M count=16 status=none
+    ./mkfs -d $IMG -i 256 -b 16384 || exit 1
+    mkdir -p $MNT
+
+    ./wfs $IMG "$@" -s $MNT || exit 1
+    start=$(date +%s.%N)
+    for i in $(seq $FILES); do
+        dd if=/dev/urandom of=$MNT/f$i bs=$BS count=1 iflag=fullblock status=none
+    done
+    sync
+    end=$(date +%s.%N)
+    bytes=$(du -cb $MNT/f* | tail -1 | cut -f1)
+    write=$(echo "$bytes / ($end - $start) / 1048576" | bc -l)
+    fusermount -u $MNT
+
+    ./wfs $IMG "$@" -s $MNT || exit 1
+    start=$(date +%s.%N)
+    cat $MNT/f* > /dev/null
+    end=$(date +%s.%N)
+    read=$(echo "$bytes / ($end - $start) / 1048576" | bc -l)
+    fusermount -u $MNT
+
+    printf "%-12s write %8.2f MB/s  read %8.2f MB/s\n" "${1:-default}" $write $read
+}
+
+make > /dev/null || exit 1
+run
+run --large-io
+rm -rf $IMG $MNT
@@ -0,0 +1,448 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "libwfs.h"
+#include "wfs_stats.h"
+
+// drives libwfs directly, no mount: inode and block allocation on a fresh
+// and a fragmented image, path lookup against depth and directory size,
+// read/write throughput per request size, and cold sequential reads of
+// fragmented files before and after defragmenting. every case starts from a
+// copy of the image mkfs made. one line per case on stdout:
+//   bench=<case> param=<value> ops=.. ops_s=.. mb_s=.. p50_ns=.. p90_ns=.. p99_ns=.. p999_ns=.. max_ns=..
+// USAGE: ./bench_wfs fresh_image [mmap|pread|uring]
+
+#define FILE_SIZE (32 * 1024) // stays below the indirect block's limit
+#define DIR_FANOUT (100) // directories only use their direct blocks, 112 entries
+#define DATA_FILES (DIR_FANOUT)
+#define LOOKUPS (20000)
+
+static const char *fresh_path;
+static char scratch_path[4096];
+static struct wfs_io_opts io_opts = {WFS_IO_MMAP, WFS_IO_DEFAULT_CACHE_BLOCKS, 0, 0};
+static uint64_t *lat; // one latency per op of the current case
+
+static void die(const char *what, int err)
+{
+    fprintf(stderr, "bench_wfs: %s: %s\n", what, strerror(err < 0 ? -err : err));
+    exit(1);
+}
+
+static struct wfs_fs *open_scratch(void)
+{
+    struct wfs_fs *fs = wfs_fs_open_image(scratch_path, &io_opts);
+    if (fs == NULL)
+        die("wfs_fs_open_image", errno);
+    return fs;
+}
+
+// copies the fresh image over the scratch one and opens it
+static struct wfs_fs *fresh_fs(void)
+{
+    int in = open(fresh_path, O_RDONLY);
+    int out = open(scratch_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (in < 0 || out < 0)
+        die("open image", errno);
+    static char buf[1 << 16];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) > 0)
+    {
+        if (write(out, buf, n) != n)
+            die("copy image", errno);
+    }
+    close(in);
+    close(out);
+    return open_scratch();
+}
+
+// the path of file i below top, spread over subdirectories of DIR_FANOUT
+// files. makes the subdirectory when i is the first file in it.
+static void spread_path(struct wfs_fs *fs, char *path, size_t cap, const char *top, int i)
+{
+    if (i % DIR_FANOUT == 0)
+    {
+        snprintf(path, cap, "%s/%d", top, i / DIR_FANOUT);
+        int err = wfs_fs_mkdir(fs, path, 0755);
+        if (err != 0 && err != -EEXIST)
+            die("mkdir", err);
+    }
+    snprintf(path, cap, "%s/%d/%d", top, i / DIR_FANOUT, i % DIR_FANOUT);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t pct(size_t n, double p)
+{
+    size_t i = (size_t)(p * n);
+    return lat[i < n ? i : n - 1];
+}
+
+// prints one result line for the n latencies in lat, bytes is what the
+// case moved in total or 0 for metadata cases
+static void report(const char *name, const char *param, size_t n, size_t bytes)
+{
+    if (n == 0)
+    {
+        printf("bench=%s param=%s ops=0\n", name, param);
+        return;
+    }
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += lat[i];
+    qsort(lat, n, sizeof(uint64_t), cmp_u64);
+    double secs = total / 1e9;
+    printf("bench=%s param=%s ops=%zu ops_s=%.0f mb_s=%.2f p50_ns=%lu p90_ns=%lu p99_ns=%lu p999_ns=%lu max_ns=%lu\n", name, param, n,
+           n / secs, bytes / secs / 1e6, pct(n, 0.5), pct(n, 0.9), pct(n, 0.99), pct(n, 0.999), lat[n - 1]);
+    fflush(stdout);
+}
+
+// one new file per op, each written with a single block so every op
+// allocates one inode and one data block
+static void bench_alloc(struct wfs_fs *fs, const char *param, int files)
+{
+    char block[BLOCK_SIZE], path[64];
+    memset(block, 'a', sizeof(block));
+    int err = wfs_fs_mkdir(fs, "/new", 0755);
+    if (err != 0)
+        die("mkdir /new", err);
+    size_t n_inode = 0;
+    for (int i = 0; i < files; i++)
+    {
+        spread_path(fs, path, sizeof(path), "/new", i);
+        uint64_t start = wfs_stats_now();
+        err = wfs_fs_mknod(fs, path, S_IFREG | 0644);
+        lat[n_inode] = wfs_stats_now() - start;
+        if (err != 0)
+            break;
+        n_inode++;
+    }
+    report("alloc_inode", param, n_inode, 0);
+
+    size_t n_block = 0;
+    for (size_t i = 0; i < n_inode; i++)
+    {
+        snprintf(path, sizeof(path), "/new/%zu/%zu", i / DIR_FANOUT, i % DIR_FANOUT);
+        uint64_t start = wfs_stats_now();
+        int written = wfs_fs_write(fs, path, NULL, block, BLOCK_SIZE, 0);
+        lat[n_block] = wfs_stats_now() - start;
+        if (written != BLOCK_SIZE)
+            break;
+        n_block++;
+    }
+    report("alloc_block", param, n_block, n_block * BLOCK_SIZE);
+}
+
+// fills every data block with files written a block at a time round robin,
+// so neighbouring blocks belong to different files, then deletes every
+// stride'th file. what is left free is single blocks spread over the
+// whole bitmap.
+static int fragment(struct wfs_fs *fs, int stride)
+{
+    struct statvfs sv;
+    wfs_fs_statfs(fs, &sv);
+    // the subdirectories take an inode and a block each
+    int files = sv.f_ffree / 2;
+    int per_file = sv.f_bfree / files + 1;
+    if (per_file * BLOCK_SIZE > FILE_SIZE)
+        per_file = FILE_SIZE / BLOCK_SIZE;
+    char block[BLOCK_SIZE], path[64];
+    memset(block, 'f', sizeof(block));
+    wfs_fs_mkdir(fs, "/frag", 0755);
+    for (int i = 0; i < files; i++)
+    {
+        spread_path(fs, path, sizeof(path), "/frag", i);
+        int err = wfs_fs_mknod(fs, path, S_IFREG | 0644);
+        if (err != 0)
+        {
+            files = i;
+            break;
+        }
+    }
+    for (int b = 0; b < per_file; b++)
+    {
+        for (int i = 0; i < files; i++)
+        {
+            snprintf(path, sizeof(path), "/frag/%d/%d", i / DIR_FANOUT, i % DIR_FANOUT);
+            if (wfs_fs_write(fs, path, NULL, block, BLOCK_SIZE, (off_t)b * BLOCK_SIZE) != BLOCK_SIZE)
+                goto full;
+        }
+    }
+full:
+    for (int i = 0; i < files; i += stride)
+    {
+        snprintf(path, sizeof(path), "/frag/%d/%d", i / DIR_FANOUT, i % DIR_FANOUT);
+        wfs_fs_unlink(fs, path);
+    }
+    wfs_fs_statfs(fs, &sv);
+    return sv.f_bfree;
+}
+
+// a chain of one letter directories, timed getattr of the deepest path
+static void bench_lookup_depth(struct wfs_fs *fs, int max_depth)
+{
+    char path[4096] = "";
+    char param[16];
+    for (int depth = 1; depth <= max_depth; depth++)
+    {
+        strcat(path, "/d");
+        int err = wfs_fs_mkdir(fs, path, 0755);
+        if (err != 0)
+            die("mkdir chain", err);
+        if ((depth & (depth - 1)) != 0)
+            continue;
+        struct stat st;
+        for (size_t i = 0; i < LOOKUPS; i++)
+        {
+            uint64_t start = wfs_stats_now();
+            wfs_fs_getattr(fs, path, &st);
+            lat[i] = wfs_stats_now() - start;
+        }
+        snprintf(param, sizeof(param), "depth=%d", depth);
+        report("lookup_depth", param, LOOKUPS, 0);
+    }
+}
+
+// timed getattr of random entries in one directory holding entries files
+static void bench_lookup_dir(struct wfs_fs *fs, int entries)
+{
+    char dir[32], path[64], param[16];
+    snprintf(dir, sizeof(dir), "/dir%d", entries);
+    int err = wfs_fs_mkdir(fs, dir, 0755);
+    if (err != 0)
+        die("mkdir", err);
+    for (int i = 0; i < entries; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%d", dir, i);
+        err = wfs_fs_mknod(fs, path, S_IFREG | 0644);
+        if (err != 0)
+            die("mknod", err);
+    }
+    srand(537);
+    struct stat st;
+    for (size_t i = 0; i < LOOKUPS; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%d", dir, rand() % entries);
+        uint64_t start = wfs_stats_now();
+        wfs_fs_getattr(fs, path, &st);
+        lat[i] = wfs_stats_now() - start;
+    }
+    snprintf(param, sizeof(param), "entries=%d", entries);
+    report("lookup_dir", param, LOOKUPS, 0);
+}
+
+// sequential and random reads and writes of bs bytes over DATA_FILES
+// files of FILE_SIZE, through open file handles like the daemon
+static void bench_data(struct wfs_fs *fs, size_t bs)
+{
+    static char buf[FILE_SIZE];
+    char path[64], param[16];
+    struct wfs_file *files[DATA_FILES];
+    size_t per_file = FILE_SIZE / bs;
+    size_t ops = DATA_FILES * per_file;
+    memset(buf, 'd', sizeof(buf));
+    snprintf(param, sizeof(param), "bs=%zu", bs);
+    snprintf(path, sizeof(path), "/data%zu", bs);
+    int err = wfs_fs_mkdir(fs, path, 0755);
+    if (err != 0)
+        die("mkdir", err);
+    for (int f = 0; f < DATA_FILES; f++)
+    {
+        snprintf(path, sizeof(path), "/data%zu/%d", bs, f);
+        err = wfs_fs_create(fs, path, S_IFREG | 0644, O_RDWR, &files[f]);
+        if (err != 0)
+            die("create", err);
+    }
+
+    // the first pass allocates, the random one overwrites in place
+    size_t n = 0;
+    for (int f = 0; f < DATA_FILES; f++)
+    {
+        snprintf(path, sizeof(path), "/data%zu/%d", bs, f);
+        for (size_t b = 0; b < per_file; b++)
+        {
+            uint64_t start = wfs_stats_now();
+            int done = wfs_fs_write(fs, path, files[f], buf, bs, b * bs);
+            lat[n++] = wfs_stats_now() - start;
+            if (done != (int)bs)
+                die("write", done < 0 ? done : -ENOSPC);
+        }
+    }
+    report("seq_write", param, n, n * bs);
+
+    srand(537);
+    for (n = 0; n < ops; n++)
+    {
+        int f = rand() % DATA_FILES;
+        snprintf(path, sizeof(path), "/data%zu/%d", bs, f);
+        uint64_t start = wfs_stats_now();
+        wfs_fs_write(fs, path, files[f], buf, bs, (rand() % per_file) * bs);
+        lat[n] = wfs_stats_now() - start;
+    }
+    report("rand_write", param, n, n * bs);
+
+    n = 0;
+    for (int f = 0; f < DATA_FILES; f++)
+    {
+        snprintf(path, sizeof(path), "/data%zu/%d", bs, f);
+        for (size_t b = 0; b < per_file; b++)
+        {
+            uint64_t start = wfs_stats_now();
+            wfs_fs_read(fs, path, files[f], buf, bs, b * bs);
+            lat[n++] = wfs_stats_now() - start;
+        }
+    }
+    report("seq_read", param, n, n * bs);
+
+    for (n = 0; n < ops; n++)
+    {
+        int f = rand() % DATA_FILES;
+        snprintf(path, sizeof(path), "/data%zu/%d", bs, f);
+        uint64_t start = wfs_stats_now();
+        wfs_fs_read(fs, path, files[f], buf, bs, (rand() % per_file) * bs);
+        lat[n] = wfs_stats_now() - start;
+    }
+    report("rand_read", param, n, n * bs);
+
+    for (int f = 0; f < DATA_FILES; f++)
+        wfs_fs_release(fs, files[f]);
+}
+
+// reads every file of /defrag front to back in 4 KiB requests, with the
+// scratch image out of the page cache first so the layout on disk shows
+static void cold_seq_read(const char *param)
+{
+    int fd = open(scratch_path, O_RDONLY);
+    if (fd < 0 || fdatasync(fd) != 0 || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+        die("drop scratch image from the page cache", errno);
+    close(fd);
+
+    struct wfs_fs *fs = open_scratch();
+    static char buf[4096];
+    char path[64];
+    size_t n = 0;
+    for (int f = 0; f < DATA_FILES; f++)
+    {
+        struct wfs_file *file;
+        snprintf(path, sizeof(path), "/defrag/%d", f);
+        int err = wfs_fs_open(fs, path, O_RDONLY, &file);
+        if (err != 0)
+            die("open", err);
+        for (off_t off = 0; off < FILE_SIZE; off += sizeof(buf))
+        {
+            uint64_t start = wfs_stats_now();
+            wfs_fs_read(fs, path, file, buf, sizeof(buf), off);
+            lat[n++] = wfs_stats_now() - start;
+        }
+        wfs_fs_release(fs, file);
+    }
+    report("cold_seq_read", param, n, n * sizeof(buf));
+    wfs_fs_close_image(fs);
+}
+
+// files written a block at a time round robin, so every block of a file
+// is its own extent, read back before and after wfs_fs_defrag
+static void bench_defrag(void)
+{
+    struct wfs_fs *fs = fresh_fs();
+    char block[BLOCK_SIZE], path[64];
+    memset(block, 'g', sizeof(block));
+    int err = wfs_fs_mkdir(fs, "/defrag", 0755);
+    for (int f = 0; f < DATA_FILES && err == 0; f++)
+    {
+        snprintf(path, sizeof(path), "/defrag/%d", f);
+        err = wfs_fs_mknod(fs, path, S_IFREG | 0644);
+    }
+    if (err != 0)
+        die("make /defrag", err);
+    for (off_t off = 0; off < FILE_SIZE; off += BLOCK_SIZE)
+    {
+        for (int f = 0; f < DATA_FILES; f++)
+        {
+            snprintf(path, sizeof(path), "/defrag/%d", f);
+            if (wfs_fs_write(fs, path, NULL, block, BLOCK_SIZE, off) != BLOCK_SIZE)
+                die("write", ENOSPC);
+        }
+    }
+    wfs_fs_close_image(fs);
+    cold_seq_read("fragmented");
+
+    fs = open_scratch();
+    struct wfs_defrag_arg moved = {0};
+    for (int f = 0; f < DATA_FILES; f++)
+    {
+        snprintf(path, sizeof(path), "/defrag/%d", f);
+        uint64_t start = wfs_stats_now();
+        err = wfs_fs_defrag(fs, path, &moved);
+        lat[f] = wfs_stats_now() - start;
+        if (err != 0)
+            die("defrag", err);
+    }
+    report("defrag", "files", DATA_FILES, (size_t)DATA_FILES * FILE_SIZE);
+    fprintf(stderr, "bench_wfs: defrag moved %u of %u files, %lu extents before, %lu after\n", moved.moved, moved.files,
+            (unsigned long)moved.extents_before, (unsigned long)moved.extents_after);
+    wfs_fs_close_image(fs);
+    cold_seq_read("defragmented");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "USAGE: %s fresh_image [mmap|pread|uring]\n", argv[0]);
+        return 1;
+    }
+    fresh_path = argv[1];
+    snprintf(scratch_path, sizeof(scratch_path), "%s.scratch", fresh_path);
+    if (argc > 2 && strcmp(argv[2], "pread") == 0)
+        io_opts.backend = WFS_IO_PREAD;
+    else if (argc > 2 && strcmp(argv[2], "uring") == 0)
+        io_opts.backend = WFS_IO_URING;
+
+    struct wfs_fs *fs = fresh_fs();
+    struct statvfs sv;
+    wfs_fs_statfs(fs, &sv);
+    lat = malloc((sv.f_files + sv.f_blocks + LOOKUPS) * sizeof(uint64_t));
+    if (lat == NULL)
+        die("malloc", ENOMEM);
+    fprintf(stderr, "bench_wfs: %lu inodes, %lu data blocks, io %s\n", sv.f_files, sv.f_blocks, argc > 2 ? argv[2] : "mmap");
+
+    // a quarter of the inodes leaves room in /new on either image
+    int files = sv.f_files / 4;
+    bench_alloc(fs, "fresh", files);
+    wfs_fs_close_image(fs);
+
+    fs = fresh_fs();
+    int free_blocks = fragment(fs, 16);
+    fprintf(stderr, "bench_wfs: fragmented, %d single free blocks\n", free_blocks);
+    bench_alloc(fs, "fragmented", files < free_blocks ? files : free_blocks);
+    wfs_fs_close_image(fs);
+
+    fs = fresh_fs();
+    bench_lookup_depth(fs, 32);
+    bench_lookup_dir(fs, 4);
+    bench_lookup_dir(fs, 32);
+    bench_lookup_dir(fs, DIR_FANOUT);
+    wfs_fs_close_image(fs);
+
+    size_t sizes[] = {BLOCK_SIZE, 4096, FILE_SIZE};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        fs = fresh_fs();
+        bench_data(fs, sizes[i]);
+        wfs_fs_close_image(fs);
+    }
+
+    bench_defrag();
+
+    unlink(scratch_path);
+    free(lat);
+    return 0;
+}
@@ -1,18 +1,79 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #define BLOCK_SIZE 512
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <output file> <n>\n", argv[0]);
-        return 1;
-    }
+/*
+  Two modes. The original one writes a file of n blocks of 'A':
+
+      ./generate <output file> <n>
+
+  The workload mode runs fio style jobs against a directory, normally a
+  mounted wfs, and reports throughput, IOPS and latency percentiles:
+
+      ./generate -d <dir> [global options] [--name=job [job options]]...
+
+  Options before the first --name are defaults for every job, options
+  after a --name only apply to that job. All jobs run at the same time.
+
+      --rw=read|write|randread|randwrite|rw|randrw   (default randread)
+      --rwmix=N        percent of reads in rw and randrw (default 50)
+      --bs=SIZE        request size (default 4k)
+      --size=SIZE      size of each file (default 32k, wfs tops out near 36k)
+      --nrfiles=N      files per thread (default 4)
+      --numjobs=N      threads running the job (default 1)
+      --fsync=N        fsync after every N writes, 0 never (default 0)
+      --runtime=SECS   how long to run (default 5)
+      --ops=N          stop each thread after N requests instead
+
+  Every thread works on its own files, <dir>/<job>.<thread>.<file>, laid
+  out in full before the clock starts. One line per job and direction:
 
-    char *filename = argv[1];
-    int n = atoi(argv[2]);
+      job=<name> op=read|write ops=.. iops=.. mb_s=.. p50_us=.. p90_us=.. p99_us=.. p999_us=.. max_us=..
+*/
 
+#define MAX_JOBS 16
+
+struct job {
+    char name[32];
+    int random;
+    int rwmix; // percent reads, 100 read only, 0 write only
+    size_t bs;
+    size_t size;
+    int nrfiles;
+    int numjobs;
+    int fsync_every;
+    double runtime;
+    long ops;
+};
+
+// latencies in ns of one direction of one thread, grown as it runs
+struct lat_log {
+    uint64_t *ns;
+    size_t n, cap;
+    uint64_t bytes;
+};
+
+struct worker {
+    struct job *job;
+    int index;
+    pthread_t thread;
+    int err;
+    struct lat_log lat[2]; // 0 reads, 1 writes
+};
+
+static const char *dir;
+static pthread_barrier_t start_line;
+
+static int legacy(const char *filename, int n) {
     if (n <= 0) {
         fprintf(stderr, "Error: 'n' must be a positive integer\n");
         return 1;
@@ -42,3 +103,280 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 4k, 1m and plain byte counts
+static size_t parse_size(const char *s) {
+    char *end;
+    size_t v = strtoul(s, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': return v << 10;
+    case 'm': case 'M': return v << 20;
+    default: return v;
+    }
+}
+
+static int log_latency(struct lat_log *log, uint64_t ns, size_t bytes) {
+    if (log->n == log->cap) {
+        size_t cap = log->cap ? log->cap * 2 : 4096;
+        uint64_t *grown = realloc(log->ns, cap * sizeof(uint64_t));
+        if (grown == NULL)
+            return -1;
+        log->ns = grown;
+        log->cap = cap;
+    }
+    log->ns[log->n++] = ns;
+    log->bytes += bytes;
+    return 0;
+}
+
+static void file_path(char *path, size_t cap, struct worker *w, int f) {
+    snprintf(path, cap, "%s/%s.%d.%d", dir, w->job->name, w->index, f);
+}
+
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    struct job *job = w->job;
+    char path[4096];
+    char *buf = malloc(job->bs);
+    int *fds = malloc(job->nrfiles * sizeof(int));
+    unsigned int seed = 537 + w->index * 7919 + (unsigned int)(uintptr_t)job;
+    if (buf == NULL || fds == NULL) {
+        w->err = ENOMEM;
+        pthread_barrier_wait(&start_line);
+        return NULL;
+    }
+    memset(buf, 'A' + w->index % 26, job->bs);
+
+    // lay every file out in full so reads never hit a hole or end of file
+    for (int f = 0; f < job->nrfiles; f++) {
+        file_path(path, sizeof(path), w, f);
+        fds[f] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fds[f] < 0) {
+            w->err = errno;
+            break;
+        }
+        for (size_t off = 0; off < job->size; off += job->bs) {
+            size_t len = job->size - off < job->bs ? job->size - off : job->bs;
+            if (pwrite(fds[f], buf, len, off) != (ssize_t)len) {
+                w->err = errno;
+                break;
+            }
+        }
+        fsync(fds[f]);
+    }
+    pthread_barrier_wait(&start_line);
+
+    size_t blocks = job->size / job->bs;
+    uint64_t start = now_ns();
+    uint64_t deadline = start + (uint64_t)(job->runtime * 1e9);
+    long done = 0, writes = 0;
+    size_t seq = 0;
+    while (w->err == 0 && blocks > 0) {
+        if (job->ops > 0 ? done >= job->ops : now_ns() >= deadline)
+            break;
+        // sequential jobs walk each file in turn, random ones pick any block
+        int f;
+        size_t block;
+        if (job->random) {
+            f = rand_r(&seed) % job->nrfiles;
+            block = rand_r(&seed) % blocks;
+        } else {
+            f = (seq / blocks) % job->nrfiles;
+            block = seq % blocks;
+            seq++;
+        }
+        int reading = (int)(rand_r(&seed) % 100) < job->rwmix;
+        off_t off = (off_t)block * job->bs;
+
+        uint64_t t = now_ns();
+        ssize_t n = reading ? pread(fds[f], buf, job->bs, off) : pwrite(fds[f], buf, job->bs, off);
+        if (!reading && job->fsync_every > 0 && ++writes % job->fsync_every == 0)
+            fsync(fds[f]);
+        uint64_t elapsed = now_ns() - t;
+        if (n != (ssize_t)job->bs) {
+            w->err = (n < 0) ? errno : EIO;
+            break;
+        }
+        if (log_latency(&w->lat[reading ? 0 : 1], elapsed, n) != 0) {
+            w->err = ENOMEM;
+            break;
+        }
+        done++;
+    }
+
+    for (int f = 0; f < job->nrfiles; f++) {
+        if (fds[f] >= 0)
+            close(fds[f]);
+    }
+    free(fds);
+    free(buf);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// merges one direction of all the job's threads and prints its line
+static void report(struct job *job, struct worker *workers, int dirn, double secs) {
+    struct lat_log all = {0};
+    for (int i = 0; i < job->numjobs; i++) {
+        struct lat_log *l = &workers[i].lat[dirn];
+        for (size_t j = 0; j < l->n; j++)
+            log_latency(&all, l->ns[j], 0);
+        all.bytes += l->bytes;
+    }
+    if (all.n == 0)
+        return;
+    qsort(all.ns, all.n, sizeof(uint64_t), cmp_u64);
+#define PCT(p) (all.ns[(size_t)((p) * all.n) < all.n ? (size_t)((p) * all.n) : all.n - 1] / 1e3)
+    printf("job=%s op=%s ops=%zu iops=%.0f mb_s=%.2f p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n",
+           job->name, dirn ? "write" : "read", all.n, all.n / secs, all.bytes / secs / 1e6,
+           PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999), all.ns[all.n - 1] / 1e3);
+#undef PCT
+    free(all.ns);
+}
+
+// applies one --key=value to job, nonzero if it is not an option
+static int set_option(struct job *job, const char *arg) {
+    const char *v = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) != 0 || v == NULL)
+        return -1;
+    v++;
+    if (strncmp(arg, "--rw=", 5) == 0) {
+        const char *rw = v;
+        job->random = strncmp(rw, "rand", 4) == 0;
+        if (job->random)
+            rw += 4;
+        if (strcmp(rw, "read") == 0)
+            job->rwmix = 100;
+        else if (strcmp(rw, "write") == 0)
+            job->rwmix = 0;
+        else if (strcmp(rw, "rw") == 0)
+            job->rwmix = 50;
+        else
+            return -1;
+    } else if (strncmp(arg, "--rwmix=", 8) == 0) {
+        job->rwmix = atoi(v);
+    } else if (strncmp(arg, "--bs=", 5) == 0) {
+        job->bs = parse_size(v);
+    } else if (strncmp(arg, "--size=", 7) == 0) {
+        job->size = parse_size(v);
+    } else if (strncmp(arg, "--nrfiles=", 10) == 0) {
+        job->nrfiles = atoi(v);
+    } else if (strncmp(arg, "--numjobs=", 10) == 0) {
+        job->numjobs = atoi(v);
+    } else if (strncmp(arg, "--fsync=", 8) == 0) {
+        job->fsync_every = atoi(v);
+    } else if (strncmp(arg, "--runtime=", 10) == 0) {
+        job->runtime = atof(v);
+    } else if (strncmp(arg, "--ops=", 6) == 0) {
+        job->ops = atol(v);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int workload(int argc, char *argv[]) {
+    struct job defaults = {"job", 1, 100, 4096, 32768, 4, 1, 0, 5.0, 0};
+    static struct job jobs[MAX_JOBS];
+    int njobs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strncmp(argv[i], "--name=", 7) == 0) {
+            if (njobs == MAX_JOBS) {
+                fprintf(stderr, "Error: at most %d jobs\n", MAX_JOBS);
+                return 1;
+            }
+            jobs[njobs] = defaults;
+            snprintf(jobs[njobs].name, sizeof(jobs[njobs].name), "%s", argv[i] + 7);
+            njobs++;
+        } else if (set_option(njobs ? &jobs[njobs - 1] : &defaults, argv[i]) != 0) {
+            fprintf(stderr, "Error: unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (dir == NULL) {
+        fprintf(stderr, "Error: -d <dir> is required\n");
+        return 1;
+    }
+    if (njobs == 0)
+        jobs[njobs++] = defaults;
+
+    int threads = 0;
+    for (int j = 0; j < njobs; j++) {
+        struct job *job = &jobs[j];
+        if (job->bs == 0 || job->size < job->bs || job->nrfiles <= 0 || job->numjobs <= 0 ||
+            job->rwmix < 0 || job->rwmix > 100) {
+            fprintf(stderr, "Error: job %s: bad bs, size, nrfiles, numjobs or rwmix\n", job->name);
+            return 1;
+        }
+        threads += job->numjobs;
+    }
+
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+    if (workers == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    // everyone lays out their files first, then the clock starts for all
+    pthread_barrier_init(&start_line, NULL, threads + 1);
+    int t = 0;
+    for (int j = 0; j < njobs; j++) {
+        for (int i = 0; i < jobs[j].numjobs; i++, t++) {
+            workers[t].job = &jobs[j];
+            workers[t].index = i;
+            if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) != 0) {
+                perror("pthread_create");
+                exit(1);
+            }
+        }
+    }
+    pthread_barrier_wait(&start_line);
+    uint64_t start = now_ns();
+    for (t = 0; t < threads; t++)
+        pthread_join(workers[t].thread, NULL);
+    double secs = (now_ns() - start) / 1e9;
+
+    int failed = 0;
+    t = 0;
+    for (int j = 0; j < njobs; j++) {
+        struct worker *w = &workers[t];
+        for (int i = 0; i < jobs[j].numjobs; i++) {
+            if (w[i].err != 0) {
+                fprintf(stderr, "job %s.%d: %s\n", jobs[j].name, i, strerror(w[i].err));
+                failed = 1;
+            }
+        }
+        report(&jobs[j], w, 0, secs);
+        report(&jobs[j], w, 1, secs);
+        for (int i = 0; i < jobs[j].numjobs; i++) {
+            free(w[i].lat[0].ns);
+            free(w[i].lat[1].ns);
+        }
+        t += jobs[j].numjobs;
+    }
+    pthread_barrier_destroy(&start_line);
+    free(workers);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && argv[1][0] != '-')
+        return legacy(argv[1], atoi(argv[2]));
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output file> <n>\n", argv[0]);
+        fprintf(stderr, "       %s -d <dir> [--rw=..] [--bs=..] [--size=..] [--nrfiles=..] [--numjobs=..]\n"
+                        "          [--fsync=..] [--runtime=..] [--ops=..] [--name=job [job options]]...\n", argv[0]);
+        return 1;
+    }
+    return workload(argc, argv);
+}
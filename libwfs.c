@@ -0,0 +1,2998 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "libwfs.h"
+#include "wfs_lz.h"
+#include "wfs_crc.h"
+#include "wfs_stats.h"
+#include "wfs_log.h"
+
+// file blocks an inode can address, direct blocks plus the indirect block
+#define MAX_FILE_BLOCKS (IND_BLOCK + (BLOCK_SIZE / sizeof(off_t)))
+
+// in-memory counters per inode that let open file handles notice when
+// what they cached went stale: life moves on when the inode is freed and
+// map whenever one of its block pointers changes
+struct inode_gen
+{
+    uint32_t life;
+    uint32_t map;
+};
+
+#define DENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(struct wfs_dentry))
+
+// in-memory free slot hints per directory, filled from its blocks the
+// first time an entry goes in or out after mount and kept up to date
+// from then on, so inserts go straight to a block with room instead of
+// rescanning the directory. they belong to one life of the inode.
+struct dir_hint
+{
+    uint32_t life; // inode_gens[num].life the hint was filled for
+    uint8_t valid;
+    uint8_t free[N_BLOCKS];       // empty entries per block, 0 if it is not allocated
+    uint8_t first_free[N_BLOCKS]; // no empty entry in the block below this one
+};
+
+// small LRU of decompressed clusters so reads of a compressed file do not
+// decompress the same cluster for every FUSE request that touches it
+#define CLUSTER_CACHE_ENTRIES (16)
+
+struct cluster_cache_entry
+{
+    int inode;           // inode number, -1 if the entry is unused
+    int cluster;         // cluster index within the file
+    unsigned long used;  // LRU clock
+    char data[CLUSTER_SIZE];
+};
+
+// in-memory index from block contents to a data block holding them.
+// it is direct mapped and lossy, a newer block simply replaces whatever
+// was in its slot, so memory stays bounded whatever the image size. the
+// index starts empty on every mount and fills as files are written.
+#define DEDUP_INDEX_MAX (1 << 16)
+
+struct dedup_entry
+{
+    uint64_t hash;
+    off_t block; // 0 when the slot is empty
+};
+
+// everything that belongs to one open image
+struct wfs_fs
+{
+    struct wfs_io *disk; // block I/O layer the file system goes through
+    struct wfs_sb *super_block;
+    struct wfs_sb_ext *sb_ext; // NULL for images made without features
+    struct inode_gen *inode_gens;
+    struct dir_hint *dir_hints;
+    // where the next search for a free data block starts. allocation is
+    // next fit, so a file written in one go gets neighbouring blocks
+    // without the bitmap being scanned from the start for every one.
+    int next_datablock;
+    struct cluster_cache_entry cluster_cache[CLUSTER_CACHE_ENTRIES];
+    unsigned long cluster_cache_clock;
+    struct dedup_entry *dedup_index;
+    size_t dedup_index_mask;
+    // WFS_FEATURE_CSUM: a bit per checksum table entry, set once what it
+    // covers was checked or written since mount
+    uint8_t *csum_checked;
+    // and one set while the entry lags behind what it covers
+    uint8_t *csum_stale;
+};
+
+// returns nonzero if mkfs turned the feature on for this image
+static int has_feature(struct wfs_fs *fs, uint32_t feature)
+{
+    return fs->sb_ext != NULL && (fs->sb_ext->features & feature);
+}
+
+// returns the inode or data bitmap, both stay resident in the io layer
+static char *pin_bitmap(struct wfs_fs *fs, int isBlocks)
+{
+    if (isBlocks)
+    {
+        return wfs_io_pin(fs->disk, fs->super_block->d_bitmap_ptr, fs->super_block->num_data_blocks / 8);
+    }
+    return wfs_io_pin(fs->disk, fs->super_block->i_bitmap_ptr, fs->super_block->num_inodes / 8);
+}
+
+// returns the reference count table, resident like the bitmaps.
+// only valid on images with WFS_FEATURE_REFCOUNT.
+static wfs_refcount_t *pin_refcounts(struct wfs_fs *fs)
+{
+    return wfs_io_pin(fs->disk, fs->sb_ext->refcount_ptr, fs->super_block->num_data_blocks * sizeof(wfs_refcount_t));
+}
+
+// index of a data block in the bitmap and refcount table
+static int block_index(struct wfs_fs *fs, off_t datablock)
+{
+    return (datablock - fs->super_block->d_blocks_ptr) / BLOCK_SIZE;
+}
+
+static size_t min(size_t a, size_t b)
+{
+    return (a < b) ? a : b;
+}
+
+static void csum_mark(struct wfs_fs *fs, size_t entry)
+{
+    fs->csum_checked[entry / 8] |= 1 << (entry % 8);
+}
+
+// stores the checksum of len bytes at data in the table entry covering
+// them, a no-op on images without WFS_FEATURE_CSUM
+static void csum_update(struct wfs_fs *fs, size_t entry, const void *data, size_t len)
+{
+    if (!has_feature(fs, WFS_FEATURE_CSUM))
+    {
+        return;
+    }
+    wfs_csum_t *stored = wfs_io_pin(fs->disk, fs->sb_ext->csum_ptr + entry * sizeof(wfs_csum_t), sizeof(wfs_csum_t));
+    if (stored == NULL)
+    {
+        return;
+    }
+    *stored = wfs_crc32c(0, data, len);
+    wfs_io_unpin(fs->disk, stored, 1);
+    csum_mark(fs, entry);
+}
+
+// notes that what a table entry covers changed. the checksum itself is
+// left to csum_flush, so an inode or directory block changed many times
+// between two syncs is checksummed once and a create or unlink costs a
+// bit set here instead of a CRC per structure it touches.
+static void csum_stale(struct wfs_fs *fs, size_t entry)
+{
+    if (!has_feature(fs, WFS_FEATURE_CSUM))
+    {
+        return;
+    }
+    csum_mark(fs, entry);
+    fs->csum_stale[entry / 8] |= 1 << (entry % 8);
+    if (!fs->sb_ext->csum_pending)
+    {
+        // synced ahead of the changes themselves, so a mount that never
+        // gets to close is rebuilt on the next open
+        fs->sb_ext->csum_pending = 1;
+        wfs_io_unpin(fs->disk, fs->sb_ext, 1);
+        wfs_io_sync(fs->disk);
+    }
+}
+
+// stores the checksum of whatever table entry covers now
+static void csum_refresh(struct wfs_fs *fs, size_t entry)
+{
+    struct wfs_sb *sb = fs->super_block;
+    size_t ibitmap = WFS_CSUM_PIECES(sb->num_inodes / 8);
+    if (entry < WFS_CSUM_INODE(sb, 0))
+    {
+        int isBlocks = entry >= ibitmap;
+        size_t off = (entry - (isBlocks ? ibitmap : 0)) * BLOCK_SIZE;
+        size_t len = (isBlocks ? sb->num_data_blocks : sb->num_inodes) / 8;
+        char *bitmap = pin_bitmap(fs, isBlocks);
+        csum_update(fs, entry, bitmap + off, min(len - off, BLOCK_SIZE));
+        wfs_io_unpin(fs->disk, bitmap, 0);
+        return;
+    }
+    off_t where = (entry < WFS_CSUM_DATA(sb, 0)) ? sb->i_blocks_ptr + (off_t)(entry - WFS_CSUM_INODE(sb, 0)) * BLOCK_SIZE
+                                                 : sb->d_blocks_ptr + (off_t)(entry - WFS_CSUM_DATA(sb, 0)) * BLOCK_SIZE;
+    size_t len = (entry < WFS_CSUM_DATA(sb, 0)) ? sizeof(struct wfs_inode) : BLOCK_SIZE;
+    void *data = wfs_io_pin(fs->disk, where, len);
+    if (data != NULL)
+    {
+        csum_update(fs, entry, data, len);
+        wfs_io_unpin(fs->disk, data, 0);
+    }
+}
+
+// brings every stale table entry up to date, before a sync or close
+static void csum_flush(struct wfs_fs *fs)
+{
+    if (!has_feature(fs, WFS_FEATURE_CSUM))
+    {
+        return;
+    }
+    size_t n = WFS_CSUM_ENTRIES(fs->super_block);
+    for (size_t byte = 0; byte < (n + 7) / 8; byte++)
+    {
+        // almost all of the table is current, skip it a byte at a time
+        if (fs->csum_stale[byte] == 0)
+        {
+            continue;
+        }
+        for (size_t entry = byte * 8; entry < byte * 8 + 8 && entry < n; entry++)
+        {
+            if ((fs->csum_stale[byte] >> (entry % 8)) & 1)
+            {
+                csum_refresh(fs, entry);
+            }
+        }
+        fs->csum_stale[byte] = 0;
+    }
+}
+
+// checks len bytes at data against their table entry the first time
+// they are used after mount. from then on this mount keeps the entry
+// current itself. returns 0, or -EIO if the checksum does not match.
+static int csum_verify(struct wfs_fs *fs, size_t entry, const void *data, size_t len, const char *what, long which)
+{
+    if (!has_feature(fs, WFS_FEATURE_CSUM) || ((fs->csum_checked[entry / 8] >> (entry % 8)) & 1))
+    {
+        return 0;
+    }
+    wfs_csum_t *stored = wfs_io_pin(fs->disk, fs->sb_ext->csum_ptr + entry * sizeof(wfs_csum_t), sizeof(wfs_csum_t));
+    if (stored == NULL)
+    {
+        return -EIO;
+    }
+    uint32_t crc = wfs_crc32c(0, data, len);
+    wfs_csum_t expected = *stored;
+    wfs_io_unpin(fs->disk, stored, 0);
+    if (crc != expected)
+    {
+        wfs_error("%s %ld is corrupt, checksum %08x instead of %08x", what, which, crc, expected);
+        return -EIO;
+    }
+    csum_mark(fs, entry);
+    return 0;
+}
+
+// a mount that never closed left entries behind what they cover and
+// there is no telling which, so every one in use is computed again:
+// the bitmaps, the inodes and the blocks of every directory
+static void csum_rebuild(struct wfs_fs *fs)
+{
+    struct wfs_sb *sb = fs->super_block;
+    wfs_warn("image was not closed cleanly, recomputing its metadata checksums");
+    for (size_t entry = 0; entry < WFS_CSUM_DATA(sb, 0); entry++)
+    {
+        csum_refresh(fs, entry);
+    }
+    char *bitmap = pin_bitmap(fs, 0);
+    for (size_t num = 0; num < sb->num_inodes; num++)
+    {
+        if (!((bitmap[num / 8] >> (num % 8)) & 1))
+        {
+            continue;
+        }
+        struct wfs_inode *inode = wfs_io_pin(fs->disk, sb->i_blocks_ptr + (off_t)num * BLOCK_SIZE, sizeof(struct wfs_inode));
+        for (int k = 0; inode != NULL && S_ISDIR(inode->mode) && k < N_BLOCKS; k++)
+        {
+            off_t block = inode->blocks[k];
+            if (block >= sb->d_blocks_ptr && block < sb->d_blocks_ptr + (off_t)sb->num_data_blocks * BLOCK_SIZE)
+            {
+                csum_refresh(fs, WFS_CSUM_DATA(sb, block_index(fs, block)));
+            }
+        }
+        wfs_io_unpin(fs->disk, inode, 0);
+    }
+    wfs_io_unpin(fs->disk, bitmap, 0);
+    fs->sb_ext->csum_pending = 0;
+    wfs_io_unpin(fs->disk, fs->sb_ext, 1);
+}
+
+// the bitmap pieces holding bits first to last changed
+static void csum_bitmap(struct wfs_fs *fs, int isBlocks, int first, int last)
+{
+    for (size_t piece = first / 8 / BLOCK_SIZE; piece <= last / 8 / BLOCK_SIZE; piece++)
+    {
+        csum_stale(fs, isBlocks ? WFS_CSUM_DBITMAP(fs->super_block, piece) : WFS_CSUM_IBITMAP(fs->super_block, piece));
+    }
+}
+
+// checks both bitmaps in full, they are used from the first allocation on
+static int csum_check_bitmaps(struct wfs_fs *fs)
+{
+    for (int isBlocks = 0; isBlocks < 2; isBlocks++)
+    {
+        size_t len = (isBlocks ? fs->super_block->num_data_blocks : fs->super_block->num_inodes) / 8;
+        char *bitmap = pin_bitmap(fs, isBlocks);
+        for (size_t off = 0; off < len; off += BLOCK_SIZE)
+        {
+            size_t piece = off / BLOCK_SIZE;
+            size_t entry = isBlocks ? WFS_CSUM_DBITMAP(fs->super_block, piece) : WFS_CSUM_IBITMAP(fs->super_block, piece);
+            if (csum_verify(fs, entry, bitmap + off, min(len - off, BLOCK_SIZE), isBlocks ? "data bitmap block" : "inode bitmap block",
+                            piece) != 0)
+            {
+                wfs_io_unpin(fs->disk, bitmap, 0);
+                return -EIO;
+            }
+        }
+        wfs_io_unpin(fs->disk, bitmap, 0);
+    }
+    return 0;
+}
+
+// pins the inode with the given number, NULL if it cannot be read
+static struct wfs_inode *pin_inode(struct wfs_fs *fs, int num)
+{
+    struct wfs_inode *inode =
+        wfs_io_pin(fs->disk, fs->super_block->i_blocks_ptr + ((off_t)num * BLOCK_SIZE), sizeof(struct wfs_inode));
+    if (inode != NULL &&
+        csum_verify(fs, WFS_CSUM_INODE(fs->super_block, num), inode, sizeof(struct wfs_inode), "inode", num) != 0)
+    {
+        wfs_io_unpin(fs->disk, inode, 0);
+        return NULL;
+    }
+    return inode;
+}
+
+// releases an inode returned by get_inode, pin_inode or allocate_inode
+static void unpin_inode(struct wfs_fs *fs, struct wfs_inode *inode, int dirty)
+{
+    if (dirty && inode->num >= 0 && inode->num < fs->super_block->num_inodes)
+    {
+        csum_stale(fs, WFS_CSUM_INODE(fs->super_block, inode->num));
+    }
+    wfs_io_unpin(fs->disk, inode, dirty);
+}
+
+// pins a block of directory entries, NULL if it cannot be read
+static struct wfs_dentry *pin_dentries(struct wfs_fs *fs, off_t block)
+{
+    struct wfs_dentry *entries = wfs_io_pin(fs->disk, block, BLOCK_SIZE);
+    if (entries != NULL &&
+        csum_verify(fs, WFS_CSUM_DATA(fs->super_block, block_index(fs, block)), entries, BLOCK_SIZE, "directory block", block) != 0)
+    {
+        wfs_io_unpin(fs->disk, entries, 0);
+        return NULL;
+    }
+    return entries;
+}
+
+static void unpin_dentries(struct wfs_fs *fs, off_t block, struct wfs_dentry *entries, int dirty)
+{
+    if (dirty)
+    {
+        csum_stale(fs, WFS_CSUM_DATA(fs->super_block, block_index(fs, block)));
+    }
+    wfs_io_unpin(fs->disk, entries, dirty);
+}
+
+// copies a whole block of directory entries out of the image
+static int read_dentries(struct wfs_fs *fs, off_t block, struct wfs_dentry *entries)
+{
+    if (wfs_io_read(fs->disk, block, entries, BLOCK_SIZE) != 0)
+    {
+        return -EIO;
+    }
+    return csum_verify(fs, WFS_CSUM_DATA(fs->super_block, block_index(fs, block)), entries, BLOCK_SIZE, "directory block", block);
+}
+
+// writes a whole block of directory entries to the image
+static int write_dentries(struct wfs_fs *fs, off_t block, const struct wfs_dentry *entries)
+{
+    int err = wfs_io_write(fs->disk, block, entries, BLOCK_SIZE);
+    if (err == 0)
+    {
+        csum_stale(fs, WFS_CSUM_DATA(fs->super_block, block_index(fs, block)));
+    }
+    return err;
+}
+
+// a block pointer of inode num changed, open files refill their maps
+static void map_changed(struct wfs_fs *fs, int num)
+{
+    fs->inode_gens[num].map++;
+}
+
+// bitmap is the specific bitmap pointer
+// value is the value to set in the idx specified
+// isBlocks is a boolean to decide which number of inodes or number of blocks to use.
+static int setbitmap(struct wfs_fs *fs, char *bitmap, int value, int idx, int isBlocks)
+{
+    int outer_iter = (isBlocks) ? fs->super_block->num_data_blocks : fs->super_block->num_inodes;
+    for (int i = 0; i < (outer_iter / 8); i++)
+    {
+        char *currByte = bitmap + i;
+        for (int j = 0; j < 8; j++)
+        {
+            if ((i * 8 + j) == idx)
+            {
+                char before = *currByte;
+                if (value == 1)
+                {
+                    *(currByte) |= (value << j);
+                }
+                else
+                {
+                    *(currByte) &= ~(1 << j);
+                }
+                // csum_bitmap patches in a flip, a bit already at value has none
+                if (*currByte != before)
+                {
+                    csum_bitmap(fs, isBlocks, idx, idx);
+                }
+                return value;
+            }
+        }
+    }
+    return -1;
+}
+
+// walks path from the root one directory at a time
+static struct wfs_inode *lookup_path(struct wfs_fs *fs, const char *path)
+{
+
+    // printf("the path is: %s\n", path);
+    // fetch the root inode
+    struct wfs_inode *curr_inode = pin_inode(fs, 0);
+    if (curr_inode == NULL)
+    {
+        return NULL;
+    }
+    // printf("the root inode is: %d\n", curr_inode->num);
+    // printf("size of size: %ld\n", curr_inode->size);
+    // printf("size of links: %d\n", curr_inode->nlinks);
+    // loop through the path
+    char *token;
+    char *copy_path = strdup(path);
+    char *rest = copy_path;
+    struct wfs_dentry *entries;
+    int i;
+    int found; // ensures the path has been found
+    int found_num = 0;
+    while ((token = strsep(&rest, "/")) != NULL)
+    {
+        // skip empty tokens
+        if (strcmp(token, "") == 0)
+        {
+            continue;
+        }
+        // printf("the token is: %s\n", token);
+        // nothing found yet
+        found = 0;
+        // fetch the datablock entries, all of them in one batch
+        wfs_io_prefetch(fs->disk, curr_inode->blocks, N_BLOCKS);
+        // look through current inodes data blocks
+        for (i = 0; i < N_BLOCKS; i++)
+        {
+            // printf("entering each block, current block: %ld\n", curr_inode->blocks[i]);
+            if (curr_inode->blocks[i] == 0)
+            {
+                continue;
+            }
+
+            entries = pin_dentries(fs, curr_inode->blocks[i]);
+            if (entries == NULL)
+            {
+                break;
+            }
+            for (int j = 0; j < BLOCK_SIZE / sizeof(struct wfs_dentry); j++)
+            {
+                // printf("Entry name: %s and the token: %s\n", entries[j].name, token);
+                if (strcmp(entries[j].name, token) == 0)
+                {
+                    found = 1;
+                    found_num = entries[j].num;
+                    break;
+                }
+            }
+            unpin_dentries(fs, curr_inode->blocks[i], entries, 0);
+            if (found)
+            {
+                break;
+            }
+        }
+        unpin_inode(fs, curr_inode, 0);
+        // if the path was never found, it does not exist
+        if (!found)
+        {
+            free(copy_path);
+            return NULL;
+        }
+
+        // printf("the entry num: %d\n", found_num);
+        // if it is found, update the current node
+        curr_inode = pin_inode(fs, found_num);
+        if (curr_inode == NULL)
+        {
+            free(copy_path);
+            return NULL;
+        }
+        // printf("the current node is found, and its num is: %d\n", curr_inode->num);
+    }
+    // printf("the current node is found, and its num is: %d\n", curr_inode->num);
+    // return the address of the inode, and free memory
+    free(copy_path);
+    return curr_inode;
+}
+
+// return a pointer to inode, or NULL if not found
+// fills up a given inode, given a path of a inode
+// the inode comes back pinned, release it with unpin_inode
+static struct wfs_inode *get_inode(struct wfs_fs *fs, const char *path)
+{
+    uint64_t start = wfs_stats_now();
+    struct wfs_inode *inode = lookup_path(fs, path);
+    wfs_stats_record(WFS_STATS_GET_INODE, start, inode == NULL);
+    return inode;
+}
+
+int wfs_fs_getattr(struct wfs_fs *fs, const char *path, struct stat *stbuf)
+{
+    // printf("entering getarr code\n");
+    struct wfs_inode *inode = get_inode(fs, path);
+    if (inode == NULL)
+    {
+        return -ENOENT;
+    }
+
+    // printf("the path is %s, and the inode fetched num is: %d, and uid: %d\n", path, inode->num, inode->uid);
+
+    // printf("the inode number is (getattr): %d\n",inode->num);
+
+    stbuf->st_ino = inode->num; // not sure if this one is correct.
+    // printf("the inode number is (getattr): %ld\n", stbuf->st_ino);
+    stbuf->st_mode = inode->mode;
+    stbuf->st_uid = inode->uid;
+    stbuf->st_gid = inode->gid;
+    stbuf->st_size = inode->size;
+    stbuf->st_nlink = inode->nlinks;
+    stbuf->st_blksize = BLOCK_SIZE;
+    // time attributes
+    stbuf->st_atime = inode->atim;
+    stbuf->st_mtime = inode->mtim;
+    stbuf->st_ctime = inode->ctim;
+    // calculate total number of blocks
+    int num_blocks = 0;
+    for (int i = 0; i < N_BLOCKS; i++)
+    {
+        if (inode->blocks[i] != 0)
+        {
+            num_blocks++;
+        }
+    }
+    stbuf->st_blocks = num_blocks;
+    unpin_inode(fs, inode, 0);
+
+    return 0;
+}
+
+// allocates an inode, and returns pointer to it.
+// sets basic attributes, inode num, uid, gid, time.
+// if not enough space, returns NULL
+// the inode comes back pinned, release it with unpin_inode
+static struct wfs_inode *allocate_inode(struct wfs_fs *fs, mode_t mode)
+{
+    char *bitmap = pin_bitmap(fs, 0);
+    int idx; // used to keep track of free spot in bitmap
+    struct wfs_inode *inode_ptr = NULL;
+    for (int i = 0; i < (fs->super_block->num_inodes / 8); i++)
+    {
+        // search by byte over i_bitmap
+        char *currByte = (bitmap + i);
+        for (int j = 0; j < 8; j++)
+        {
+            // check if value is equal to 0
+            if (((*currByte >> j) & 1) == 0)
+            {
+                idx = (i * 8) + j;
+                // a free slot is rewritten, whatever it held does not matter
+                if (has_feature(fs, WFS_FEATURE_CSUM))
+                {
+                    csum_mark(fs, WFS_CSUM_INODE(fs->super_block, idx));
+                }
+                inode_ptr = pin_inode(fs, idx);
+                if (inode_ptr == NULL)
+                {
+                    wfs_io_unpin(fs->disk, bitmap, 0);
+                    return NULL;
+                }
+                // found free spot, set to 1 and create inode
+                *currByte |= (1 << j);
+                wfs_io_unpin(fs->disk, bitmap, 1);
+                csum_bitmap(fs, 0, idx, idx);
+                // update inode basic attributes
+                // printf("the inode number that is found free is: %d\n", free_inode_num);
+                inode_ptr->num = idx;
+                inode_ptr->mode = mode;
+                inode_ptr->uid = getuid();
+                inode_ptr->gid = getgid();
+                inode_ptr->size = 0;   // initially empty
+                inode_ptr->nlinks = 0; // initially empty
+                inode_ptr->atim = time(NULL);
+                inode_ptr->mtim = time(NULL);
+                inode_ptr->ctim = time(NULL);
+                // set all blocks to unallocated
+                for (int k = 0; k < N_BLOCKS; k++)
+                {
+                    inode_ptr->blocks[k] = 0;
+                }
+                // returns the address of a inode pointer
+                return inode_ptr;
+            }
+        }
+    }
+    // if not enough space, will return null.
+    wfs_io_unpin(fs->disk, bitmap, 0);
+    return NULL;
+}
+
+// claims a free data block without touching its contents, for callers
+// about to write all of it. returns -1 if no space is left.
+static off_t claim_datablock(struct wfs_fs *fs)
+{
+    char *bitmap = pin_bitmap(fs, 1);
+    int n = fs->super_block->num_data_blocks;
+    for (int k = 0; k < n; k++)
+    {
+        int idx = (fs->next_datablock + k) % n;
+        // skip whole bytes of allocated blocks
+        if (idx % 8 == 0 && (unsigned char)bitmap[idx / 8] == 0xff)
+        {
+            k += 7;
+            continue;
+        }
+        if (((bitmap[idx / 8] >> (idx % 8)) & 1) == 0)
+        {
+            // update this bit to allocated
+            bitmap[idx / 8] |= (1 << (idx % 8));
+            wfs_io_unpin(fs->disk, bitmap, 1);
+            csum_bitmap(fs, 1, idx, idx);
+            if (has_feature(fs, WFS_FEATURE_REFCOUNT))
+            {
+                wfs_refcount_t *refcounts = pin_refcounts(fs);
+                refcounts[idx] = 1;
+                wfs_io_unpin(fs->disk, refcounts, 1);
+            }
+            fs->next_datablock = (idx + 1) % n;
+            return fs->super_block->d_blocks_ptr + (off_t)idx * BLOCK_SIZE;
+        }
+    }
+    wfs_io_unpin(fs->disk, bitmap, 0);
+    wfs_debug("out of data blocks");
+    return -1;
+}
+
+static void free_datablock(struct wfs_fs *fs, off_t datablock);
+
+// returns a offset from the datablock
+// Otherwise returns -1 if no more space left
+static off_t allocate_datablock(struct wfs_fs *fs)
+{
+    uint64_t start = wfs_stats_now();
+    off_t block = claim_datablock(fs);
+    // memset to 0
+    static const char zeroes[BLOCK_SIZE];
+    if (block != -1 && wfs_io_write(fs->disk, block, zeroes, BLOCK_SIZE) != 0)
+    {
+        free_datablock(fs, block);
+        block = -1;
+    }
+    wfs_stats_record(WFS_STATS_ALLOCATE_DATABLOCK, start, block == -1);
+    return block;
+}
+
+// returns the free slot hints of a directory, counting its entries first
+// if they are not known yet. NULL if a block cannot be read.
+static struct dir_hint *get_dir_hint(struct wfs_fs *fs, struct wfs_inode *directory)
+{
+    struct dir_hint *hint = &fs->dir_hints[directory->num];
+    uint32_t life = fs->inode_gens[directory->num].life;
+    if (hint->valid && hint->life == life)
+    {
+        return hint;
+    }
+    memset(hint, 0, sizeof(struct dir_hint));
+    for (int i = 0; i < N_BLOCKS; i++)
+    {
+        if (directory->blocks[i] == 0)
+        {
+            continue;
+        }
+        struct wfs_dentry *entries = pin_dentries(fs, directory->blocks[i]);
+        if (entries == NULL)
+        {
+            return NULL;
+        }
+        hint->first_free[i] = DENTRIES_PER_BLOCK;
+        for (int j = DENTRIES_PER_BLOCK - 1; j >= 0; j--)
+        {
+            if (entries[j].name[0] == '\0')
+            {
+                hint->free[i]++;
+                hint->first_free[i] = j;
+            }
+        }
+        unpin_dentries(fs, directory->blocks[i], entries, 0);
+    }
+    hint->life = life;
+    hint->valid = 1;
+    return hint;
+}
+
+// puts the entry in the first free slot, adding a block if there is none
+static int add_entry(struct wfs_fs *fs, struct wfs_inode *directory, char *file_name, int new_inode_num, mode_t mode)
+{
+    int n_blocks = 0;
+    if (S_ISDIR(mode))
+    {
+        n_blocks = N_BLOCKS;
+    }
+    else
+    {
+        // for a regular file
+        n_blocks = N_BLOCKS - 1;
+    }
+    // a block that already has room first, the hint says where to look.
+    // a hint found to be wrong says nothing about the other blocks either,
+    // it is rebuilt from the blocks and the scan runs once more.
+    struct dir_hint *hint = NULL;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        hint = get_dir_hint(fs, directory);
+        if (hint == NULL)
+        {
+            return -EIO;
+        }
+        int stale = 0;
+        for (int i = 0; i < n_blocks && !stale; i++)
+        {
+            if (hint->free[i] == 0)
+            {
+                continue;
+            }
+            struct wfs_dentry *entries = pin_dentries(fs, directory->blocks[i]);
+            if (entries == NULL)
+            {
+                return -EIO;
+            }
+            for (int j = hint->first_free[i]; j < DENTRIES_PER_BLOCK; j++)
+            {
+                if (entries[j].name[0] == '\0')
+                {
+                    strcpy(entries[j].name, file_name);
+                    entries[j].num = new_inode_num;
+                    unpin_dentries(fs, directory->blocks[i], entries, 1);
+                    hint->free[i]--;
+                    hint->first_free[i] = j + 1;
+                    return 0; // much success
+                }
+            }
+            unpin_dentries(fs, directory->blocks[i], entries, 0);
+            stale = 1;
+        }
+        if (!stale)
+        {
+            break;
+        }
+        hint->valid = 0;
+    }
+    // otherwise a new block in the first unused slot
+    for (int i = 0; i < n_blocks; i++)
+    {
+        if (directory->blocks[i] != 0)
+        {
+            continue;
+        }
+        // the whole block is written, it does not need zeroing first
+        off_t new_datablock = claim_datablock(fs);
+        if (new_datablock == -1)
+        {
+            return -ENOSPC;
+        }
+        directory->blocks[i] = new_datablock;
+        struct wfs_dentry new_entries[DENTRIES_PER_BLOCK] = {0};
+
+        strcpy(new_entries[0].name, file_name);
+        new_entries[0].num = new_inode_num;
+        hint->free[i] = DENTRIES_PER_BLOCK - 1;
+        hint->first_free[i] = 1;
+        return write_dentries(fs, new_datablock, new_entries);
+    }
+    return -1;
+}
+
+// inserts a entry into the given directory and returns 0
+// if it is full, will return -1
+static int insert_entry_into_directory(struct wfs_fs *fs, struct wfs_inode *directory, char *file_name, int new_inode_num, mode_t mode)
+{
+    uint64_t start = wfs_stats_now();
+    int err = add_entry(fs, directory, file_name, new_inode_num, mode);
+    wfs_stats_record(WFS_STATS_INSERT_ENTRY, start, err != 0);
+    return err;
+}
+
+// handles the basic inode insertion
+// creating inode, making space for it
+// and adding the inode to the parent directory
+
+static char *get_parent_path(const char *path)
+{
+    int last_slash_index = 0; // "/" is its own parent
+    for (int i = 0; i < strlen(path) - 1; i++)
+    {
+        if (path[i] == '/')
+        {
+            last_slash_index = i;
+        }
+    }
+    char *parent_path = strdup(path);
+    // seperate the parent path and child path
+    parent_path[last_slash_index + 1] = '\0';
+
+    return parent_path;
+}
+
+static char *get_file_name(const char *path)
+{
+    int last_slash_index = 0; // "/" is its own parent
+    for (int i = 0; i < strlen(path) - 1; i++)
+    {
+        if (path[i] == '/')
+        {
+            last_slash_index = i;
+        }
+    }
+    char *file_name = strdup(path + last_slash_index + 1);
+    return file_name;
+}
+
+/*
+  Snapshots (WFS_FEATURE_REFCOUNT). mkdir /.snapshots/<name> clones the
+  whole tree into a read-only directory of that name. Directories and
+  indirect blocks are copied but every file data block is shared with a
+  reference, so a snapshot costs metadata only and the live tree copies
+  a block the first time it writes to it (see store_block). rmdir of a
+  snapshot releases it again. Nothing else under /.snapshots can change.
+*/
+#define SNAPSHOT_DIR "/.snapshots"
+
+// returns nonzero for /.snapshots and everything below it
+static int is_snapshot_path(struct wfs_fs *fs, const char *path)
+{
+    size_t len = strlen(SNAPSHOT_DIR);
+    return has_feature(fs, WFS_FEATURE_REFCOUNT) && strncmp(path, SNAPSHOT_DIR, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/');
+}
+
+// returns the snapshot name if path is exactly /.snapshots/<name>, else NULL
+static const char *snapshot_name(struct wfs_fs *fs, const char *path)
+{
+    size_t len = strlen(SNAPSHOT_DIR);
+    if (!is_snapshot_path(fs, path) || path[len] != '/' || path[len + 1] == '\0' || strchr(path + len + 1, '/') != NULL)
+    {
+        return NULL;
+    }
+    return path + len + 1;
+}
+
+static int create_snapshot(struct wfs_fs *fs, const char *path);
+static int remove_snapshot(struct wfs_fs *fs, const char *path);
+
+static int handle_inode_insertion(struct wfs_fs *fs, const char *path, mode_t mode)
+{
+    // last slash before path has the new inode file name/location
+    //  ex: /siggy, here we would just grab siggy from this
+    // or /siggy/adam, here we would just grab adam
+
+    char *file_name = get_file_name(path);
+    char *parent_path = get_parent_path(path);
+    // get the parent, and allocate space for a new inode
+    struct wfs_inode *parent = get_inode(fs, parent_path);
+    free(parent_path);
+    // printf("the parent path is: %s\n", parent_path);
+    // check that parent path exists
+    if (parent == NULL)
+    {
+        free(file_name);
+        return -ENOENT;
+    }
+
+    // allocate the new inode
+    struct wfs_inode *new_inode = allocate_inode(fs, mode);
+    // make sure their is sufficient space for the inode
+    if (new_inode == NULL)
+    {
+        unpin_inode(fs, parent, 0);
+        free(file_name);
+        return -ENOSPC;
+    }
+
+    // insert the new node into the parent directory, which only changes
+    // the parent when it needs another block
+    struct wfs_inode before = *parent;
+    int is_inserted = insert_entry_into_directory(fs, parent, file_name, new_inode->num, mode);
+    unpin_inode(fs, new_inode, 1);
+    unpin_inode(fs, parent, memcmp(&before, parent, sizeof(before)) != 0);
+    free(file_name);
+    if (is_inserted == -1)
+    {
+        wfs_debug("%s: parent directory is full", path);
+        return -ENOSPC;
+    }
+
+    return is_inserted;
+}
+
+int wfs_fs_mknod(struct wfs_fs *fs, const char *path, mode_t mode)
+{
+    if (is_snapshot_path(fs, path))
+    {
+        return -EROFS;
+    }
+    int handled_insertion = handle_inode_insertion(fs, path, mode);
+    if (handled_insertion != 0)
+    {
+        return handled_insertion;
+    }
+
+    return 0; // Success
+}
+
+int wfs_fs_mkdir(struct wfs_fs *fs, const char *path, mode_t mode)
+{
+    // printf("entering mkdir\n");
+    // set the mode to directory
+    mode |= S_IFDIR;
+    if (is_snapshot_path(fs, path))
+    {
+        return create_snapshot(fs, path);
+    }
+    int handled_insertion = handle_inode_insertion(fs, path, mode);
+    if (handled_insertion != 0)
+    {
+        return handled_insertion;
+    }
+    return 0; // Success
+}
+
+// returns how many pointers share a data block, always 1 without refcounts
+static int get_refcount(struct wfs_fs *fs, off_t datablock)
+{
+    if (!has_feature(fs, WFS_FEATURE_REFCOUNT))
+    {
+        return 1;
+    }
+    wfs_refcount_t *refcounts = pin_refcounts(fs);
+    int count = refcounts[block_index(fs, datablock)];
+    wfs_io_unpin(fs->disk, refcounts, 0);
+    return count;
+}
+
+// adds a reference to an allocated data block so another pointer can
+// share it. returns -1 if the count is already at its maximum.
+static int ref_datablock(struct wfs_fs *fs, off_t datablock)
+{
+    wfs_refcount_t *refcounts = pin_refcounts(fs);
+    int idx = block_index(fs, datablock);
+    if (refcounts[idx] == 0 || refcounts[idx] == WFS_REFCOUNT_MAX)
+    {
+        wfs_io_unpin(fs->disk, refcounts, 0);
+        return -1;
+    }
+    refcounts[idx]++;
+    wfs_io_unpin(fs->disk, refcounts, 1);
+    return 0;
+}
+
+static void dedup_forget(struct wfs_fs *fs, off_t datablock);
+
+// drops a reference to the data block at the given offset and frees it
+// in the data bitmap once nothing points at it any more
+static void free_datablock(struct wfs_fs *fs, off_t datablock)
+{
+    if (has_feature(fs, WFS_FEATURE_REFCOUNT))
+    {
+        wfs_refcount_t *refcounts = pin_refcounts(fs);
+        int idx = block_index(fs, datablock);
+        if (refcounts[idx] > 1)
+        {
+            refcounts[idx]--;
+            wfs_io_unpin(fs->disk, refcounts, 1);
+            return;
+        }
+        refcounts[idx] = 0;
+        wfs_io_unpin(fs->disk, refcounts, 1);
+    }
+    if (has_feature(fs, WFS_FEATURE_DEDUP))
+    {
+        dedup_forget(fs, datablock);
+    }
+
+    char *bitmap = pin_bitmap(fs, 1);
+    setbitmap(fs, bitmap, 0, block_index(fs, datablock), 1);
+    wfs_io_unpin(fs->disk, bitmap, 1);
+    wfs_io_discard(fs->disk, datablock, BLOCK_SIZE);
+}
+
+// returns the block pointer for file block idx, 0 if there is none
+static off_t get_block_ptr(struct wfs_fs *fs, struct wfs_inode *inode, int idx)
+{
+    if (idx < IND_BLOCK)
+    {
+        return inode->blocks[idx];
+    }
+    if (idx >= MAX_FILE_BLOCKS || inode->blocks[IND_BLOCK] == 0)
+    {
+        return 0;
+    }
+    off_t ptr = 0;
+    wfs_io_read(fs->disk, inode->blocks[IND_BLOCK] + (idx - IND_BLOCK) * sizeof(off_t), &ptr, sizeof(off_t));
+    return ptr;
+}
+
+// stores the block pointer for file block idx, allocating the indirect
+// block the first time it is needed. returns 0 or a negative errno.
+static int set_block_ptr(struct wfs_fs *fs, struct wfs_inode *inode, int idx, off_t ptr)
+{
+    map_changed(fs, inode->num);
+    if (idx < IND_BLOCK)
+    {
+        inode->blocks[idx] = ptr;
+        return 0;
+    }
+    if (idx >= MAX_FILE_BLOCKS)
+    {
+        return -EFBIG;
+    }
+    if (inode->blocks[IND_BLOCK] == 0)
+    {
+        if (ptr == 0)
+        {
+            return 0;
+        }
+        off_t indirect = allocate_datablock(fs);
+        if (indirect == -1)
+        {
+            return -ENOSPC;
+        }
+        inode->blocks[IND_BLOCK] = indirect;
+    }
+    return wfs_io_write(fs->disk, inode->blocks[IND_BLOCK] + (idx - IND_BLOCK) * sizeof(off_t), &ptr, sizeof(off_t));
+}
+
+static void cluster_cache_init(struct wfs_fs *fs)
+{
+    for (int i = 0; i < CLUSTER_CACHE_ENTRIES; i++)
+    {
+        fs->cluster_cache[i].inode = -1;
+    }
+}
+
+static struct cluster_cache_entry *cluster_cache_find(struct wfs_fs *fs, int inode, int cluster)
+{
+    for (int i = 0; i < CLUSTER_CACHE_ENTRIES; i++)
+    {
+        if (fs->cluster_cache[i].inode == inode && fs->cluster_cache[i].cluster == cluster)
+        {
+            fs->cluster_cache[i].used = ++fs->cluster_cache_clock;
+            return &fs->cluster_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void cluster_cache_store(struct wfs_fs *fs, int inode, int cluster, const char *data)
+{
+    struct cluster_cache_entry *entry = cluster_cache_find(fs, inode, cluster);
+    if (entry == NULL)
+    {
+        entry = &fs->cluster_cache[0];
+        for (int i = 1; i < CLUSTER_CACHE_ENTRIES; i++)
+        {
+            if (fs->cluster_cache[i].used < entry->used)
+            {
+                entry = &fs->cluster_cache[i];
+            }
+        }
+        entry->inode = inode;
+        entry->cluster = cluster;
+        entry->used = ++fs->cluster_cache_clock;
+    }
+    memcpy(entry->data, data, CLUSTER_SIZE);
+}
+
+// drops every cached cluster of an inode, used when it is freed
+static void cluster_cache_forget(struct wfs_fs *fs, int inode)
+{
+    for (int i = 0; i < CLUSTER_CACHE_ENTRIES; i++)
+    {
+        if (fs->cluster_cache[i].inode == inode)
+        {
+            fs->cluster_cache[i].inode = -1;
+            fs->cluster_cache[i].used = 0;
+        }
+    }
+}
+
+// number of block pointers cluster c has, the last one is cut short
+// by the end of the indirect block
+static int cluster_slots(int c)
+{
+    return min(CLUSTER_BLOCKS, MAX_FILE_BLOCKS - c * CLUSTER_BLOCKS);
+}
+
+// reads cluster c of a file into data, CLUSTER_SIZE bytes with holes as zeroes
+static int load_cluster(struct wfs_fs *fs, struct wfs_inode *inode, int c, char *data)
+{
+    struct cluster_cache_entry *cached = cluster_cache_find(fs, inode->num, c);
+    if (cached != NULL)
+    {
+        memcpy(data, cached->data, CLUSTER_SIZE);
+        return 0;
+    }
+
+    off_t slots[CLUSTER_BLOCKS] = {0};
+    int nslots = cluster_slots(c);
+    for (int k = 0; k < nslots; k++)
+    {
+        slots[k] = get_block_ptr(fs, inode, c * CLUSTER_BLOCKS + k);
+    }
+    wfs_io_prefetch(fs->disk, slots, nslots);
+    memset(data, 0, CLUSTER_SIZE);
+
+    if (slots[0] == COMPRESSED_CLUSTER)
+    {
+        unsigned char packed[CLUSTER_SIZE];
+        int nblocks = 0;
+        while (nblocks + 1 < nslots && slots[nblocks + 1] != 0)
+        {
+            if (wfs_io_read(fs->disk, slots[nblocks + 1], packed + nblocks * BLOCK_SIZE, BLOCK_SIZE) != 0)
+            {
+                return -EIO;
+            }
+            nblocks++;
+        }
+        struct wfs_cluster_hdr hdr;
+        memcpy(&hdr, packed, sizeof(hdr));
+        if (hdr.clen + sizeof(hdr) > nblocks * BLOCK_SIZE || hdr.rawlen > CLUSTER_SIZE)
+        {
+            return -EIO;
+        }
+        int rawlen = wfs_lz_decompress(packed + sizeof(hdr), hdr.clen, (unsigned char *)data, CLUSTER_SIZE);
+        if (rawlen != hdr.rawlen)
+        {
+            return -EIO;
+        }
+    }
+    else
+    {
+        for (int k = 0; k < nslots; k++)
+        {
+            if (slots[k] != 0 && wfs_io_read(fs->disk, slots[k], data + k * BLOCK_SIZE, BLOCK_SIZE) != 0)
+            {
+                return -EIO;
+            }
+        }
+    }
+
+    cluster_cache_store(fs, inode->num, c, data);
+    return 0;
+}
+
+// writes cluster c back, compressed if that saves at least one block.
+// valid is how many bytes of data are inside the file. the blocks the
+// cluster already had are reused before new ones are allocated.
+static int store_cluster(struct wfs_fs *fs, struct wfs_inode *inode, int c, const char *data, int valid)
+{
+    int nslots = cluster_slots(c);
+    off_t slots[CLUSTER_BLOCKS] = {0};
+    off_t old[CLUSTER_BLOCKS];
+    int nold = 0;
+    for (int k = 0; k < nslots; k++)
+    {
+        slots[k] = get_block_ptr(fs, inode, c * CLUSTER_BLOCKS + k);
+        if (slots[k] != 0 && slots[k] != COMPRESSED_CLUSTER)
+        {
+            old[nold++] = slots[k];
+        }
+    }
+
+    unsigned char packed[CLUSTER_SIZE];
+    struct wfs_cluster_hdr hdr;
+    int room = (nslots - 1) * BLOCK_SIZE - sizeof(hdr);
+    int clen = wfs_lz_compress((const unsigned char *)data, valid, packed + sizeof(hdr), room);
+
+    const char *src;
+    off_t new_slots[CLUSTER_BLOCKS] = {0};
+    int nblocks;
+    int first;
+    if (clen > 0)
+    {
+        hdr.clen = clen;
+        hdr.rawlen = valid;
+        memcpy(packed, &hdr, sizeof(hdr));
+        src = (const char *)packed;
+        nblocks = (clen + sizeof(hdr) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        new_slots[0] = COMPRESSED_CLUSTER;
+        first = 1;
+    }
+    else
+    {
+        src = data;
+        nblocks = (valid + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        first = 0;
+    }
+
+    for (int k = 0; k < nblocks; k++)
+    {
+        off_t block = (k < nold) ? old[k] : allocate_datablock(fs);
+        if (block == -1)
+        {
+            return -ENOSPC;
+        }
+        new_slots[first + k] = block;
+        if (wfs_io_write(fs->disk, block, src + k * BLOCK_SIZE, BLOCK_SIZE) != 0)
+        {
+            return -EIO;
+        }
+    }
+    for (int k = nblocks; k < nold; k++)
+    {
+        free_datablock(fs, old[k]);
+    }
+    for (int k = 0; k < nslots; k++)
+    {
+        if (new_slots[k] != slots[k])
+        {
+            int err = set_block_ptr(fs, inode, c * CLUSTER_BLOCKS + k, new_slots[k]);
+            if (err != 0)
+            {
+                return err;
+            }
+        }
+    }
+
+    cluster_cache_store(fs, inode->num, c, data);
+    return 0;
+}
+
+// read path for images with compressed clusters
+static int read_compressed(struct wfs_fs *fs, struct wfs_inode *inode, char *buf, size_t n, off_t offset)
+{
+    if (offset >= inode->size)
+    {
+        return 0;
+    }
+    n = min(n, inode->size - offset);
+    char data[CLUSTER_SIZE];
+    size_t done = 0;
+    while (done < n)
+    {
+        off_t pos = offset + done;
+        int c = pos / CLUSTER_SIZE;
+        int err = load_cluster(fs, inode, c, data);
+        if (err != 0)
+        {
+            return err;
+        }
+        size_t in_cluster = pos % CLUSTER_SIZE;
+        size_t len = min(CLUSTER_SIZE - in_cluster, n - done);
+        memcpy(buf + done, data + in_cluster, len);
+        done += len;
+    }
+    return done;
+}
+
+// write path for images with compressed clusters: every cluster the write
+// touches is read, patched and compressed again
+static int write_compressed(struct wfs_fs *fs, struct wfs_inode *inode, const char *buf, size_t size, off_t offset)
+{
+    off_t end = offset + size;
+    if (end > (off_t)MAX_FILE_BLOCKS * BLOCK_SIZE)
+    {
+        return -ENOSPC;
+    }
+    off_t new_size = (end > inode->size) ? end : inode->size;
+    char data[CLUSTER_SIZE];
+    size_t done = 0;
+    while (done < size)
+    {
+        off_t pos = offset + done;
+        int c = pos / CLUSTER_SIZE;
+        off_t cluster_start = (off_t)c * CLUSTER_SIZE;
+        size_t in_cluster = pos - cluster_start;
+        size_t len = min(CLUSTER_SIZE - in_cluster, size - done);
+
+        // a cluster that is overwritten completely does not need reading
+        if (in_cluster != 0 || len != CLUSTER_SIZE)
+        {
+            int err = load_cluster(fs, inode, c, data);
+            if (err != 0)
+            {
+                return err;
+            }
+        }
+        memcpy(data + in_cluster, buf + done, len);
+
+        int valid = min(min(CLUSTER_SIZE, new_size - cluster_start), cluster_slots(c) * BLOCK_SIZE);
+        memset(data + valid, 0, CLUSTER_SIZE - valid);
+        int err = store_cluster(fs, inode, c, data, valid);
+        if (err != 0)
+        {
+            return err;
+        }
+        done += len;
+    }
+    inode->size = new_size;
+    return size;
+}
+
+static void dedup_init(struct wfs_fs *fs)
+{
+    if (!has_feature(fs, WFS_FEATURE_DEDUP))
+    {
+        return;
+    }
+    size_t slots = 1;
+    while (slots < fs->super_block->num_data_blocks && slots < DEDUP_INDEX_MAX)
+    {
+        slots <<= 1;
+    }
+    fs->dedup_index = calloc(slots, sizeof(struct dedup_entry));
+    fs->dedup_index_mask = slots - 1;
+}
+
+// 64-bit FNV-1a over a word at a time, matches are confirmed with memcmp
+// so this only has to spread blocks across the index
+static uint64_t block_hash(const char *data)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < BLOCK_SIZE; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+// returns a data block whose contents equal data, 0 if none is known
+static off_t dedup_find(struct wfs_fs *fs, const char *data, uint64_t hash)
+{
+    if (fs->dedup_index == NULL)
+    {
+        return 0;
+    }
+    struct dedup_entry *entry = &fs->dedup_index[hash & fs->dedup_index_mask];
+    if (entry->block == 0 || entry->hash != hash)
+    {
+        return 0;
+    }
+    char existing[BLOCK_SIZE];
+    if (wfs_io_read(fs->disk, entry->block, existing, BLOCK_SIZE) != 0 || memcmp(existing, data, BLOCK_SIZE) != 0)
+    {
+        return 0;
+    }
+    return entry->block;
+}
+
+static void dedup_insert(struct wfs_fs *fs, uint64_t hash, off_t datablock)
+{
+    if (fs->dedup_index == NULL)
+    {
+        return;
+    }
+    fs->dedup_index[hash & fs->dedup_index_mask].hash = hash;
+    fs->dedup_index[hash & fs->dedup_index_mask].block = datablock;
+}
+
+// drops the index entry for a block that is about to be freed or
+// overwritten, so nothing can be shared with its old contents later
+static void dedup_forget(struct wfs_fs *fs, off_t datablock)
+{
+    char data[BLOCK_SIZE];
+    if (fs->dedup_index == NULL || wfs_io_read(fs->disk, datablock, data, BLOCK_SIZE) != 0)
+    {
+        return;
+    }
+    struct dedup_entry *entry = &fs->dedup_index[block_hash(data) & fs->dedup_index_mask];
+    if (entry->block == datablock)
+    {
+        entry->block = 0;
+    }
+}
+
+// points file block idx at a block holding data. a block with the same
+// contents is shared when dedup knows one, a block of the file's own is
+// overwritten in place, and a shared block is left alone and replaced by
+// a new one.
+static int store_block(struct wfs_fs *fs, struct wfs_inode *inode, int idx, const char *data)
+{
+    off_t old = get_block_ptr(fs, inode, idx);
+    uint64_t hash = has_feature(fs, WFS_FEATURE_DEDUP) ? block_hash(data) : 0;
+
+    off_t match = dedup_find(fs, data, hash);
+    if (match != 0 && match == old)
+    {
+        return 0;
+    }
+    if (match != 0 && ref_datablock(fs, match) == 0)
+    {
+        int err = set_block_ptr(fs, inode, idx, match);
+        if (err != 0)
+        {
+            free_datablock(fs, match);
+            return err;
+        }
+        if (old != 0)
+        {
+            free_datablock(fs, old);
+        }
+        return 0;
+    }
+
+    if (old != 0 && get_refcount(fs, old) == 1)
+    {
+        if (has_feature(fs, WFS_FEATURE_DEDUP))
+        {
+            dedup_forget(fs, old);
+        }
+        if (wfs_io_write(fs->disk, old, data, BLOCK_SIZE) != 0)
+        {
+            return -EIO;
+        }
+        dedup_insert(fs, hash, old);
+        return 0;
+    }
+
+    // all of the new block is written below, no need to zero it first
+    off_t block = claim_datablock(fs);
+    if (block == -1)
+    {
+        return -ENOSPC;
+    }
+    int err = set_block_ptr(fs, inode, idx, block);
+    if (err == 0 && wfs_io_write(fs->disk, block, data, BLOCK_SIZE) != 0)
+    {
+        set_block_ptr(fs, inode, idx, old);
+        err = -EIO;
+    }
+    if (err != 0)
+    {
+        free_datablock(fs, block);
+        return err;
+    }
+    if (old != 0)
+    {
+        free_datablock(fs, old);
+    }
+    dedup_insert(fs, hash, block);
+    return 0;
+}
+
+// write path for every image without compressed clusters. a block only
+// this file points at is patched in place, anything new or shared goes
+// through store_block. only the blocks at either end of a request can be
+// partial, so a large request is one pass with no fill reads in between.
+static int write_blocks(struct wfs_fs *fs, struct wfs_inode *inode, const char *buf, size_t size, off_t offset)
+{
+    off_t end = offset + size;
+    if (end > (off_t)MAX_FILE_BLOCKS * BLOCK_SIZE)
+    {
+        return -ENOSPC;
+    }
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    // fetch the partial blocks at either end in one batch
+    off_t edges[2] = {0, 0};
+    if (offset % BLOCK_SIZE != 0)
+    {
+        edges[0] = get_block_ptr(fs, inode, offset / BLOCK_SIZE);
+    }
+    if (end % BLOCK_SIZE != 0 && end / BLOCK_SIZE != offset / BLOCK_SIZE)
+    {
+        edges[1] = get_block_ptr(fs, inode, end / BLOCK_SIZE);
+    }
+    wfs_io_prefetch(fs->disk, edges, 2);
+
+    char data[BLOCK_SIZE];
+    size_t done = 0;
+    while (done < size)
+    {
+        off_t pos = offset + done;
+        int idx = pos / BLOCK_SIZE;
+        size_t in_block = pos % BLOCK_SIZE;
+        size_t len = min(BLOCK_SIZE - in_block, size - done);
+        off_t old = get_block_ptr(fs, inode, idx);
+
+        int err = 0;
+        if (old != 0 && !has_feature(fs, WFS_FEATURE_DEDUP) && get_refcount(fs, old) == 1)
+        {
+            if (wfs_io_write(fs->disk, old + in_block, buf + done, len) != 0)
+            {
+                err = -EIO;
+            }
+        }
+        else if (len == BLOCK_SIZE)
+        {
+            err = store_block(fs, inode, idx, buf + done);
+        }
+        else
+        {
+            memset(data, 0, BLOCK_SIZE);
+            if (old != 0 && wfs_io_read(fs->disk, old, data, BLOCK_SIZE) != 0)
+            {
+                return -EIO;
+            }
+            memcpy(data + in_block, buf + done, len);
+            err = store_block(fs, inode, idx, data);
+        }
+        if (err != 0)
+        {
+            return err;
+        }
+        done += len;
+        if (pos + (off_t)len > inode->size)
+        {
+            inode->size = pos + len;
+        }
+    }
+    return size;
+}
+
+// drops every data block of a file, including the indirect block, and
+// clears its block pointers. shared blocks stay allocated for whoever
+// else points at them.
+static void release_file_blocks(struct wfs_fs *fs, struct wfs_inode *inode)
+{
+    map_changed(fs, inode->num);
+    // decompressed copies of the file must not outlive it
+    cluster_cache_forget(fs, inode->num);
+
+    // free the direct pointers of this inode
+    for (int k = 0; k < N_BLOCKS - 1; k++)
+    {
+        if (inode->blocks[k] != 0 && inode->blocks[k] != COMPRESSED_CLUSTER)
+        {
+            // set the dbitmaps
+            free_datablock(fs, inode->blocks[k]);
+        }
+    }
+
+    // free the indirect pointers
+    if (inode->blocks[7] != 0)
+    {
+        off_t *offsets = wfs_io_pin(fs->disk, inode->blocks[7], BLOCK_SIZE);
+        if (offsets != NULL)
+        {
+            // free every indirect block
+            for (int k = 0; k < BLOCK_SIZE / sizeof(off_t); k++)
+            {
+                if (offsets[k] != 0 && offsets[k] != COMPRESSED_CLUSTER)
+                {
+                    // set the dbitmaps
+                    free_datablock(fs, offsets[k]);
+                }
+            }
+            wfs_io_unpin(fs->disk, offsets, 0);
+        }
+        // and the block holding the pointers
+        free_datablock(fs, inode->blocks[7]);
+    }
+    memset(inode->blocks, 0, sizeof(inode->blocks));
+}
+
+// frees an inode and drops its data blocks. the caller removes its dentry.
+static int free_inode(struct wfs_fs *fs, int num, int is_directory)
+{
+    struct wfs_inode *curr_inode = pin_inode(fs, num);
+    if (curr_inode == NULL)
+        return -EIO;
+
+    // free inode, handles still open on it go stale
+    fs->inode_gens[num].life++;
+    char *inode_bitmap = pin_bitmap(fs, 0);
+    setbitmap(fs, inode_bitmap, 0, curr_inode->num, 0);
+    wfs_io_unpin(fs->disk, inode_bitmap, 1);
+
+    // if it is a directory, loop through all blocks and set to 0
+    if (is_directory)
+    {
+        // free the direct pointers of this inode
+        for (int k = 0; k < N_BLOCKS; k++)
+        {
+            if (curr_inode->blocks[k] != 0)
+            {
+                // set the dbitmaps
+                free_datablock(fs, curr_inode->blocks[k]);
+            }
+        }
+        unpin_inode(fs, curr_inode, 0);
+        return 0;
+    }
+
+    // an empty file comes out of this unchanged, its checksum still holds
+    struct wfs_inode before = *curr_inode;
+    release_file_blocks(fs, curr_inode);
+    unpin_inode(fs, curr_inode, memcmp(&before, curr_inode, sizeof(before)) != 0);
+    return 0;
+}
+
+// finds and removes an entry given by name, returns 0
+// if entry is not found, will return -1
+static int delete(struct wfs_fs *fs, struct wfs_inode *directory, char *file_name, int is_directory)
+{
+    // taken before the entry goes so the counts match the blocks
+    struct dir_hint *hint = get_dir_hint(fs, directory);
+    if (hint == NULL)
+        return -EIO;
+
+    for (int i = 0; i < N_BLOCKS; i++)
+    {
+        // continue over non-available data blocks.
+        if (directory->blocks[i] == 0)
+            continue;
+
+        struct wfs_dentry *entries = pin_dentries(fs, directory->blocks[i]);
+        if (entries == NULL)
+            return -EIO;
+
+        // loop over data entries to find within block
+        for (int j = 0; j < DENTRIES_PER_BLOCK; j++)
+        {
+            struct wfs_dentry *entry = &entries[j];
+
+            if (strcmp(entry->name, file_name) == 0)
+            {
+                // found so delete entry (set it to empty)
+                strcpy(entry->name, "");
+                int num = entry->num;
+                unpin_dentries(fs, directory->blocks[i], entries, 1);
+                hint->free[i]++;
+                if (j < hint->first_free[i])
+                    hint->first_free[i] = j;
+                // a block left with no entries goes back, so a directory
+                // that churns does not keep its high water mark of blocks
+                if (hint->free[i] == DENTRIES_PER_BLOCK)
+                {
+                    free_datablock(fs, directory->blocks[i]);
+                    directory->blocks[i] = 0;
+                    hint->free[i] = 0;
+                    hint->first_free[i] = 0;
+                }
+                // free from parents
+                return free_inode(fs, num, is_directory);
+            }
+        }
+        unpin_dentries(fs, directory->blocks[i], entries, 0);
+    }
+    return 0;
+}
+
+// points a clone at a data block, sharing it unless its count is full
+static off_t share_datablock(struct wfs_fs *fs, off_t datablock)
+{
+    if (ref_datablock(fs, datablock) == 0)
+    {
+        return datablock;
+    }
+    char data[BLOCK_SIZE];
+    off_t copy = allocate_datablock(fs);
+    if (copy == -1 || wfs_io_read(fs->disk, datablock, data, BLOCK_SIZE) != 0 || wfs_io_write(fs->disk, copy, data, BLOCK_SIZE) != 0)
+    {
+        return -1;
+    }
+    return copy;
+}
+
+// fills blocks with pointers sharing the file data blocks in src. the
+// indirect block is copied, a file can only change pointers it owns. on
+// failure blocks holds what was shared so far for release_file_blocks.
+static int share_file_blocks(struct wfs_fs *fs, const off_t *src, off_t *blocks)
+{
+    memset(blocks, 0, N_BLOCKS * sizeof(off_t));
+    for (int i = 0; i < IND_BLOCK; i++)
+    {
+        if (src[i] == 0)
+        {
+            continue;
+        }
+        blocks[i] = share_datablock(fs, src[i]);
+        if (blocks[i] == -1)
+        {
+            blocks[i] = 0;
+            return -ENOSPC;
+        }
+    }
+    if (src[IND_BLOCK] == 0)
+    {
+        return 0;
+    }
+
+    off_t offsets[BLOCK_SIZE / sizeof(off_t)];
+    if (wfs_io_read(fs->disk, src[IND_BLOCK], offsets, BLOCK_SIZE) != 0)
+    {
+        return -EIO;
+    }
+    off_t indirect = allocate_datablock(fs);
+    if (indirect == -1)
+    {
+        return -ENOSPC;
+    }
+    int err = 0;
+    for (int j = 0; j < BLOCK_SIZE / sizeof(off_t); j++)
+    {
+        if (offsets[j] == 0)
+        {
+            continue;
+        }
+        offsets[j] = (err == 0) ? share_datablock(fs, offsets[j]) : -1;
+        if (offsets[j] == -1)
+        {
+            offsets[j] = 0;
+            err = -ENOSPC;
+        }
+    }
+    blocks[IND_BLOCK] = indirect;
+    if (wfs_io_write(fs->disk, indirect, offsets, BLOCK_SIZE) != 0 && err == 0)
+    {
+        err = -EIO;
+    }
+    return err;
+}
+
+// releases everything below a directory, not the directory itself
+static void release_children(struct wfs_fs *fs, int num);
+
+// makes a read-only copy of inode num and everything below it, returns
+// the new inode number or a negative errno. whatever was copied before
+// a failure stays linked into the new tree so release_children can undo it.
+static int clone_inode(struct wfs_fs *fs, int num)
+{
+    struct wfs_inode *src = pin_inode(fs, num);
+    if (src == NULL)
+    {
+        return -EIO;
+    }
+    struct wfs_inode copy = *src;
+    unpin_inode(fs, src, 0);
+
+    struct wfs_inode *dst = allocate_inode(fs, copy.mode & ~0222);
+    if (dst == NULL)
+    {
+        return -ENOSPC;
+    }
+    int dst_num = dst->num;
+    dst->uid = copy.uid;
+    dst->gid = copy.gid;
+    dst->size = copy.size;
+    dst->nlinks = copy.nlinks;
+    dst->atim = copy.atim;
+    dst->mtim = copy.mtim;
+    dst->ctim = copy.ctim;
+    unpin_inode(fs, dst, 1);
+
+    off_t blocks[N_BLOCKS] = {0};
+    int err = 0;
+    if (!S_ISDIR(copy.mode))
+    {
+        err = share_file_blocks(fs, copy.blocks, blocks);
+    }
+    for (int i = 0; i < N_BLOCKS && S_ISDIR(copy.mode) && err == 0; i++)
+    {
+        if (copy.blocks[i] == 0)
+        {
+            continue;
+        }
+        struct wfs_dentry entries[BLOCK_SIZE / sizeof(struct wfs_dentry)];
+        if (read_dentries(fs, copy.blocks[i], entries) != 0)
+        {
+            err = -EIO;
+            break;
+        }
+        blocks[i] = allocate_datablock(fs);
+        if (blocks[i] == -1)
+        {
+            blocks[i] = 0;
+            err = -ENOSPC;
+            break;
+        }
+        for (int j = 0; j < BLOCK_SIZE / sizeof(struct wfs_dentry); j++)
+        {
+            if (strcmp(entries[j].name, "") == 0)
+            {
+                continue;
+            }
+            // the snapshots are not part of the snapshot
+            if (num == 0 && strcmp(entries[j].name, SNAPSHOT_DIR + 1) == 0)
+            {
+                strcpy(entries[j].name, "");
+                continue;
+            }
+            int child = (err == 0) ? clone_inode(fs, entries[j].num) : err;
+            if (child < 0)
+            {
+                err = child;
+                strcpy(entries[j].name, "");
+                continue;
+            }
+            entries[j].num = child;
+        }
+        if (write_dentries(fs, blocks[i], entries) != 0 && err == 0)
+        {
+            err = -EIO;
+        }
+    }
+
+    dst = pin_inode(fs, dst_num);
+    if (dst == NULL)
+    {
+        return -EIO;
+    }
+    memcpy(dst->blocks, blocks, sizeof(blocks));
+    unpin_inode(fs, dst, 1);
+    if (err != 0)
+    {
+        if (S_ISDIR(copy.mode))
+        {
+            release_children(fs, dst_num);
+        }
+        free_inode(fs, dst_num, S_ISDIR(copy.mode));
+        return err;
+    }
+    return dst_num;
+}
+
+static void release_children(struct wfs_fs *fs, int num)
+{
+    struct wfs_inode *dir = pin_inode(fs, num);
+    if (dir == NULL)
+    {
+        return;
+    }
+    off_t blocks[N_BLOCKS];
+    memcpy(blocks, dir->blocks, sizeof(blocks));
+    unpin_inode(fs, dir, 0);
+
+    for (int i = 0; i < N_BLOCKS; i++)
+    {
+        struct wfs_dentry entries[BLOCK_SIZE / sizeof(struct wfs_dentry)];
+        if (blocks[i] == 0 || read_dentries(fs, blocks[i], entries) != 0)
+        {
+            continue;
+        }
+        for (int j = 0; j < BLOCK_SIZE / sizeof(struct wfs_dentry); j++)
+        {
+            if (strcmp(entries[j].name, "") == 0)
+            {
+                continue;
+            }
+            struct wfs_inode *child = pin_inode(fs, entries[j].num);
+            if (child == NULL)
+            {
+                continue;
+            }
+            int is_directory = S_ISDIR(child->mode);
+            unpin_inode(fs, child, 0);
+            if (is_directory)
+            {
+                release_children(fs, entries[j].num);
+            }
+            free_inode(fs, entries[j].num, is_directory);
+        }
+    }
+}
+
+// mkdir /.snapshots/<name>
+static int create_snapshot(struct wfs_fs *fs, const char *path)
+{
+    const char *name = snapshot_name(fs, path);
+    if (name == NULL)
+    {
+        return -EROFS;
+    }
+    if (strlen(name) >= MAX_NAME)
+    {
+        return -ENAMETOOLONG;
+    }
+    struct wfs_inode *snapshots = get_inode(fs, SNAPSHOT_DIR);
+    if (snapshots == NULL)
+    {
+        int err = handle_inode_insertion(fs, SNAPSHOT_DIR, S_IFDIR | 0555);
+        if (err != 0)
+        {
+            return err;
+        }
+        snapshots = get_inode(fs, SNAPSHOT_DIR);
+        if (snapshots == NULL)
+        {
+            return -EIO;
+        }
+    }
+    struct wfs_inode *existing = get_inode(fs, path);
+    if (existing != NULL)
+    {
+        unpin_inode(fs, existing, 0);
+        unpin_inode(fs, snapshots, 0);
+        return -EEXIST;
+    }
+    // the directory inode is copied in place, release the pin meanwhile
+    int snapshots_num = snapshots->num;
+    unpin_inode(fs, snapshots, 0);
+
+    int root = clone_inode(fs, 0);
+    if (root < 0)
+    {
+        return root;
+    }
+    snapshots = pin_inode(fs, snapshots_num);
+    if (snapshots == NULL)
+    {
+        return -EIO;
+    }
+    int err = insert_entry_into_directory(fs, snapshots, (char *)name, root, S_IFDIR);
+    unpin_inode(fs, snapshots, 1);
+    if (err != 0)
+    {
+        release_children(fs, root);
+        free_inode(fs, root, 1);
+        return (err == -1) ? -ENOSPC : err;
+    }
+    return 0;
+}
+
+// rmdir /.snapshots/<name>
+static int remove_snapshot(struct wfs_fs *fs, const char *path)
+{
+    const char *name = snapshot_name(fs, path);
+    if (name == NULL)
+    {
+        return -EROFS;
+    }
+    struct wfs_inode *root = get_inode(fs, path);
+    if (root == NULL)
+    {
+        return -ENOENT;
+    }
+    int num = root->num;
+    unpin_inode(fs, root, 0);
+
+    struct wfs_inode *snapshots = get_inode(fs, SNAPSHOT_DIR);
+    if (snapshots == NULL)
+    {
+        return -ENOENT;
+    }
+    release_children(fs, num);
+    int err = delete(fs, snapshots, (char *)name, 1);
+    unpin_inode(fs, snapshots, 1);
+    return err;
+}
+
+static int handle_unlinking(struct wfs_fs *fs, const char *path, int is_directory)
+{
+    char *parent_path = get_parent_path(path);
+    struct wfs_inode *parent = get_inode(fs, parent_path);
+    free(parent_path);
+    if (parent == NULL)
+    {
+        return -ENOENT;
+    }
+
+    char *file_name = get_file_name(path);
+    // struct wfs_inode *inode = get_inode(file_name);
+    // if it is a directory, first need to remove cd . & cd ..
+    int is_unlinked;
+
+    // unlink from parent directory, remove entry from data bitmap and inode bitmap
+    struct wfs_inode before = *parent;
+    is_unlinked = delete(fs, parent, file_name,is_directory);
+    free(file_name);
+    // delete may have given back one of its blocks
+    unpin_inode(fs, parent, memcmp(&before, parent, sizeof(before)) != 0);
+    if (is_unlinked == -1)
+    {
+        return -EEXIST;
+    }
+    if (is_unlinked != 0)
+    {
+        return is_unlinked;
+    }
+
+    //  unallocate it in the inode bitmap
+    // //set this inode to free in inode bitmap
+    // printf("the i node number is: %d and its allocationow haven: %d\n", inode->num, *(file_system + super_block->i_bitmap_ptr + inode->num));
+    // setbitmap((char *)(file_system + super_block->i_bitmap_ptr), 0, inode->num, 0);
+    // printf("the i node number is: %d and its allocation: %d\n", inode->num, *(file_system + super_block->i_bitmap_ptr + inode->num));
+    // printf("now have freed the inode\n");
+
+    return 0;
+}
+
+int wfs_fs_unlink(struct wfs_fs *fs, const char *path)
+{
+    if (is_snapshot_path(fs, path))
+    {
+        return -EROFS;
+    }
+    int is_unlinked = handle_unlinking(fs, path, 0);
+
+    if (is_unlinked != 0)
+    {
+        return is_unlinked;
+    }
+
+    return 0;
+}
+
+int wfs_fs_rmdir(struct wfs_fs *fs, const char *path)
+{
+    if (is_snapshot_path(fs, path))
+    {
+        return remove_snapshot(fs, path);
+    }
+    int is_unlinked = handle_unlinking(fs, path,1);
+
+    if (is_unlinked != 0)
+    {
+        return is_unlinked;
+    }
+    return 0;
+}
+
+int wfs_fs_readdir(struct wfs_fs *fs, const char *path, wfs_filler_t fill, void *ctx)
+{
+    // printf("In readdir: %s\n", path);
+    struct wfs_inode *directory = get_inode(fs, path); // get parent_dir
+
+    if (directory == NULL)
+    {
+        return -ENOENT;
+    }
+    // printf("After get inode\n");
+    // check that it is directory
+    if (!S_ISDIR(directory->mode))
+    {
+        wfs_debug("readdir of %s, mode %o is not a directory", path, directory->mode);
+        unpin_inode(fs, directory, 0);
+        return -ENOTDIR;
+    }
+    // copy the block list so the directory inode can be released
+    off_t dir_blocks[N_BLOCKS];
+    memcpy(dir_blocks, directory->blocks, sizeof(dir_blocks));
+    unpin_inode(fs, directory, 0);
+    wfs_io_prefetch(fs->disk, dir_blocks, N_BLOCKS);
+
+    // add cd . and cd ..
+    char *cd[2] = {".", ".."};
+    char path_checked[strlen(path) + 1];
+    for (int i = 0; i < 2; i++)
+    {
+
+        struct stat statbuf;
+        // concat the entire path, path/dentry
+        // cd .
+        if (i == 0)
+        {
+            strcpy(path_checked, path);
+        }
+        // cd ..
+        else
+        {
+            char *parent_path = get_parent_path(path);
+            strcpy(path_checked, parent_path);
+            free(parent_path);
+        }
+
+        if (wfs_fs_getattr(fs, path_checked, &statbuf) != 0)
+        {
+            wfs_warn("readdir of %s: cannot stat %s", path, path_checked);
+            return -EIO;
+        }
+
+        // add it to the buffer
+        if (fill(ctx, cd[i], &statbuf) != 0)
+        {
+            wfs_trace("readdir of %s: buffer full", path);
+            return 0;
+        }
+    }
+
+    int i;
+    int j;
+    struct wfs_dentry *dentry;
+    // loop over every block
+    for (i = 0; i < N_BLOCKS; i++)
+    {
+
+        off_t d_offset = dir_blocks[i];
+        // skip over empty entries
+        if (d_offset == 0)
+        {
+            // printf("d_offset: %d\n", d_offset);
+            continue;
+        }
+
+        struct wfs_dentry *entries = pin_dentries(fs, d_offset);
+        if (entries == NULL)
+        {
+            return -EIO;
+        }
+
+        // every block (512 bytes) has 16 possible dentries.
+        for (j = 0; j < BLOCK_SIZE / sizeof(struct wfs_dentry); j++)
+        {
+
+            // calculate the address of the entry
+            dentry = &entries[j];
+            // printf("block: %d, offset: %d dentry is: %s\n", i,j,dentry->name);
+
+            // snapshots stay reachable by path but out of listings of
+            // the root, so walking the tree does not copy them all again
+            if (strcmp(path, "/") == 0 && is_snapshot_path(fs, SNAPSHOT_DIR) && strcmp(dentry->name, SNAPSHOT_DIR + 1) == 0)
+            {
+                continue;
+            }
+
+            // if it is not an empty string (valid), add it
+            if (strcmp(dentry->name, "") != 0)
+            {
+                struct stat statbuf;
+                // concat the entire path, path/dentry
+                char subfile_path[MAX_NAME + 2 + strlen(path)];
+                strcpy(subfile_path, path);
+                strcat(subfile_path, "/");
+                strcat(subfile_path, dentry->name);
+                if (wfs_fs_getattr(fs, subfile_path, &statbuf) != 0)
+                {
+                    wfs_warn("readdir of %s: cannot stat %s", path, subfile_path);
+                    unpin_dentries(fs, d_offset, entries, 0);
+                    return -EIO;
+                }
+
+                // add it to the buffer
+                if (fill(ctx, dentry->name, &statbuf) != 0)
+                {
+                    wfs_trace("readdir of %s: buffer full", path);
+                    unpin_dentries(fs, d_offset, entries, 0);
+                    return 0;
+                }
+            }
+        }
+        unpin_dentries(fs, d_offset, entries, 0);
+    }
+    // printf("finished readdir\n");
+    return 0;
+}
+
+// an open file: the inode resolved once at open
+// and, after the first read, the file's block map so reads skip both the
+// path walk and the indirect block
+struct wfs_file
+{
+    int num;
+    uint32_t life;    // inode_gens[num].life at open
+    uint32_t map_gen; // inode_gens[num].map when map was filled
+    int mapped;
+    off_t map[MAX_FILE_BLOCKS];
+    // readahead: a read starting where the last one ended continues a
+    // sequential stream, anything else is a random read
+    off_t ra_next;  // offset right after the last read
+    int ra_window;  // blocks asked for at a time, 0 if random
+    int ra_until;   // file blocks below this were already asked for
+    int ra_misses;  // random reads in a row
+    int ra_random;  // the file's blocks are advised random
+};
+
+// the window starts at one page and doubles every time it is used
+#define RA_MIN_BLOCKS (4096 / BLOCK_SIZE)
+#define RA_MAX_BLOCKS (MAX_FILE_BLOCKS)
+// random reads in a row before the blocks are advised random
+#define RA_RANDOM_AFTER (2)
+
+// resolves the inode an operation works on, through the open file when
+// there is one. comes back pinned like get_inode, NULL once the file was
+// deleted under the handle.
+static struct wfs_inode *op_inode(struct wfs_fs *fs, const char *path, struct wfs_file *file)
+{
+    if (file == NULL)
+    {
+        return get_inode(fs, path);
+    }
+    if (fs->inode_gens[file->num].life != file->life)
+    {
+        return NULL;
+    }
+    return pin_inode(fs, file->num);
+}
+
+// get_block_ptr through the open file's block map, refilled when any
+// pointer of the inode changed since it was taken
+static off_t file_block(struct wfs_fs *fs, struct wfs_file *file, struct wfs_inode *inode, int idx)
+{
+    if (file == NULL || idx >= MAX_FILE_BLOCKS)
+    {
+        return get_block_ptr(fs, inode, idx);
+    }
+    if (!file->mapped || file->map_gen != fs->inode_gens[file->num].map)
+    {
+        memcpy(file->map, inode->blocks, IND_BLOCK * sizeof(off_t));
+        memset(file->map + IND_BLOCK, 0, (MAX_FILE_BLOCKS - IND_BLOCK) * sizeof(off_t));
+        if (inode->blocks[IND_BLOCK] != 0 && wfs_io_read(fs->disk, inode->blocks[IND_BLOCK], file->map + IND_BLOCK, BLOCK_SIZE) != 0)
+        {
+            file->mapped = 0;
+            return get_block_ptr(fs, inode, idx);
+        }
+        file->map_gen = fs->inode_gens[file->num].map;
+        file->mapped = 1;
+    }
+    return file->map[idx];
+}
+
+// called with the blocks of a read at offset mapped. a sequential
+// stream gets the blocks after the read asked for with a window that
+// grows, a stream of random reads gets its blocks advised random so the
+// backend stops reading around them.
+static void file_readahead(struct wfs_fs *fs, struct wfs_file *file, struct wfs_inode *inode, off_t offset, size_t n)
+{
+    int last = (offset + n - 1) / BLOCK_SIZE;
+    int nblocks = min((inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE, MAX_FILE_BLOCKS);
+    int sequential = offset == file->ra_next;
+    file->ra_next = offset + n;
+    if (!sequential)
+    {
+        file->ra_window = 0;
+        file->ra_until = 0;
+        if (++file->ra_misses >= RA_RANDOM_AFTER && !file->ra_random)
+        {
+            wfs_io_advise_random(fs->disk, file->map, nblocks, 1);
+            file->ra_random = 1;
+        }
+        return;
+    }
+
+    file->ra_misses = 0;
+    if (file->ra_random)
+    {
+        wfs_io_advise_random(fs->disk, file->map, nblocks, 0);
+        file->ra_random = 0;
+    }
+    // the next window goes out once the stream is half way into the
+    // last one, so it is on its way before the reads get there
+    if (file->ra_until >= nblocks || last + 1 + file->ra_window / 2 < file->ra_until)
+    {
+        return;
+    }
+    file->ra_window = file->ra_window ? min(file->ra_window * 2, RA_MAX_BLOCKS) : RA_MIN_BLOCKS;
+    int from = (last + 1 > file->ra_until) ? last + 1 : file->ra_until;
+    int to = min(from + file->ra_window - 1, nblocks - 1);
+    if (from <= to)
+    {
+        wfs_io_readahead(fs->disk, file->map[from - 1], file->map + from, to - from + 1);
+    }
+    file->ra_until = to + 1;
+}
+
+int wfs_fs_open(struct wfs_fs *fs, const char *path, int flags, struct wfs_file **filep)
+{
+    struct wfs_inode *inode = get_inode(fs, path);
+    if (inode == NULL)
+    {
+        return -ENOENT;
+    }
+    int writing = (flags & O_ACCMODE) != O_RDONLY;
+    if (S_ISDIR(inode->mode) && writing)
+    {
+        unpin_inode(fs, inode, 0);
+        return -EISDIR;
+    }
+    if (writing && is_snapshot_path(fs, path))
+    {
+        unpin_inode(fs, inode, 0);
+        return -EROFS;
+    }
+
+    struct wfs_file *file = calloc(1, sizeof(struct wfs_file));
+    if (file == NULL)
+    {
+        unpin_inode(fs, inode, 0);
+        return -ENOMEM;
+    }
+    file->num = inode->num;
+    file->life = fs->inode_gens[inode->num].life;
+    unpin_inode(fs, inode, 0);
+    *filep = file;
+    return 0;
+}
+
+int wfs_fs_create(struct wfs_fs *fs, const char *path, mode_t mode, int flags, struct wfs_file **file)
+{
+    if (is_snapshot_path(fs, path))
+    {
+        return -EROFS;
+    }
+    int err = handle_inode_insertion(fs, path, mode);
+    if (err != 0)
+    {
+        return err;
+    }
+    return wfs_fs_open(fs, path, flags, file);
+}
+
+void wfs_fs_release(struct wfs_fs *fs, struct wfs_file *file)
+{
+    free(file);
+}
+
+// asks the io layer for every block backing [offset, offset + n) up front,
+// so a backend that can overlap reads fetches them as one batch
+static void prefetch_range(struct wfs_fs *fs, struct wfs_inode *inode, off_t offset, size_t n)
+{
+    if (n == 0)
+    {
+        return;
+    }
+    int first = offset / BLOCK_SIZE;
+    int last = (offset + n - 1) / BLOCK_SIZE;
+    off_t offs[N_BLOCKS];
+    int count = 0;
+    for (int i = first; i <= last && i < IND_BLOCK; i++)
+    {
+        offs[count++] = inode->blocks[i];
+    }
+    if (last >= IND_BLOCK)
+    {
+        offs[count++] = inode->blocks[IND_BLOCK];
+    }
+    wfs_io_prefetch(fs->disk, offs, count);
+
+    if (last < IND_BLOCK || inode->blocks[IND_BLOCK] == 0)
+    {
+        return;
+    }
+    off_t *indirect = wfs_io_pin(fs->disk, inode->blocks[IND_BLOCK], BLOCK_SIZE);
+    if (indirect == NULL)
+    {
+        return;
+    }
+    int start = (first > IND_BLOCK) ? first - IND_BLOCK : 0;
+    int end = min(last - IND_BLOCK + 1, BLOCK_SIZE / sizeof(off_t));
+    if (start < end)
+    {
+        wfs_io_prefetch(fs->disk, indirect + start, end - start);
+    }
+    wfs_io_unpin(fs->disk, indirect, 0);
+}
+
+int wfs_fs_read(struct wfs_fs *fs, const char *path, struct wfs_file *file, char *buf, size_t n, off_t offset)
+{
+    wfs_trace("read %s: %zu bytes at %ld", path, n, offset);
+    struct wfs_inode *file_node = op_inode(fs, path, file);
+    if (file_node == NULL)
+    {
+        wfs_debug("read of missing %s", path);
+        return -ENOENT;
+    }
+
+    if (has_feature(fs, WFS_FEATURE_COMPRESS))
+    {
+        int read = read_compressed(fs, file_node, buf, n, offset);
+        unpin_inode(fs, file_node, 0);
+        return read;
+    }
+
+    if (offset >= file_node->size)
+    {
+        unpin_inode(fs, file_node, 0);
+        return 0;
+    }
+    n = min(n, file_node->size - offset);
+    if (file == NULL)
+    {
+        prefetch_range(fs, file_node, offset, n);
+    }
+    else
+    {
+        // the block map already has every pointer the read needs
+        int first = offset / BLOCK_SIZE;
+        int last = (offset + n - 1) / BLOCK_SIZE;
+        file_block(fs, file, file_node, first);
+        if (file->mapped && first < MAX_FILE_BLOCKS)
+        {
+            // what this read needs first, a prefetch waits for the ring
+            wfs_io_prefetch(fs->disk, file->map + first, min(last, MAX_FILE_BLOCKS - 1) - first + 1);
+            file_readahead(fs, file, file_node, offset, n);
+        }
+    }
+
+    size_t bytes_read = 0; // use to decide when to break
+    while (bytes_read < n)
+    {
+        off_t pos = offset + bytes_read;
+        size_t block_offset = pos % BLOCK_SIZE;
+        size_t read_num = min(BLOCK_SIZE - block_offset, n - bytes_read); // do either whole block or whats left.
+        off_t block = file_block(fs, file, file_node, pos / BLOCK_SIZE);
+        if (block == 0)
+        {
+            // never written, reads back as zeroes
+            memset(buf + bytes_read, 0, read_num);
+        }
+        else if (wfs_io_read(fs->disk, block + block_offset, buf + bytes_read, read_num) != 0)
+        {
+            unpin_inode(fs, file_node, 0);
+            return -EIO;
+        }
+        bytes_read += read_num;
+    }
+
+    // printf("read over: %zu for %zu requested\n", bytes_read, n);
+    unpin_inode(fs, file_node, 0);
+    return bytes_read;
+}
+
+// writes data to a inode
+int wfs_fs_write(struct wfs_fs *fs, const char *path, struct wfs_file *file, const char *buf, size_t size, off_t offset)
+{
+    wfs_trace("write %s: %zu bytes at %ld", path, size, offset);
+
+    if (is_snapshot_path(fs, path))
+    {
+        return -EROFS;
+    }
+    struct wfs_inode *inode = op_inode(fs, path, file);
+    if (inode == NULL)
+    {
+        return -ENOENT;
+    }
+
+    int written;
+    if (has_feature(fs, WFS_FEATURE_COMPRESS))
+    {
+        written = write_compressed(fs, inode, buf, size, offset);
+    }
+    else
+    {
+        written = write_blocks(fs, inode, buf, size, offset);
+    }
+    unpin_inode(fs, inode, 1);
+    return written;
+}
+
+// makes file block out_idx of path_out share the data block behind file
+// block in_idx of path_in. returns 1 when there is nothing to share, a
+// hole or an image without refcounts, and the caller copies instead.
+static int reflink_block(struct wfs_fs *fs, const char *path_in, int in_idx, const char *path_out, int out_idx)
+{
+    if (!has_feature(fs, WFS_FEATURE_REFCOUNT))
+    {
+        return 1;
+    }
+    struct wfs_inode *in = get_inode(fs, path_in);
+    if (in == NULL)
+    {
+        return -ENOENT;
+    }
+    off_t block = get_block_ptr(fs, in, in_idx);
+    unpin_inode(fs, in, 0);
+    if (block == 0 || ref_datablock(fs, block) != 0)
+    {
+        return 1;
+    }
+
+    struct wfs_inode *out = get_inode(fs, path_out);
+    if (out == NULL)
+    {
+        free_datablock(fs, block);
+        return -ENOENT;
+    }
+    off_t old = get_block_ptr(fs, out, out_idx);
+    int err = set_block_ptr(fs, out, out_idx, block);
+    if (err != 0)
+    {
+        free_datablock(fs, block);
+        unpin_inode(fs, out, 1);
+        return err;
+    }
+    if (old != 0)
+    {
+        free_datablock(fs, old);
+    }
+    off_t end = (off_t)(out_idx + 1) * BLOCK_SIZE;
+    if (end > out->size)
+    {
+        out->size = end;
+    }
+    out->mtim = time(NULL);
+    unpin_inode(fs, out, 1);
+    return 0;
+}
+
+// copies a range between two files inside the image. whole blocks at the
+// same alignment on both sides are shared on images with refcounts, the
+// rest goes through read and write without a trip through the kernel.
+ssize_t wfs_fs_copy_file_range(struct wfs_fs *fs, const char *path_in, off_t offset_in, const char *path_out, off_t offset_out,
+                               size_t size)
+{
+    if (is_snapshot_path(fs, path_out))
+    {
+        return -EROFS;
+    }
+    struct wfs_inode *in = get_inode(fs, path_in);
+    if (in == NULL)
+    {
+        return -ENOENT;
+    }
+    off_t in_size = in->size;
+    unpin_inode(fs, in, 0);
+    if (offset_in >= in_size)
+    {
+        return 0;
+    }
+    size = min(size, in_size - offset_in);
+
+    char buf[BLOCK_SIZE];
+    size_t done = 0;
+    int err = 0;
+    while (done < size)
+    {
+        off_t pos_in = offset_in + done;
+        off_t pos_out = offset_out + done;
+        size_t len = min(BLOCK_SIZE - pos_in % BLOCK_SIZE, size - done);
+        if (len == BLOCK_SIZE && pos_out % BLOCK_SIZE == 0)
+        {
+            int shared = reflink_block(fs, path_in, pos_in / BLOCK_SIZE, path_out, pos_out / BLOCK_SIZE);
+            if (shared < 0)
+            {
+                err = shared;
+                break;
+            }
+            if (shared == 0)
+            {
+                done += len;
+                continue;
+            }
+        }
+
+        int read = wfs_fs_read(fs, path_in, NULL, buf, len, pos_in);
+        if (read <= 0)
+        {
+            err = read;
+            break;
+        }
+        int written = wfs_fs_write(fs, path_out, NULL, buf, read, pos_out);
+        if (written < 0)
+        {
+            err = written;
+            break;
+        }
+        done += written;
+    }
+    return (done > 0) ? done : err;
+}
+
+int wfs_fs_clone(struct wfs_fs *fs, const char *src_path, const char *dst_path)
+{
+    if (!has_feature(fs, WFS_FEATURE_REFCOUNT))
+    {
+        return -EOPNOTSUPP;
+    }
+    if (is_snapshot_path(fs, dst_path))
+    {
+        return -EROFS;
+    }
+    struct wfs_inode *src = get_inode(fs, src_path);
+    if (src == NULL)
+    {
+        return -ENOENT;
+    }
+    struct wfs_inode copy = *src;
+    unpin_inode(fs, src, 0);
+
+    struct wfs_inode *dst = get_inode(fs, dst_path);
+    if (dst == NULL)
+    {
+        return -ENOENT;
+    }
+    if (!S_ISREG(copy.mode) || !S_ISREG(dst->mode))
+    {
+        unpin_inode(fs, dst, 0);
+        return -EINVAL;
+    }
+    if (dst->num == copy.num)
+    {
+        unpin_inode(fs, dst, 0);
+        return 0;
+    }
+
+    struct wfs_inode shared = *dst;
+    int err = share_file_blocks(fs, copy.blocks, shared.blocks);
+    if (err != 0)
+    {
+        release_file_blocks(fs, &shared);
+        unpin_inode(fs, dst, 0);
+        return err;
+    }
+    release_file_blocks(fs, dst);
+    memcpy(dst->blocks, shared.blocks, sizeof(dst->blocks));
+    map_changed(fs, dst->num);
+    dst->size = copy.size;
+    dst->mtim = time(NULL);
+    unpin_inode(fs, dst, 1);
+    return 0;
+}
+
+/*
+  Online defragmentation. A file's blocks are measured in extents, runs
+  that follow each other on disk in file order with the indirect block
+  last. A file in more than one extent is copied into a free run long
+  enough for all of its blocks, its pointers are switched over in one
+  go and only then are the old blocks freed, so a reader sees either
+  layout with the same contents. Open files refill their block maps.
+  Files with shared blocks stay where they are, moving them would undo
+  the sharing.
+*/
+
+// a pointer to a block of its own, not a hole or a cluster marker
+static int movable_block(off_t ptr)
+{
+    return ptr != 0 && ptr != COMPRESSED_CLUSTER;
+}
+
+// the blocks an inode owns in the order they should sit on disk,
+// returns how many. directories have no indirect block.
+static int defrag_blocks(struct wfs_fs *fs, struct wfs_inode *inode, off_t *blocks)
+{
+    int count = 0;
+    if (S_ISDIR(inode->mode))
+    {
+        for (int k = 0; k < N_BLOCKS; k++)
+        {
+            if (movable_block(inode->blocks[k]))
+            {
+                blocks[count++] = inode->blocks[k];
+            }
+        }
+        return count;
+    }
+    for (int k = 0; k < MAX_FILE_BLOCKS; k++)
+    {
+        off_t ptr = get_block_ptr(fs, inode, k);
+        if (movable_block(ptr))
+        {
+            blocks[count++] = ptr;
+        }
+    }
+    if (inode->blocks[IND_BLOCK] != 0)
+    {
+        blocks[count++] = inode->blocks[IND_BLOCK];
+    }
+    return count;
+}
+
+static int count_extents(const off_t *blocks, int count)
+{
+    int extents = (count > 0) ? 1 : 0;
+    for (int i = 1; i < count; i++)
+    {
+        if (blocks[i] != blocks[i - 1] + BLOCK_SIZE)
+        {
+            extents++;
+        }
+    }
+    return extents;
+}
+
+// claims the first run of need free data blocks, returns the offset of
+// its first block or -1 if there is no such run
+static off_t claim_run(struct wfs_fs *fs, int need)
+{
+    char *bitmap = pin_bitmap(fs, 1);
+    int n = fs->super_block->num_data_blocks;
+    int start = 0;
+    for (int idx = 0; idx < n; idx++)
+    {
+        if ((bitmap[idx / 8] >> (idx % 8)) & 1)
+        {
+            start = idx + 1;
+            continue;
+        }
+        if (idx - start + 1 < need)
+        {
+            continue;
+        }
+        for (int k = start; k < start + need; k++)
+        {
+            bitmap[k / 8] |= (1 << (k % 8));
+        }
+        wfs_io_unpin(fs->disk, bitmap, 1);
+        csum_bitmap(fs, 1, start, start + need - 1);
+        if (has_feature(fs, WFS_FEATURE_REFCOUNT))
+        {
+            wfs_refcount_t *refcounts = pin_refcounts(fs);
+            for (int k = start; k < start + need; k++)
+            {
+                refcounts[k] = 1;
+            }
+            wfs_io_unpin(fs->disk, refcounts, 1);
+        }
+        return fs->super_block->d_blocks_ptr + (off_t)start * BLOCK_SIZE;
+    }
+    wfs_io_unpin(fs->disk, bitmap, 0);
+    return -1;
+}
+
+// moves inode num into one extent if it is in several, adding what it
+// found to report. returns 0 or a negative errno.
+static int defrag_inode(struct wfs_fs *fs, int num, struct wfs_defrag_arg *report)
+{
+    struct wfs_inode *inode = pin_inode(fs, num);
+    if (inode == NULL)
+    {
+        return -EIO;
+    }
+    off_t old[MAX_FILE_BLOCKS + 1];
+    int count = defrag_blocks(fs, inode, old);
+    int extents = count_extents(old, count);
+    if (count == 0)
+    {
+        unpin_inode(fs, inode, 0);
+        return 0;
+    }
+    report->files++;
+    report->extents_before += extents;
+    int shared = 0;
+    for (int i = 0; i < count && !shared; i++)
+    {
+        shared = get_refcount(fs, old[i]) > 1;
+    }
+    off_t run = (extents > 1 && !shared) ? claim_run(fs, count) : -1;
+    if (extents > 1)
+    {
+        report->fragmented++;
+    }
+    if (run == -1)
+    {
+        report->extents_after += extents;
+        unpin_inode(fs, inode, 0);
+        return 0;
+    }
+
+    // copy every block to its place in the run, the pointers stay on the
+    // old blocks until all of them are there. this relies on the handle
+    // contract: no other call runs until defrag returns (the daemon holds
+    // fs_lock), so no reader can see a half moved file or a freed block.
+    int is_dir = S_ISDIR(inode->mode);
+    int has_indirect = !is_dir && inode->blocks[IND_BLOCK] != 0;
+    wfs_io_prefetch(fs->disk, old, count);
+    char data[BLOCK_SIZE];
+    for (int i = 0; i < count - has_indirect; i++)
+    {
+        off_t to = run + (off_t)i * BLOCK_SIZE;
+        int failed;
+        if (is_dir)
+        {
+            // entries are checked on the way, their checksum moves along
+            struct wfs_dentry entries[DENTRIES_PER_BLOCK];
+            failed = read_dentries(fs, old[i], entries) != 0 || write_dentries(fs, to, entries) != 0;
+        }
+        else
+        {
+            failed = wfs_io_read(fs->disk, old[i], data, BLOCK_SIZE) != 0 || wfs_io_write(fs->disk, to, data, BLOCK_SIZE) != 0;
+        }
+        if (failed)
+        {
+            for (int k = 0; k < count; k++)
+            {
+                free_datablock(fs, run + (off_t)k * BLOCK_SIZE);
+            }
+            report->extents_after += extents;
+            unpin_inode(fs, inode, 0);
+            return -EIO;
+        }
+        if (has_feature(fs, WFS_FEATURE_DEDUP) && !is_dir)
+        {
+            dedup_insert(fs, block_hash(data), to);
+        }
+    }
+
+    // new pointers in file order, holes and cluster markers kept
+    off_t ptrs[MAX_FILE_BLOCKS] = {0};
+    int nptrs = is_dir ? N_BLOCKS : MAX_FILE_BLOCKS;
+    int next = 0;
+    for (int k = 0; k < nptrs; k++)
+    {
+        off_t ptr = is_dir ? inode->blocks[k] : get_block_ptr(fs, inode, k);
+        ptrs[k] = movable_block(ptr) ? run + (off_t)(next++) * BLOCK_SIZE : ptr;
+    }
+    off_t indirect = has_indirect ? run + (off_t)next * BLOCK_SIZE : 0;
+    if (has_indirect && wfs_io_write(fs->disk, indirect, ptrs + IND_BLOCK, BLOCK_SIZE) != 0)
+    {
+        for (int k = 0; k < count; k++)
+        {
+            free_datablock(fs, run + (off_t)k * BLOCK_SIZE);
+        }
+        report->extents_after += extents;
+        unpin_inode(fs, inode, 0);
+        return -EIO;
+    }
+    memcpy(inode->blocks, ptrs, (is_dir ? N_BLOCKS : IND_BLOCK) * sizeof(off_t));
+    if (has_indirect)
+    {
+        inode->blocks[IND_BLOCK] = indirect;
+    }
+    map_changed(fs, num);
+    unpin_inode(fs, inode, 1);
+
+    for (int i = 0; i < count; i++)
+    {
+        free_datablock(fs, old[i]);
+    }
+    report->moved++;
+    report->extents_after += 1;
+    return 0;
+}
+
+int wfs_fs_defrag(struct wfs_fs *fs, const char *path, struct wfs_defrag_arg *report)
+{
+    if (is_snapshot_path(fs, path))
+    {
+        return -EROFS;
+    }
+    struct wfs_inode *inode = get_inode(fs, path);
+    if (inode == NULL)
+    {
+        return -ENOENT;
+    }
+    int num = inode->num;
+    unpin_inode(fs, inode, 0);
+    return defrag_inode(fs, num, report);
+}
+
+int wfs_fs_defrag_all(struct wfs_fs *fs, struct wfs_defrag_arg *report)
+{
+    char *bitmap = pin_bitmap(fs, 0);
+    char *used = malloc(fs->super_block->num_inodes / 8);
+    if (used == NULL)
+    {
+        wfs_io_unpin(fs->disk, bitmap, 0);
+        return -ENOMEM;
+    }
+    memcpy(used, bitmap, fs->super_block->num_inodes / 8);
+    wfs_io_unpin(fs->disk, bitmap, 0);
+
+    int err = 0;
+    for (int num = 0; num < fs->super_block->num_inodes && err == 0; num++)
+    {
+        if ((used[num / 8] >> (num % 8)) & 1)
+        {
+            err = defrag_inode(fs, num, report);
+        }
+    }
+    free(used);
+    return err;
+}
+
+int wfs_fs_sync(struct wfs_fs *fs)
+{
+    csum_flush(fs);
+    return wfs_io_sync(fs->disk);
+}
+
+int wfs_fs_has_feature(struct wfs_fs *fs, uint32_t feature)
+{
+    return has_feature(fs, feature);
+}
+
+struct wfs_io *wfs_fs_io(struct wfs_fs *fs)
+{
+    return fs->disk;
+}
+
+// counts the set bits of the inode or data bitmap
+static int count_used(struct wfs_fs *fs, int isBlocks)
+{
+    int n = isBlocks ? fs->super_block->num_data_blocks : fs->super_block->num_inodes;
+    char *bitmap = pin_bitmap(fs, isBlocks);
+    int used = 0;
+    for (int i = 0; i < n; i++)
+    {
+        used += (bitmap[i / 8] >> (i % 8)) & 1;
+    }
+    wfs_io_unpin(fs->disk, bitmap, 0);
+    return used;
+}
+
+int wfs_fs_statfs(struct wfs_fs *fs, struct statvfs *st)
+{
+    memset(st, 0, sizeof(struct statvfs));
+    st->f_bsize = BLOCK_SIZE;
+    st->f_frsize = BLOCK_SIZE;
+    st->f_blocks = fs->super_block->num_data_blocks;
+    st->f_bfree = st->f_blocks - count_used(fs, 1);
+    st->f_bavail = st->f_bfree;
+    st->f_files = fs->super_block->num_inodes;
+    st->f_ffree = st->f_files - count_used(fs, 0);
+    st->f_favail = st->f_ffree;
+    st->f_namemax = MAX_NAME - 1;
+    return 0;
+}
+
+struct wfs_fs *wfs_fs_open_image(const char *path, const struct wfs_io_opts *opts)
+{
+    struct wfs_fs *fs = calloc(1, sizeof(struct wfs_fs));
+    if (fs == NULL)
+    {
+        return NULL;
+    }
+    fs->disk = wfs_io_open(path, opts);
+    if (fs->disk == NULL)
+    {
+        free(fs);
+        return NULL;
+    }
+
+    // setup pointers, the superblock lives in the resident header
+    fs->super_block = wfs_io_pin(fs->disk, 0, sizeof(struct wfs_sb));
+    fs->sb_ext = NULL;
+    if (fs->super_block->i_bitmap_ptr >= sizeof(struct wfs_sb) + sizeof(struct wfs_sb_ext))
+    {
+        fs->sb_ext = wfs_io_pin(fs->disk, sizeof(struct wfs_sb), sizeof(struct wfs_sb_ext));
+        if (fs->sb_ext->magic != WFS_EXT_MAGIC)
+        {
+            fs->sb_ext = NULL;
+        }
+    }
+    fs->inode_gens = calloc(fs->super_block->num_inodes, sizeof(struct inode_gen));
+    fs->dir_hints = calloc(fs->super_block->num_inodes, sizeof(struct dir_hint));
+    if (has_feature(fs, WFS_FEATURE_CSUM))
+    {
+        fs->csum_checked = calloc((WFS_CSUM_ENTRIES(fs->super_block) + 7) / 8, 1);
+        fs->csum_stale = calloc((WFS_CSUM_ENTRIES(fs->super_block) + 7) / 8, 1);
+    }
+    if (fs->inode_gens == NULL || fs->dir_hints == NULL ||
+        (has_feature(fs, WFS_FEATURE_CSUM) && (fs->csum_checked == NULL || fs->csum_stale == NULL)))
+    {
+        wfs_io_close(fs->disk);
+        free(fs->inode_gens);
+        free(fs->dir_hints);
+        free(fs->csum_checked);
+        free(fs->csum_stale);
+        free(fs);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (has_feature(fs, WFS_FEATURE_CSUM))
+    {
+        wfs_info("metadata checksums on, crc32c on %s", wfs_crc32c_impl());
+        if (fs->sb_ext->csum_pending)
+        {
+            csum_rebuild(fs);
+        }
+        if (csum_check_bitmaps(fs) != 0)
+        {
+            wfs_fs_close_image(fs);
+            errno = EIO;
+            return NULL;
+        }
+    }
+    cluster_cache_init(fs);
+    dedup_init(fs);
+    // snapshots are made by mkdir inside /.snapshots, which the kernel
+    // only sends once it has found the directory
+    struct wfs_inode *snapshots = is_snapshot_path(fs, SNAPSHOT_DIR) ? get_inode(fs, SNAPSHOT_DIR) : NULL;
+    if (snapshots != NULL)
+    {
+        unpin_inode(fs, snapshots, 0);
+    }
+    else if (is_snapshot_path(fs, SNAPSHOT_DIR))
+    {
+        handle_inode_insertion(fs, SNAPSHOT_DIR, S_IFDIR | 0555);
+    }
+    return fs;
+}
+
+void wfs_fs_close_image(struct wfs_fs *fs)
+{
+    if (has_feature(fs, WFS_FEATURE_CSUM) && fs->sb_ext->csum_pending)
+    {
+        csum_flush(fs);
+        fs->sb_ext->csum_pending = 0;
+        wfs_io_unpin(fs->disk, fs->sb_ext, 1);
+    }
+    wfs_io_close(fs->disk);
+    free(fs->dedup_index);
+    free(fs->inode_gens);
+    free(fs->dir_hints);
+    free(fs->csum_checked);
+    free(fs->csum_stale);
+    free(fs);
+}
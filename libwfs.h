@@ -0,0 +1,74 @@
+#ifndef LIBWFS_H
+#define LIBWFS_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "wfs.h"
+#include "wfs_io.h"
+
+/*
+  The file system itself, without FUSE. Everything works on an explicit
+  handle from wfs_fs_open_image, so one process can have several images
+  open and benchmarks, fuzzers and tools can drive the code directly.
+  The wfs daemon is a thin adapter from FUSE callbacks onto these calls.
+
+  Paths are absolute inside the image. Calls return 0, a byte count or a
+  negative errno like the FUSE callbacks they back. A handle is not
+  thread safe, callers serialize calls on the same one.
+*/
+
+struct wfs_fs;
+// an open file: the inode resolved once plus a cached block map
+struct wfs_file;
+
+// called once per directory entry, returns nonzero to stop the listing
+typedef int (*wfs_filler_t)(void *ctx, const char *name, const struct stat *st);
+
+// opens the image at path through the io layer, NULL and errno on failure
+struct wfs_fs *wfs_fs_open_image(const char *path, const struct wfs_io_opts *opts);
+// writes everything back and frees the handle
+void wfs_fs_close_image(struct wfs_fs *fs);
+// writes back everything the io layer is holding
+int wfs_fs_sync(struct wfs_fs *fs);
+
+// nonzero if mkfs turned any of the WFS_FEATURE_* bits on
+int wfs_fs_has_feature(struct wfs_fs *fs, uint32_t feature);
+// block and inode counts in statvfs form
+int wfs_fs_statfs(struct wfs_fs *fs, struct statvfs *st);
+struct wfs_io *wfs_fs_io(struct wfs_fs *fs);
+
+int wfs_fs_getattr(struct wfs_fs *fs, const char *path, struct stat *st);
+int wfs_fs_mknod(struct wfs_fs *fs, const char *path, mode_t mode);
+int wfs_fs_mkdir(struct wfs_fs *fs, const char *path, mode_t mode);
+int wfs_fs_unlink(struct wfs_fs *fs, const char *path);
+int wfs_fs_rmdir(struct wfs_fs *fs, const char *path);
+// lists ".", ".." and every entry of the directory at path
+int wfs_fs_readdir(struct wfs_fs *fs, const char *path, wfs_filler_t filler, void *ctx);
+
+// open and create hand back a file for read, write and wfs_fs_release.
+// flags are the O_ACCMODE bits of open(2).
+int wfs_fs_open(struct wfs_fs *fs, const char *path, int flags, struct wfs_file **file);
+int wfs_fs_create(struct wfs_fs *fs, const char *path, mode_t mode, int flags, struct wfs_file **file);
+void wfs_fs_release(struct wfs_fs *fs, struct wfs_file *file);
+
+// file may be NULL, the path is looked up then
+int wfs_fs_read(struct wfs_fs *fs, const char *path, struct wfs_file *file, char *buf, size_t n, off_t offset);
+int wfs_fs_write(struct wfs_fs *fs, const char *path, struct wfs_file *file, const char *buf, size_t size, off_t offset);
+
+// copies a range between two files, sharing whole aligned blocks on
+// images with refcounts. returns the bytes copied.
+ssize_t wfs_fs_copy_file_range(struct wfs_fs *fs, const char *path_in, off_t offset_in, const char *path_out, off_t offset_out,
+                               size_t size);
+// replaces the contents of dst with those of src by sharing every block
+int wfs_fs_clone(struct wfs_fs *fs, const char *src, const char *dst);
+
+// moves the blocks of the file or directory at path into one contiguous
+// run if they are spread over several, adding what was found to report
+int wfs_fs_defrag(struct wfs_fs *fs, const char *path, struct wfs_defrag_arg *report);
+// wfs_fs_defrag for every file and directory in the image
+int wfs_fs_defrag_all(struct wfs_fs *fs, struct wfs_defrag_arg *report);
+
+#endif
@@ -5,29 +5,155 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include "wfs.h"
-#include <sys/mman.h>
+#include "wfs_io.h"
+#include "wfs_build.h"
+#include "wfs_crc.h"
 
 // PRESUMING: You may presume the block size is always 512 bytes (according to instructions)
 
+#define CSUM_INODE_BATCH (256)
+// stripe unit of a striped set unless -S says otherwise, in blocks
+#define DEFAULT_STRIPE_BLOCKS (8)
+// where the stripes start on each member, past its label and header
+#define STRIPE_GRID_ALIGN (4096)
+
+// checksums a bitmap one BLOCK_SIZE piece at a time, an entry of table each
+static int checksum_bitmap(const struct wfs_stripe *set, off_t ptr, size_t len, wfs_csum_t *table)
+{
+    char *map = malloc(len);
+    if (map == NULL || wfs_stripe_pread(set, map, len, ptr) != 0)
+    {
+        free(map);
+        return -1;
+    }
+    for (size_t off = 0; off < len; off += BLOCK_SIZE)
+    {
+        table[off / BLOCK_SIZE] = wfs_crc32c(0, map + off, (len - off < BLOCK_SIZE) ? len - off : BLOCK_SIZE);
+    }
+    free(map);
+    return 0;
+}
+
+// fills the checksum table from the metadata on the image, once the root
+// inode and whatever -r copied in are there
+static int write_checksums(const struct wfs_stripe *set, const struct wfs_sb *sb, const struct wfs_sb_ext *ext)
+{
+    size_t len = WFS_CSUM_ENTRIES(sb) * sizeof(wfs_csum_t);
+    wfs_csum_t *table = calloc(1, len);
+    char *used = malloc(sb->num_inodes / 8);
+    char *slots = malloc(CSUM_INODE_BATCH * BLOCK_SIZE);
+    int err = -1;
+    if (table == NULL || used == NULL || slots == NULL ||
+        checksum_bitmap(set, sb->i_bitmap_ptr, sb->num_inodes / 8, &table[WFS_CSUM_IBITMAP(sb, 0)]) != 0 ||
+        checksum_bitmap(set, sb->d_bitmap_ptr, sb->num_data_blocks / 8, &table[WFS_CSUM_DBITMAP(sb, 0)]) != 0 ||
+        wfs_stripe_pread(set, used, sb->num_inodes / 8, sb->i_bitmap_ptr) != 0)
+    {
+        goto out;
+    }
+    for (size_t first = 0; first < sb->num_inodes; first += CSUM_INODE_BATCH)
+    {
+        size_t count = (sb->num_inodes - first < CSUM_INODE_BATCH) ? sb->num_inodes - first : CSUM_INODE_BATCH;
+        if (wfs_stripe_pread(set, slots, count * BLOCK_SIZE, sb->i_blocks_ptr + (off_t)first * BLOCK_SIZE) != 0)
+        {
+            goto out;
+        }
+        for (size_t k = 0; k < count; k++)
+        {
+            size_t num = first + k;
+            struct wfs_inode *inode = (struct wfs_inode *)(slots + k * BLOCK_SIZE);
+            table[WFS_CSUM_INODE(sb, num)] = wfs_crc32c(0, inode, sizeof(struct wfs_inode));
+            if (!((used[num / 8] >> (num % 8)) & 1) || !S_ISDIR(inode->mode))
+            {
+                continue;
+            }
+            // a directory's blocks hold its entries
+            for (int i = 0; i < N_BLOCKS; i++)
+            {
+                char block[BLOCK_SIZE];
+                if (inode->blocks[i] == 0)
+                {
+                    continue;
+                }
+                if (wfs_stripe_pread(set, block, BLOCK_SIZE, inode->blocks[i]) != 0)
+                {
+                    goto out;
+                }
+                size_t idx = (inode->blocks[i] - sb->d_blocks_ptr) / BLOCK_SIZE;
+                table[WFS_CSUM_DATA(sb, idx)] = wfs_crc32c(0, block, BLOCK_SIZE);
+            }
+        }
+    }
+    err = wfs_stripe_pwrite(set, table, len, ext->csum_ptr);
+out:
+    free(table);
+    free(used);
+    free(slots);
+    return err;
+}
+
+static int sync_set(const struct wfs_stripe *set)
+{
+    for (int i = 0; i < set->ndisks; i++)
+    {
+        if (fsync(set->fds[i]) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// stamps every member of a striped set, last so that a set mkfs gave up
+// on never opens
+static int write_labels(const struct wfs_stripe *set, const struct wfs_sb *sb)
+{
+    struct wfs_stripe_label label = {0};
+    label.magic = WFS_STRIPE_MAGIC;
+    label.disks = set->ndisks;
+    label.set_id = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid();
+    label.stripe_unit = set->unit;
+    label.grid_base = set->grid_base;
+    label.grid_bytes = (set->size - set->header_len) / set->ndisks;
+    label.sb = *sb;
+    for (int i = 0; i < set->ndisks; i++)
+    {
+        label.index = i;
+        if (pwrite(set->fds[i], &label, sizeof(label), 0) != sizeof(label))
+        {
+            return -1;
+        }
+    }
+    return sync_set(set);
+}
+
 int main(int argc, char **argv)
 {
     int num_blocks = -1;
     int num_inodes = -1;
-    char *DISK_IMG_PATH = NULL;
+    uint32_t features = 0;
+    char *disk_paths[WFS_IO_MAX_DISKS];
+    int ndisks = 0;
+    int stripe_blocks = DEFAULT_STRIPE_BLOCKS;
+    char *src_dir = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
 
     // argument parsing
     for (int i = 0; i < argc; i++)
     {
         if (strcmp(argv[i], "-d") == 0)
         {
-            DISK_IMG_PATH = (char *)malloc(strlen(argv[i + 1]) + 1);
-            if (DISK_IMG_PATH == NULL)
+            // more than one stripes the file system over all of them
+            if (ndisks == WFS_IO_MAX_DISKS)
             {
-                perror("ERROR: could not get memory for the disk image path.\n");
+                printf("ERROR: at most %d disk images can be striped.\n", WFS_IO_MAX_DISKS);
                 exit(1);
             }
-            strcpy(DISK_IMG_PATH, argv[i + 1]);
-            
+            disk_paths[ndisks++] = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-S") == 0)
+        {
+            // stripe unit in blocks
+            stripe_blocks = atoi(argv[i + 1]);
         }
         else if (strcmp(argv[i], "-i") == 0)
         {
@@ -37,6 +163,54 @@ int main(int argc, char **argv)
         {
             num_blocks = atoi(argv[i + 1]);
         }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            features |= WFS_FEATURE_COMPRESS;
+        }
+        else if (strcmp(argv[i], "-D") == 0)
+        {
+            features |= WFS_FEATURE_DEDUP | WFS_FEATURE_REFCOUNT;
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            // shared blocks without dedup, enough for snapshots
+            features |= WFS_FEATURE_REFCOUNT;
+        }
+        else if (strcmp(argv[i], "-C") == 0)
+        {
+            // checksummed bitmaps, inodes and directory blocks
+            features |= WFS_FEATURE_CSUM;
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            // fill the new image with a copy of a host directory
+            src_dir = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            threads = atoi(argv[i + 1]);
+        }
+    }
+
+    // compressed clusters rewrite their blocks in place, they cannot be shared
+    if ((features & WFS_FEATURE_COMPRESS) && (features & WFS_FEATURE_REFCOUNT))
+    {
+        printf("ERROR: -c cannot be combined with -D or -s.\n");
+        exit(1);
+    }
+    if (src_dir != NULL && (features & WFS_FEATURE_COMPRESS))
+    {
+        printf("ERROR: -r cannot be combined with -c.\n");
+        exit(1);
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (ndisks == 0 || stripe_blocks < 1)
+    {
+        printf("ERROR: need a disk image (-d) and a stripe unit (-S) of at least one block.\n");
+        exit(1);
     }
 
     // round up num blocks to nearest higher multiple of 32
@@ -45,67 +219,185 @@ int main(int argc, char **argv)
     if (num_inodes % 32 != 0)
         num_inodes = (num_inodes - num_inodes % 32) + 32;
 
-    int fd = open(DISK_IMG_PATH, O_RDWR);
-    if (fd < 0)
+    // the images are opened directly rather than with wfs_stripe_open,
+    // whatever labels they carry from an earlier set are overwritten
+    struct wfs_stripe set = {0};
+    for (int i = 0; i < ndisks; i++)
     {
-        perror("ERROR: failed to open disk image for initialization.\n");
-        exit(1);
-    }
-    // check that num of blocks is possible with disk img file size
-    struct stat statbuf;
-    if (fstat(fd, &statbuf) != 0)
-    {
-        perror("ERROR: cannot get disk image size.\n");
-        free(DISK_IMG_PATH);
-        exit(1);
+        set.fds[i] = open(disk_paths[i], O_RDWR);
+        if (set.fds[i] < 0)
+        {
+            perror("ERROR: failed to open disk image for initialization.\n");
+            wfs_stripe_close(&set);
+            exit(1);
+        }
+        set.ndisks++;
+        // check that num of blocks is possible with disk img file size,
+        // raw block devices report a size of 0 to fstat so probe them instead
+        if (wfs_io_probe(set.fds[i], &set.geo[i]) != 0)
+        {
+            perror("ERROR: cannot get disk image size.\n");
+            wfs_stripe_close(&set);
+            exit(1);
+        }
     }
 
     printf("num blocks is %d, num nodes is %d\n", num_blocks, num_inodes);
 
-
-    // initialize super block
-    // open disk img
-
-    struct stat stat;
-    fstat(fd, &stat);
-    off_t size = stat.st_size;
-
-    // setup pointers
-    char *file_system = mmap(NULL, size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
-    memset(file_system, 0, size);
-
-    // define super block
-    struct wfs_sb *super_block = (struct wfs_sb *)file_system;
+    // initialize super block, the extension only goes in when a feature needs it
+    struct wfs_sb super_block = {0};
+    struct wfs_sb_ext ext = {0};
+    ext.magic = WFS_EXT_MAGIC;
+    ext.features = features;
     off_t i_map_ptr = sizeof(struct wfs_sb);
+    if (features != 0)
+    {
+        i_map_ptr += sizeof(struct wfs_sb_ext);
+    }
     off_t d_map_ptr = i_map_ptr + (num_inodes / 8);
     off_t i_block_ptr = d_map_ptr + (num_blocks / 8);
+    if (features & WFS_FEATURE_REFCOUNT)
+    {
+        // the refcount table goes between the data bitmap and the inodes
+        ext.refcount_ptr = i_block_ptr;
+        i_block_ptr += (off_t)num_blocks * sizeof(wfs_refcount_t);
+    }
+    super_block.num_data_blocks = num_blocks;
+    super_block.num_inodes = num_inodes;
+    if (features & WFS_FEATURE_CSUM)
+    {
+        // and the checksum table after it, right before the inodes
+        ext.csum_ptr = i_block_ptr;
+        i_block_ptr += (off_t)WFS_CSUM_ENTRIES(&super_block) * sizeof(wfs_csum_t);
+        // an odd number of entries would leave the inodes 4 byte aligned
+        i_block_ptr = (i_block_ptr + 7) & ~(off_t)7;
+    }
     off_t d_block_ptr = i_block_ptr + (BLOCK_SIZE * num_inodes);
-    super_block->num_data_blocks = num_blocks;
-    super_block->num_inodes = num_inodes;
-    super_block->i_bitmap_ptr = i_map_ptr;
-    super_block->d_bitmap_ptr = d_map_ptr;
-    super_block->i_blocks_ptr = i_block_ptr;
-    super_block->d_blocks_ptr = d_block_ptr;
-    // close files
-    close(fd);
-    free(DISK_IMG_PATH);
+    super_block.i_bitmap_ptr = i_map_ptr;
+    super_block.d_bitmap_ptr = d_map_ptr;
+    super_block.i_blocks_ptr = i_block_ptr;
+    super_block.d_blocks_ptr = d_block_ptr;
+
+    if (ndisks == 1)
+    {
+        set.size = set.geo[0].size;
+    }
+    else
+    {
+        // everything up to the inodes goes on member 0 after its label,
+        // the inodes and data blocks are dealt out round robin from there
+        set.unit = (off_t)stripe_blocks * BLOCK_SIZE;
+        set.header_len = i_block_ptr;
+        set.grid_base = WFS_STRIPE_LABEL_SIZE + i_block_ptr;
+        set.grid_base += (STRIPE_GRID_ALIGN - set.grid_base % STRIPE_GRID_ALIGN) % STRIPE_GRID_ALIGN;
+        off_t stripes = (d_block_ptr + (off_t)num_blocks * BLOCK_SIZE - i_block_ptr + set.unit - 1) / set.unit;
+        off_t grid_bytes = (stripes + ndisks - 1) / ndisks * set.unit;
+        set.size = i_block_ptr + ndisks * grid_bytes;
+        for (int i = 0; i < ndisks; i++)
+        {
+            if (set.geo[i].size < set.grid_base + grid_bytes)
+            {
+                printf("ERROR: %s is too small, each image needs %ld bytes.\n", disk_paths[i], (long)(set.grid_base + grid_bytes));
+                wfs_stripe_close(&set);
+                exit(1);
+            }
+        }
+        printf("striped over %d images, %d blocks a stripe\n", ndisks, stripe_blocks);
+    }
+
+    if (set.size < d_block_ptr + ((off_t)num_blocks * BLOCK_SIZE))
+    {
+        printf("ERROR: disk image is too small for %d inodes and %d blocks.\n", num_inodes, num_blocks);
+        wfs_stripe_close(&set);
+        exit(1);
+    }
+
+    // zero the metadata with plain writes instead of mapping the image,
+    // a device can be far bigger than the address space we want to touch.
+    // data blocks are zeroed when wfs allocates them.
+    char zeroes[64 * BLOCK_SIZE] = {0};
+    for (off_t off = 0; off < d_block_ptr; off += sizeof(zeroes))
+    {
+        size_t len = (d_block_ptr - off < (off_t)sizeof(zeroes)) ? d_block_ptr - off : sizeof(zeroes);
+        if (wfs_stripe_pwrite(&set, zeroes, len, off) != 0)
+        {
+            perror("ERROR: failed to clear the disk image metadata.\n");
+            wfs_stripe_close(&set);
+            exit(1);
+        }
+    }
+
+    // a fresh device does not need to keep any old data, let it know
+    for (off_t off = d_block_ptr, end = d_block_ptr + (off_t)num_blocks * BLOCK_SIZE; off < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t len = wfs_stripe_locate(&set, off, &disk, &phys);
+        len = (len < end - off) ? len : end - off;
+        if (set.geo[disk].is_device)
+        {
+            wfs_io_discard_range(set.fds[disk], &set.geo[disk], phys, len);
+        }
+        off += len;
+    }
 
     // initialize root inode; CONSIDER: may need to zero the bitmaps, dont think so so I wont do it.
-    struct wfs_inode *inode = (struct wfs_inode *)(file_system + super_block->i_blocks_ptr);
-    inode->num = 0;               // NOTE ROOT DIRECTORY IS FIRST INODE
-    inode->mode = S_IFDIR | 0755; // directory with rwx for all users. Piazza said it doesnt really matter what permissions we give it.
-    inode->uid = 0;
-    inode->gid = 0;
-    inode->size = 2 * sizeof(struct wfs_dentry); // for . and .. dirs
-    inode->nlinks = 2;
-    inode->atim = inode->mtim = inode->ctim = time(NULL);
+    struct wfs_inode inode = {0};
+    inode.num = 0;               // NOTE ROOT DIRECTORY IS FIRST INODE
+    inode.mode = S_IFDIR | 0755; // directory with rwx for all users. Piazza said it doesnt really matter what permissions we give it.
+    inode.uid = 0;
+    inode.gid = 0;
+    inode.size = 2 * sizeof(struct wfs_dentry); // for . and .. dirs
+    inode.nlinks = 2;
+    inode.atim = inode.mtim = inode.ctim = time(NULL);
     for (int i = 0; i < N_BLOCKS; i++)
     {
-        inode->blocks[i] = 0; // updated as a block at offset 0 is possible.
+        inode.blocks[i] = 0; // updated as a block at offset 0 is possible.
     }
 
     // set IBITMAP to 1 for the first spot for the root inode
-    *(file_system + super_block->i_bitmap_ptr) |= 1;
+    char root_bit = 1;
+
+    if (features != 0 && wfs_stripe_pwrite(&set, &ext, sizeof(ext), sizeof(super_block)) != 0)
+    {
+        perror("ERROR: failed to write the superblock extension.\n");
+        wfs_stripe_close(&set);
+        exit(1);
+    }
+    if (wfs_stripe_pwrite(&set, &super_block, sizeof(super_block), 0) != 0 ||
+        wfs_stripe_pwrite(&set, &inode, sizeof(inode), super_block.i_blocks_ptr) != 0 ||
+        wfs_stripe_pwrite(&set, &root_bit, 1, super_block.i_bitmap_ptr) != 0 ||
+        sync_set(&set) != 0)
+    {
+        perror("ERROR: failed to write the superblock and root inode.\n");
+        wfs_stripe_close(&set);
+        exit(1);
+    }
+
+    if (src_dir != NULL &&
+        (wfs_build(&set, &super_block, (features != 0) ? &ext : NULL, src_dir, threads) != 0 || sync_set(&set) != 0))
+    {
+        printf("ERROR: failed to copy %s into the disk image.\n", src_dir);
+        wfs_stripe_close(&set);
+        exit(1);
+    }
+
+    if ((features & WFS_FEATURE_CSUM) && (write_checksums(&set, &super_block, &ext) != 0 || sync_set(&set) != 0))
+    {
+        perror("ERROR: failed to write the metadata checksums.\n");
+        wfs_stripe_close(&set);
+        exit(1);
+    }
+
+    if (ndisks > 1 && write_labels(&set, &super_block) != 0)
+    {
+        perror("ERROR: failed to write the stripe labels.\n");
+        wfs_stripe_close(&set);
+        exit(1);
+    }
+
+    // close files
+    wfs_stripe_close(&set);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,904 +1,751 @@
 #include <sys/types.h>
-#include "wfs.h"
+#include "libwfs.h"
 #include <fuse.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/mman.h>
 #include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include "wfs_stats.h"
+#include "wfs_log.h"
+#include "wfs_trace.h"
+
+/*
+  The FUSE daemon. The file system lives in libwfs, this file maps FUSE
+  callbacks onto it and adds what only a mount has: the kernel cache
+  settings, invalidation, and the /.wfs_stats file.
+*/
+
+struct wfs_fs *fs; // the mounted image
+// libwfs handles are not thread safe and fuse runs callbacks on several
+// threads unless mounted with -s, every callback takes this first. it
+// also keeps one request's I/O in flight at a time, with --io=uring too:
+// replying to each request as its I/O completes would need the low-level
+// fuse API and a libwfs that can be reentered mid-request.
+static pthread_mutex_t fs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --kernel-cache: the kernel keeps entries, attributes and file pages for
+// cache_timeout seconds and is told when the daemon changes them itself
+int kernel_cache;
+double cache_timeout;
+#define WFS_CACHE_TIMEOUT (3600.0)
+// --negative-timeout=SECONDS: how long a name that does not exist is
+// remembered, a few seconds unless given. names appear behind the
+// kernel's back, such as a tool like wfs_replay or mkfs -r run on the
+// image between mounts, and a cached miss would hide them.
+double negative_timeout = -1;
+#define WFS_NEGATIVE_TIMEOUT (5.0)
+
+// --mem-budget=SIZE: with the mmap backend at most this much file data
+// stays mapped, cold regions are handed back to the kernel
+size_t mem_budget;
+
+// --large-io: fewer and bigger requests, each one pays for the inode
+// lookup and the setup of the block loop once however much it carries
+int large_io;
+#define WFS_LARGE_IO (1024 * 1024)
 
-char *file_system; // define a file system we can use
-struct wfs_sb *super_block;
+size_t min(size_t a, size_t b)
+{
+    return (a < b) ? a : b;
+}
 
-// bitmap is the specific bitmap pointer
-// value is the value to set in the idx specified
-// isBlocks is a boolean to decide which number of inodes or number of blocks to use.
-int setbitmap(char *bitmap, int value, int idx, int isBlocks)
+/*
+  /.wfs_stats is a read-only file that only exists in the daemon: reading
+  it returns the wfs_stats report followed by the io layer's cache
+  counters. It is not in the root directory so readdir never lists it.
+*/
+#define STATS_FILE "/.wfs_stats"
+#define STATS_FILE_MAX (8192)
+
+int is_stats_path(const char *path)
 {
-    int outer_iter = (isBlocks) ? super_block->num_data_blocks : super_block->num_inodes;
-    for (int i = 0; i < (outer_iter / 8); i++)
-    {
-        char *currByte = bitmap + i;
-        for (int j = 0; j < 8; j++)
+    return strcmp(path, STATS_FILE) == 0;
+}
+
+// fills buf with the stats file, returns its full length like snprintf
+int format_stats(char *buf, size_t cap)
+{
+    int len = wfs_stats_report(buf, cap);
+    struct wfs_io_stats io;
+    wfs_io_get_stats(wfs_fs_io(fs), &io);
+    size_t used = min(len, cap);
+    len += snprintf(buf + used, cap - used, "io hits %lu misses %lu evictions %lu writebacks %lu readahead %lu\n", io.hits,
+                    io.misses, io.evictions, io.writebacks, io.readahead);
+    // resident set of the whole daemon, the second field of statm in pages
+    unsigned long size_pages = 0, rss_pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%lu %lu", &size_pages, &rss_pages) != 2)
         {
-            if ((i * 8 + j) == idx)
-            {
-                if (value == 1)
-                {
-                    *(currByte) |= (value << j);
-                }
-                else
-                {
-                    *(currByte) &= ~(1 << j);
-                }
-                return value;
-            }
+            rss_pages = 0;
         }
+        fclose(statm);
     }
-    return -1;
+    used = min(len, cap);
+    return len + snprintf(buf + used, cap - used, "mem rss %lu budget %zu resident %zu dropped %lu\n",
+                          rss_pages * sysconf(_SC_PAGESIZE), mem_budget, io.resident, io.dropped);
 }
 
-// return a pointer to inode, or NULL if not found
-// fills up a given inode, given a path of a inode
-struct wfs_inode *get_inode(const char *path)
+// parses a byte count with an optional K, M or G suffix
+size_t parse_size(const char *s)
 {
+    char *end;
+    size_t n = strtoull(s, &end, 10);
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        n <<= 10;
+        // fall through
+    case 'M':
+    case 'm':
+        n <<= 10;
+        // fall through
+    case 'K':
+    case 'k':
+        n <<= 10;
+    }
+    return n;
+}
 
-    // printf("the path is: %s\n", path);
-    // fetch the root inode
-    struct wfs_inode *curr_inode = (struct wfs_inode *)(file_system + super_block->i_blocks_ptr);
-    // printf("the root inode is: %d\n", curr_inode->num);
-    // printf("size of size: %ld\n", curr_inode->size);
-    // printf("size of links: %d\n", curr_inode->nlinks);
-    // loop through the path
-    char *token;
-    char *copy_path = strdup(path);
-    struct wfs_dentry *entry;
-    int i;
-    int found; // ensures the path has been found
-    while ((token = strsep(&copy_path, "/")) != NULL)
-    {
-        // skip empty tokens
-        if (strcmp(token, "") == 0)
-        {
-            continue;
-        }
-        // printf("the token is: %s\n", token);
-        // nothing found yet
-        found = 0;
-        // fetch the datablock entries
-        // look through current inodes data blocks
-        for (i = 0; i < N_BLOCKS; i++)
-        {
-            // printf("entering each block, current block: %ld\n", curr_inode->blocks[i]);
-            if (curr_inode->blocks[i] == 0)
-            {
-                continue;
-            }
+// returns the open file behind fi, NULL for calls made without one
+struct wfs_file *get_file(struct fuse_file_info *fi)
+{
+    return (fi != NULL) ? (struct wfs_file *)(uintptr_t)fi->fh : NULL;
+}
 
-            for (int j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-            {
-                entry = (struct wfs_dentry *)(file_system + curr_inode->blocks[i] + j);
-                // printf("Entry name: %s and the token: %s\n", entry->name, token);
-                if (strcmp(entry->name, token) == 0)
-                {
-                    found = 1;
-                    break;
-                }
-            }
-            if (found)
-            {
-                break;
-            }
-        }
-        // if the path was never found, it does not exist
-        if (!found)
-        {
-            free(copy_path);
-            return NULL;
-        }
+// the path the callback running on this thread changed behind the
+// kernel's back, sent by flush_invalidation once fs_lock is released.
+// invalidating locks the file's cached pages, which a read or write of
+// the same file waiting on fs_lock may be holding.
+static _Thread_local const char *pending_invalidation;
 
-        // printf("the entry num: %d\n", entry->num);
-        // if it is found, update the current node, TODO, make sure this arithmetic is correct.
-        curr_inode = (struct wfs_inode *)(file_system + super_block->i_blocks_ptr + (entry->num * BLOCK_SIZE));
-        // printf("the current node is found, and its num is: %d\n", curr_inode->num);
+// tells the kernel to drop what it cached for path after the daemon
+// changed the file without the kernel seeing the data go by
+static void invalidate_path(const char *path)
+{
+    if (kernel_cache)
+    {
+        pending_invalidation = path;
     }
-    // printf("the current node is found, and its num is: %d\n", curr_inode->num);
-    // return the address of the inode, and free memory
-    free(copy_path);
-    return curr_inode;
 }
 
-// this fuse operation makes a directory
-static int wfs_getattr(const char *path, struct stat *stbuf)
+// sends the invalidation asked for on this thread, called without fs_lock
+static void flush_invalidation(void)
 {
-    // printf("entering getarr code\n");
-    struct wfs_inode *inode = get_inode(path);
-    if (inode == NULL)
+    const char *path = pending_invalidation;
+    if (path == NULL)
     {
-        return -ENOENT;
+        return;
     }
-
-    // printf("the path is %s, and the inode fetched num is: %d, and uid: %d\n", path, inode->num, inode->uid);
-
-    // printf("the inode number is (getattr): %d\n",inode->num);
-
-    stbuf->st_ino = inode->num; // not sure if this one is correct.
-    // printf("the inode number is (getattr): %ld\n", stbuf->st_ino);
-    stbuf->st_mode = inode->mode;
-    stbuf->st_uid = inode->uid;
-    stbuf->st_gid = inode->gid;
-    stbuf->st_size = inode->size;
-    stbuf->st_nlink = inode->nlinks;
-    stbuf->st_blksize = BLOCK_SIZE;
-    // time attributes
-    stbuf->st_atime = inode->atim;
-    stbuf->st_mtime = inode->mtim;
-    stbuf->st_ctime = inode->ctim;
-    // calculate total number of blocks
-    int num_blocks = 0;
-    for (int i = 0; i < N_BLOCKS; i++)
+    pending_invalidation = NULL;
+    struct fuse_context *ctx = fuse_get_context();
+    if (ctx != NULL && ctx->fuse != NULL)
     {
-        if (inode->blocks[i] != 0)
-        {
-            num_blocks++;
-        }
+        fuse_invalidate_path(ctx->fuse, path);
     }
-    stbuf->st_blocks = num_blocks;
+}
 
-    return 0;
+static int wfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    if (is_stats_path(path))
+    {
+        char report[STATS_FILE_MAX];
+        memset(stbuf, 0, sizeof(struct stat));
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        stbuf->st_uid = getuid();
+        stbuf->st_gid = getgid();
+        stbuf->st_size = min(format_stats(report, sizeof(report)), sizeof(report) - 1);
+        stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = time(NULL);
+        return 0;
+    }
+    return wfs_fs_getattr(fs, path, stbuf);
 }
 
-// allocates an inode, and returns pointer to it.
-// sets basic attributes, inode num, uid, gid, time.
-// if not enough space, returns NULL
-struct wfs_inode *allocate_inode(mode_t mode)
+static int wfs_mknod(const char *path, mode_t mode, dev_t dev)
 {
-    char *bitmap = file_system + super_block->i_bitmap_ptr;
-    int idx; // used to keep track of free spot in bitmap
-    struct wfs_inode *inode_ptr = NULL;
-    for (int i = 0; i < (super_block->num_inodes / 8); i++)
+    if (is_stats_path(path))
     {
-        // search by byte over i_bitmap
-        char *currByte = (bitmap + i);
-        for (int j = 0; j < 8; j++)
-        {
-            // check if value is equal to 0
-            if (((*currByte >> j) & 1) == 0)
-            {
-                // found free spot, set to 1 and create inode
-                *currByte |= (1 << j);
-                idx = (i * 8) + j;
-                inode_ptr = (struct wfs_inode *)(file_system + super_block->i_blocks_ptr + (idx * BLOCK_SIZE));
-                // update inode basic attributes
-                // printf("the inode number that is found free is: %d\n", free_inode_num);
-                inode_ptr->num = idx;
-                inode_ptr->mode = mode;
-                inode_ptr->uid = getuid();
-                inode_ptr->gid = getgid();
-                inode_ptr->size = 0;   // initially empty
-                inode_ptr->nlinks = 0; // initially empty
-                inode_ptr->atim = time(NULL);
-                inode_ptr->mtim = time(NULL);
-                inode_ptr->ctim = time(NULL);
-                // set all blocks to unallocated
-                for (int k = 0; k < N_BLOCKS; k++)
-                {
-                    inode_ptr->blocks[k] = 0;
-                }
-                // returns the address of a inode pointer
-                return inode_ptr;
-            }
-        }
+        return -EEXIST;
     }
-    // if not enough space, will return null.
-    return NULL;
+    return wfs_fs_mknod(fs, path, mode);
 }
 
-// returns a offset from the datablock
-// Otherwise returns -1 if no more space left
-off_t allocate_datablock()
+static int wfs_mkdir(const char *path, mode_t mode)
 {
-    off_t free_datablock;
-    int i;
-    int j;
-    char *curr_data_byte;
-    for (i = 0; i < (super_block->num_data_blocks / 8); i++)
+    if (is_stats_path(path))
     {
-
-        // get the char pointer to this byte
-        curr_data_byte = file_system + super_block->d_bitmap_ptr + i;
-        // loop over each bit, checking if they are 1
-        for (j = 0; j < 8; j++)
-        {
-            // find first open spot
-            if (((*(curr_data_byte) >> j) & 1) == 0)
-            {
-
-                // update this bit to allocated
-                // printf("\n\nopen idx: %d\n\n", (i*8 + j));
-                setbitmap((file_system + super_block->d_bitmap_ptr), 1, (i * 8 + j), 1);
-                // calculate offset for this
-                free_datablock = super_block->d_blocks_ptr + ((i * 8) + j) * BLOCK_SIZE;
-                // memset to 0
-                memset(file_system + free_datablock, 0, BLOCK_SIZE);
-                return free_datablock;
-            }
-        }
+        return -EEXIST;
     }
-    printf("this is happening in bitmap");
-
-    return -1;
+    return wfs_fs_mkdir(fs, path, mode);
 }
 
-// inserts a entry into the given directory and returns 0
-// if it is full, will return -1
-int insert_entry_into_directory(struct wfs_inode *directory, char *file_name, int new_inode_num, mode_t mode)
+static int wfs_unlink(const char *path)
 {
-    struct wfs_dentry *currBlock;
-    int n_blocks = 0;
-    if (S_ISDIR(mode))
+    if (is_stats_path(path))
     {
-        n_blocks = N_BLOCKS;
+        return -EPERM;
     }
-    else
+    return wfs_fs_unlink(fs, path);
+}
+
+static int wfs_rmdir(const char *path)
+{
+    if (is_stats_path(path))
     {
-        // for a regular file
-        n_blocks = N_BLOCKS - 1;
+        return -EPERM;
     }
-    // search through blocks to find viable spots in created blocks
-    for (int i = 0; i < n_blocks; i++)
-    {
-        // since searching left to right, check if not allocated first.
-        if (directory->blocks[i] == 0)
-        {
-            off_t new_datablock = allocate_datablock();
-            if (new_datablock == -1)
-            {
-                return -ENOSPC;
-            }
-            directory->blocks[i] = new_datablock;
-            struct wfs_dentry *new_entry = (struct wfs_dentry *)(file_system + new_datablock);
-
-            strcpy(new_entry->name, file_name);
-            new_entry->num = new_inode_num;
+    return wfs_fs_rmdir(fs, path);
+}
 
-            return 0;
-        }
-        else
-        {
-            // if allocated search for open entry.
+// what wfs_fs_readdir hands each entry to, the buffer fuse is filling
+struct fill_ctx
+{
+    void *buf;
+    fuse_fill_dir_t fill;
+};
 
-            // check within block for empty name, if empty set to new file name and num
-            for (int j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-            {
-                currBlock = (struct wfs_dentry *)(file_system + directory->blocks[i] + j);
-                if (strcmp(currBlock->name, "") == 0)
-                {
-                    strcpy(currBlock->name, file_name);
-                    // printf("the curr block name is: %s\n", currBlock->name);
-                    currBlock->num = new_inode_num;
-
-                    return 0; // much success
-                }
-            }
-        }
-    }
-    return -1;
+static int fill_entry(void *ctx, const char *name, const struct stat *st)
+{
+    struct fill_ctx *fc = ctx;
+    return fc->fill(fc->buf, name, st, 0, 0);
 }
 
-// handles the basic inode insertion
-// creating inode, making space for it
-// and adding the inode to the parent directory
+static int wfs_readdir(const char *path, void *buf, fuse_fill_dir_t fill, off_t offset, struct fuse_file_info *file_info, enum fuse_readdir_flags flags)
+{
+    struct fill_ctx fc = {buf, fill};
+    return wfs_fs_readdir(fs, path, fill_entry, &fc);
+}
 
-char *get_parent_path(const char *path)
+static int wfs_open(const char *path, struct fuse_file_info *fi)
 {
-    int last_slash_index;
-    for (int i = 0; i < strlen(path) - 1; i++)
+    if (is_stats_path(path))
     {
-        if (path[i] == '/')
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
         {
-            last_slash_index = i;
+            return -EACCES;
         }
+        // the report changes size between reads, skip the page cache
+        fi->direct_io = 1;
+        fi->fh = 0;
+        return 0;
+    }
+    struct wfs_file *file;
+    int err = wfs_fs_open(fs, path, fi->flags, &file);
+    if (err == 0)
+    {
+        fi->fh = (uintptr_t)file;
+    }
+    return err;
+}
+
+static int wfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    if (is_stats_path(path))
+    {
+        return -EEXIST;
+    }
+    struct wfs_file *file;
+    int err = wfs_fs_create(fs, path, mode, fi->flags, &file);
+    if (err == 0)
+    {
+        fi->fh = (uintptr_t)file;
     }
-    char *parent_path = strdup(path);
-    // seperate the parent path and child path
-    parent_path[last_slash_index + 1] = '\0';
+    return err;
+}
 
-    return parent_path;
+static int wfs_release(const char *path, struct fuse_file_info *fi)
+{
+    wfs_fs_release(fs, get_file(fi));
+    fi->fh = 0;
+    return 0;
 }
 
-char *get_file_name(const char *path)
+static int wfs_read(const char *path, char *buf, size_t n, off_t offset, struct fuse_file_info *fi)
 {
-    int last_slash_index;
-    for (int i = 0; i < strlen(path) - 1; i++)
+    if (is_stats_path(path))
     {
-        if (path[i] == '/')
+        char report[STATS_FILE_MAX];
+        size_t len = min(format_stats(report, sizeof(report)), sizeof(report) - 1);
+        if (offset >= len)
         {
-            last_slash_index = i;
+            return 0;
         }
+        n = min(n, len - offset);
+        memcpy(buf, report + offset, n);
+        return n;
     }
-    char *file_name = strdup(path + last_slash_index + 1);
-    return file_name;
+    return wfs_fs_read(fs, path, get_file(fi), buf, n, offset);
 }
 
-int handle_inode_insertion(const char *path, mode_t mode)
+static int wfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
-    // last slash before path has the new inode file name/location
-    //  ex: /siggy, here we would just grab siggy from this
-    // or /siggy/adam, here we would just grab adam
+    return wfs_fs_write(fs, path, get_file(fi), buf, size, offset);
+}
 
-    char *file_name = get_file_name(path);
-    char *parent_path = get_parent_path(path);
-    // get the parent, and allocate space for a new inode
-    struct wfs_inode *parent = get_inode(parent_path);
-    // printf("the parent path is: %s\n", parent_path);
-    // check that parent path exists
-    if (parent == NULL)
+static ssize_t wfs_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in, const char *path_out,
+                                   struct fuse_file_info *fi_out, off_t offset_out, size_t size, int flags)
+{
+    ssize_t copied = wfs_fs_copy_file_range(fs, path_in, offset_in, path_out, offset_out, size);
+    // shared blocks never went through the kernel's page cache
+    if (copied > 0)
     {
-        return -ENOENT;
+        invalidate_path(path_out);
     }
+    return copied;
+}
 
-    // allocate the new inode
-    struct wfs_inode *new_inode = allocate_inode(mode);
-    // make sure their is sufficient space for the inode
-    if (new_inode == NULL)
+// WFS_IOC_CLONE on regular files and WFS_IOC_DEFRAG on anything
+static int wfs_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+    if ((unsigned int)cmd == WFS_IOC_DEFRAG)
     {
-        return -ENOSPC;
+        // contents stay the same, nothing the kernel caches goes stale
+        struct wfs_defrag_arg *report = data;
+        memset(report, 0, sizeof(*report));
+        return (flags & FUSE_IOCTL_DIR) ? wfs_fs_defrag_all(fs, report) : wfs_fs_defrag(fs, path, report);
     }
-
-    // insert the new node into the parent directory
-    int is_inserted = insert_entry_into_directory(parent, file_name, new_inode->num, mode);
-    if (is_inserted == -1)
+    if ((unsigned int)cmd != WFS_IOC_CLONE || (flags & FUSE_IOCTL_DIR))
+    {
+        return -ENOTTY;
+    }
+    struct wfs_clone_arg *clone = data;
+    clone->src[sizeof(clone->src) - 1] = '\0';
+    int err = wfs_fs_clone(fs, clone->src, path);
+    if (err == 0)
     {
-        printf("erere\n");
-        return -ENOSPC;
+        invalidate_path(path);
     }
+    return err;
+}
 
-    return 0;
+// writes everything the io layer is holding back to the image
+static int wfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return wfs_fs_sync(fs);
 }
 
-static int wfs_mknod(const char *path, mode_t mode, dev_t dev)
+static void *wfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 {
-    int handled_insertion = handle_inode_insertion(path, mode);
-    if (handled_insertion != 0)
-    {
-        return handled_insertion;
+    // runs after fuse has daemonized, a thread started before that would
+    // not survive the fork
+    wfs_stats_init();
+    wfs_stats_dump_on(SIGUSR1, STDERR_FILENO);
+    wfs_log_start(STDERR_FILENO);
+    if (kernel_cache)
+    {
+        // every change goes through an op the kernel sees, except the
+        // ones invalidate_path reports, so long timeouts stay correct
+        cfg->entry_timeout = cache_timeout;
+        cfg->attr_timeout = cache_timeout;
+        if (negative_timeout < 0)
+        {
+            negative_timeout = (cache_timeout < WFS_NEGATIVE_TIMEOUT) ? cache_timeout : WFS_NEGATIVE_TIMEOUT;
+        }
+        cfg->negative_timeout = negative_timeout;
+        cfg->kernel_cache = 1;
+    }
+    if (large_io)
+    {
+        conn->max_write = WFS_LARGE_IO;
+        conn->max_read = WFS_LARGE_IO;
+        conn->max_readahead = WFS_LARGE_IO;
+        // fuse asks for async reads by default, fs_lock would hand them to
+        // the library one at a time anyway, so keep reads of a file in order
+        conn->want &= ~FUSE_CAP_ASYNC_READ;
+        // the kernel gathers small writes into whole pages and sends them
+        // down in batches instead of one request per write(2)
+        if (conn->capable & FUSE_CAP_WRITEBACK_CACHE)
+        {
+            conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+        }
     }
+    return NULL;
+}
 
-    return 0; // Success
+static void wfs_destroy(void *private_data)
+{
+    wfs_log_flush();
+    wfs_trace_flush();
+    wfs_fs_close_image(fs);
+    fs = NULL;
 }
 
-static int wfs_mkdir(const char *path, mode_t mode)
+// appends a finished call to the --trace file, rec holds its arguments.
+// the stats file only exists in the daemon, replay has nothing to run.
+static void trace(struct wfs_trace_rec *rec, enum wfs_stats_op op, uint64_t start, long ret, const char *path, const char *path2)
 {
-    // printf("entering mkdir\n");
-    // set the mode to directory
-    mode |= S_IFDIR;
-    int handled_insertion = handle_inode_insertion(path, mode);
-    if (handled_insertion != 0)
+    if (is_stats_path(path))
     {
-        return handled_insertion;
+        return;
     }
-    return 0; // Success
+    rec->op = op;
+    rec->ts_ns = start;
+    rec->duration_ns = wfs_stats_now() - start;
+    rec->result = (ret < INT32_MIN) ? INT32_MIN : (ret > INT32_MAX) ? INT32_MAX : ret;
+    wfs_trace_record(rec, path, path2);
 }
 
-// finds and removes an entry given by name, returns 0
-// if entry is not found, will return -1
-int delete(struct wfs_inode *directory, char *file_name, int is_directory)
+// the callbacks fuse sees, each one records its latency in wfs_stats and,
+// with --trace, its arguments in the trace. they hold fs_lock throughout,
+// so one request at a time reaches the library, and send any kernel
+// invalidation the call asked for after letting go of it.
+static int timed_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
 {
-
-    for (int i = 0; i < N_BLOCKS; i++)
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_getattr(path, stbuf, fi);
+    wfs_stats_record(WFS_STATS_GETATTR, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        // continue over non-available data blocks.
-        if (directory->blocks[i] == 0)
-            continue;
-
-        // loop over data entries to find within block
-        for (int j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-        {
-            struct wfs_dentry *entry = (struct wfs_dentry *)(file_system + directory->blocks[i] + j);
-
-            if (strcmp(entry->name, file_name) == 0)
-            {
-                // found so delete entry (set it to empty)
-                strcpy(entry->name, "");
-                // free from parents
-                struct wfs_inode *curr_inode = (struct wfs_inode *)(file_system + super_block->i_blocks_ptr + (entry->num * BLOCK_SIZE));
-
-                // free inode
-                setbitmap(file_system+  super_block->i_bitmap_ptr, 0, curr_inode->num, 1);
-
-                // if it is a directory, loop through all blocks and set to 0
-                if (is_directory)
-                {
-                    // free the direct pointers of this inode
-                    for (int k = 0; k < N_BLOCKS; k++)
-                    {
-                        if (curr_inode->blocks[k] != 0)
-                        {
-                            // set the dbitmaps
-                            setbitmap( file_system+ super_block->d_bitmap_ptr, 0, (curr_inode->blocks[k] - super_block->d_blocks_ptr) / 512, 1);
-                        }
-                    }
-                    return 0;
-                }
-
-                // free the direct pointers of this inode
-                for (int k = 0; k < N_BLOCKS - 1; k++)
-                {
-                    if (curr_inode->blocks[k] != 0)
-                    {
-                        // set the dbitmaps
-                        setbitmap(file_system+  super_block->d_bitmap_ptr, 0, (curr_inode->blocks[k] - super_block->d_blocks_ptr) / 512, 1);
-                    }
-                }
-
-                // free the indirect pointers
-                if (curr_inode->blocks[7] != 0)
-                {
-                    off_t *offsets = (off_t *)(file_system + curr_inode->blocks[7]);
-                    // free every indirect block
-                    for (int k = 0; k < N_BLOCKS; k++)
-                    {
-                        if (offsets[k] != 0)
-                        {
-                            // set the dbitmaps
-                            setbitmap(file_system+  super_block->d_bitmap_ptr, 0, (offsets[k] - super_block->d_blocks_ptr) / 512, 1);
-                        }
-                    }
-                }
-
-                return 0;
-            }
-        }
+        struct wfs_trace_rec rec = {0};
+        trace(&rec, WFS_STATS_GETATTR, start, ret, path, NULL);
     }
-    return 0;
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
 }
 
-int handle_unlinking(const char *path, int is_directory)
+static int timed_mknod(const char *path, mode_t mode, dev_t dev)
 {
-    char *parent_path = get_parent_path(path);
-    struct wfs_inode *parent = get_inode(parent_path);
-
-    char *file_name = get_file_name(path);
-    // struct wfs_inode *inode = get_inode(file_name);
-    // if it is a directory, first need to remove cd . & cd ..
-    int is_unlinked;
-
-    // unlink from parent directory, remove entry from data bitmap and inode bitmap
-    is_unlinked = delete (parent, file_name,is_directory);
-    if (is_unlinked == -1)
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_mknod(path, mode, dev);
+    wfs_stats_record(WFS_STATS_MKNOD, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        return -EEXIST;
+        struct wfs_trace_rec rec = {.mode = mode};
+        trace(&rec, WFS_STATS_MKNOD, start, ret, path, NULL);
     }
-
-    //  unallocate it in the inode bitmap
-    // //set this inode to free in inode bitmap
-    // printf("the i node number is: %d and its allocationow haven: %d\n", inode->num, *(file_system + super_block->i_bitmap_ptr + inode->num));
-    // setbitmap((char *)(file_system + super_block->i_bitmap_ptr), 0, inode->num, 0);
-    // printf("the i node number is: %d and its allocation: %d\n", inode->num, *(file_system + super_block->i_bitmap_ptr + inode->num));
-    // printf("now have freed the inode\n");
-
-    return 0;
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
 }
 
-/** Remove a file */
-static int wfs_unlink(const char *path)
+static int timed_mkdir(const char *path, mode_t mode)
 {
-    int is_unlinked = handle_unlinking(path, 0);
-
-    if (is_unlinked != 0)
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_mkdir(path, mode);
+    wfs_stats_record(WFS_STATS_MKDIR, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        return is_unlinked;
+        struct wfs_trace_rec rec = {.mode = mode};
+        trace(&rec, WFS_STATS_MKDIR, start, ret, path, NULL);
     }
-
-    return 0;
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
 }
 
-/** Remove a file */
-static int wfs_rmdir(const char *path)
+static int timed_unlink(const char *path)
 {
-    int is_unlinked = handle_unlinking(path,1);
-
-    if (is_unlinked != 0)
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_unlink(path);
+    wfs_stats_record(WFS_STATS_UNLINK, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        return is_unlinked;
+        struct wfs_trace_rec rec = {0};
+        trace(&rec, WFS_STATS_UNLINK, start, ret, path, NULL);
     }
-    return 0;
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
 }
 
-static int wfs_readdir(const char *path, void *buf, fuse_fill_dir_t fill, off_t offset, struct fuse_file_info *file_info)
+static int timed_rmdir(const char *path)
 {
-    // printf("In readdir: %s\n", path);
-    struct wfs_inode *directory = get_inode(path); // get parent_dir
-
-    if (directory == NULL)
-    {
-        return -ENOENT;
-    }
-    // printf("After get inode\n");
-    // check that it is directory
-    if (!S_ISDIR(directory->mode))
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_rmdir(path);
+    wfs_stats_record(WFS_STATS_RMDIR, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        printf("%d", directory->mode);
-        printf("Must pass in a directory.\n");
-        return 1;
+        struct wfs_trace_rec rec = {0};
+        trace(&rec, WFS_STATS_RMDIR, start, ret, path, NULL);
     }
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
 
-    // add cd . and cd ..
-    char *cd[2] = {".", ".."};
-    char path_checked[30];
-    for (int i = 0; i < 2; i++)
+static int timed_read(const char *path, char *buf, size_t n, off_t offset, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_read(path, buf, n, offset, fi);
+    wfs_stats_record(WFS_STATS_READ, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-
-        struct stat *statbuf = (struct stat *)malloc(sizeof(struct stat));
-        // concat the entire path, path/dentry
-        // cd .
-        if (i == 0)
-        {
-            strcpy(path_checked, path);
-        }
-        // cd ..
-        else
-        {
-            char *parent_path = get_parent_path(path);
-            strcpy(path_checked, parent_path);
-        }
-
-        if (wfs_getattr(path_checked, statbuf) != 0)
-        {
-            printf("ERROR with getattr\n");
-            return 1;
-        }
-
-        // add it to the buffer
-        if (fill(buf, cd[i], statbuf, 0) != 0)
-        {
-            printf("Buffer is full...\n");
-            return 1;
-        }
+        struct wfs_trace_rec rec = {.handle = fi ? fi->fh : 0, .offset = offset, .size = n};
+        trace(&rec, WFS_STATS_READ, start, ret, path, NULL);
     }
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
 
-    int i;
-    int j;
-    struct wfs_dentry *dentry;
-    // loop over every block
-    for (i = 0; i < N_BLOCKS; i++)
+static int timed_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_write(path, buf, size, offset, fi);
+    wfs_stats_record(WFS_STATS_WRITE, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-
-        int d_offset = directory->blocks[i];
-        // skip over empty entries
-        if (d_offset == 0)
-        {
-            // printf("d_offset: %d\n", d_offset);
-            continue;
-        }
-
-        // every block (512 bytes) has 16 possible dentries.
-        for (j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-        {
-
-            // calculate the address of the entry
-            dentry = (struct wfs_dentry *)(file_system + d_offset + j);
-            // printf("block: %d, offset: %d dentry is: %s\n", i,j,dentry->name);
-
-            // if it is not an empty string (valid), add it
-            if (strcmp(dentry->name, "") != 0)
-            {
-                struct stat *statbuf = (struct stat *)malloc(sizeof(struct stat));
-                // concat the entire path, path/dentry
-                char subfile_path[MAX_NAME + 2 + strlen(path)];
-                strcpy(subfile_path, path);
-                strcat(subfile_path, "/");
-                strcat(subfile_path, dentry->name);
-                if (wfs_getattr(subfile_path, statbuf) != 0)
-                {
-                    printf("ERROR with getattr\n");
-                    return 1;
-                }
-
-                // add it to the buffer
-                if (fill(buf, dentry->name, statbuf, 0) != 0)
-                {
-                    printf("Buffer is full...\n");
-                    return 1;
-                }
-            }
-        }
+        struct wfs_trace_rec rec = {.handle = fi ? fi->fh : 0, .offset = offset, .size = size};
+        trace(&rec, WFS_STATS_WRITE, start, ret, path, NULL);
     }
-    // printf("finished readdir\n");
-    return 0;
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
 }
 
-size_t min(size_t a, size_t b)
+static int timed_readdir(const char *path, void *buf, fuse_fill_dir_t fill, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
 {
-    return (a < b) ? a : b;
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_readdir(path, buf, fill, offset, fi, flags);
+    wfs_stats_record(WFS_STATS_READDIR, start, ret < 0);
+    if (wfs_trace_enabled())
+    {
+        struct wfs_trace_rec rec = {0};
+        trace(&rec, WFS_STATS_READDIR, start, ret, path, NULL);
+    }
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
 }
 
-static int wfs_read(const char *path, char *buf, size_t n, off_t offset, struct fuse_file_info *file)
+static int timed_fsync(const char *path, int datasync, struct fuse_file_info *fi)
 {
-    // printf("In read method\n");
-    // printf("offset passed %ld\n", offset);
-    // printf("size passed %ld\n", n);
-    struct wfs_inode *file_node = get_inode(path);
-    if (file_node == NULL)
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_fsync(path, datasync, fi);
+    wfs_stats_record(WFS_STATS_FSYNC, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        printf("Invalid path: %s\n", path);
-        return -ENOENT;
+        struct wfs_trace_rec rec = {.handle = fi ? fi->fh : 0};
+        trace(&rec, WFS_STATS_FSYNC, start, ret, path, NULL);
     }
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
 
-    int num_blocks_to_read = n / BLOCK_SIZE;
-    if (n % BLOCK_SIZE != 0)
+static int timed_open(const char *path, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_open(path, fi);
+    wfs_stats_record(WFS_STATS_OPEN, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        num_blocks_to_read++;
+        struct wfs_trace_rec rec = {.handle = fi->fh, .flags = fi->flags};
+        trace(&rec, WFS_STATS_OPEN, start, ret, path, NULL);
     }
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
 
-    // get start of datablocks
-    // char * datablocks = (char *)(file_system + super_block->d_blocks_ptr);
-    size_t bytes_read = 0; // use to decide when to break
-    size_t block_offset = offset % BLOCK_SIZE;
-    int starting_block = offset / BLOCK_SIZE;
-    for (int i = starting_block; i < N_BLOCKS; i++)
+static int timed_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_create(path, mode, fi);
+    wfs_stats_record(WFS_STATS_CREATE, start, ret < 0);
+    if (wfs_trace_enabled())
     {
-        if (bytes_read == n)
-        {
-            break;
-        }
-
-        // for error checking, shouldnt have bytes_read be greater than size n
-        if (bytes_read > n)
-        {
-            printf("read in too much...\n");
-            break;
-        }
-        // printf("file node block: %ld\n", file_node->blocks[i]);
-        if (file_node->blocks[i] != 0)
-        {
-            // valid block so read in this block
-            if (i == N_BLOCKS - 1)
-            {
-                off_t *indirect_ptr = (off_t *)(file_system + file_node->blocks[i]);
-                // loop over off_ts starting at indirect_ptr, for each one read the block
-                for (int j = 0; j < (BLOCK_SIZE / sizeof(off_t)); j++)
-                {
-                    if (indirect_ptr[j] == 0)
-                        continue;
-
-                    char *indirect_block = file_system + indirect_ptr[j] + block_offset; // offset should be zero if this is not the first block otherwise adjust
-
-                    size_t file_bytes_left = file_node->size - offset - bytes_read;
-                    size_t remianing_bytes = min(file_bytes_left, n - bytes_read);     // whats shorter length till end of file or bytes still requested
-                    size_t read_num = min(BLOCK_SIZE - block_offset, remianing_bytes); // if block offset is zero, then it should either write block size or whats left
-
-                    memcpy(buf + bytes_read, indirect_block, read_num);
-                    bytes_read += read_num;
-                    block_offset = 0; // to only apply offset once
-                }
-            }
-            else
-            {
-                char *valid_block = file_system + file_node->blocks[i] + block_offset;
+        struct wfs_trace_rec rec = {.handle = fi->fh, .mode = mode, .flags = fi->flags};
+        trace(&rec, WFS_STATS_CREATE, start, ret, path, NULL);
+    }
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
 
-                size_t length_left = file_node->size - offset - bytes_read;
-                size_t end_length = min(length_left, n - bytes_read);
-                size_t num_read = min(BLOCK_SIZE - block_offset, end_length); // do either whole block or whats left.
+static int timed_release(const char *path, struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    uint64_t handle = fi->fh; // release clears it
+    int ret = wfs_release(path, fi);
+    wfs_stats_record(WFS_STATS_RELEASE, start, ret < 0);
+    if (wfs_trace_enabled())
+    {
+        struct wfs_trace_rec rec = {.handle = handle};
+        trace(&rec, WFS_STATS_RELEASE, start, ret, path, NULL);
+    }
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
 
-                memcpy(buf + bytes_read, valid_block, num_read);
-                bytes_read += num_read;
-                block_offset = 0;
-            }
-        }
-    }
+static int timed_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    int ret = wfs_ioctl(path, cmd, arg, fi, flags, data);
+    wfs_stats_record(WFS_STATS_IOCTL, start, ret < 0);
+    if (wfs_trace_enabled())
+    {
+        // wfs_ioctl has terminated the source of any clone it looked at
+        int clone = (unsigned int)cmd == WFS_IOC_CLONE && !(flags & FUSE_IOCTL_DIR);
+        struct wfs_trace_rec rec = {.mode = cmd};
+        trace(&rec, WFS_STATS_IOCTL, start, ret, path, clone ? ((struct wfs_clone_arg *)data)->src : NULL);
+    }
+    pthread_mutex_unlock(&fs_lock);
+    flush_invalidation();
+    return ret;
+}
 
-    // printf("read over: %zu for %zu requested\n", bytes_read, n);
-    return bytes_read;
+static ssize_t timed_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in, const char *path_out,
+                                     struct fuse_file_info *fi_out, off_t offset_out, size_t size, int flags)
+{
+    pthread_mutex_lock(&fs_lock);
+    uint64_t start = wfs_stats_now();
+    ssize_t ret = wfs_copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out, size, flags);
+    wfs_stats_record(WFS_STATS_COPY_FILE_RANGE, start, ret < 0);
+    if (wfs_trace_enabled())
+    {
+        struct wfs_trace_rec rec = {.offset = offset_in, .offset2 = offset_out, .size = size};
+        trace(&rec, WFS_STATS_COPY_FILE_RANGE, start, ret, path_in, path_out);
+    }
+    pthread_mutex_unlock(&fs_lock);
+    flush_invalidation();
+    return ret;
 }
 
-// writes data to a inode
-static int wfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+// add fuse ops here
+static struct fuse_operations ops = {
+    .getattr = timed_getattr,
+    .mknod = timed_mknod,
+    .mkdir = timed_mkdir,
+    .unlink = timed_unlink,
+    .rmdir = timed_rmdir,
+    .read = timed_read,
+    .write = timed_write,
+    .readdir = timed_readdir,
+    .fsync = timed_fsync,
+    .open = timed_open,
+    .create = timed_create,
+    .release = timed_release,
+    .ioctl = timed_ioctl,
+    .copy_file_range = timed_copy_file_range,
+    .init = wfs_init,
+    .destroy = wfs_destroy,
+};
+
+int main(int argc, char **argv)
 {
-    // printf("now entering write..\n");
 
-    struct wfs_inode *inode = get_inode(path);
-    if (inode == NULL)
+    if (argc < 3)
     {
-        return -ENOENT;
+        printf("USAGE: ./wfs disk_path[,disk_path...] [--io=mmap|pread|uring] [--cache-blocks=N] [--mem-budget=SIZE] [--direct] [--discard] [--kernel-cache[=SECONDS]] [--negative-timeout=SECONDS] [--large-io] [--trace=FILE] [FUSE options] mount_point\n");
+        exit(1);
     }
 
-    off_t datablock;
-    char *datablock_ptr;
+    // get disk image path and remove from fuse args, the members of a
+    // striped set are all in it separated by commas
 
-    // if offset is empty,
-    off_t starting_block = offset / BLOCK_SIZE;
-    off_t starting_offset = offset % BLOCK_SIZE;
-    // printf("starting block: %ld starting offset is: %ld vs offset: %ld and the size is: %ld\n", starting_block, starting_offset, offset, size);
-    off_t offset_in_buffer = 0;
-    // this may be the wrong way to do it
-    size_t data_left_to_write = size;
-    // loop over first 7 blocks
-    // start at the block where the size ends, that is there is open space
-    // loop over all blocks, looking for a frees
-    // for (int i = 0; i < N_BLOCKS - 1; i++)
-    // {
-    //     printf("this block is: %ld\n", inode->blocks[i]);
-    // }
+    char *disk_img_path = strdup(argv[1]);
 
-    for (int i = starting_block; i < N_BLOCKS - 1; i++)
+    // pull out our own options, everything else goes to fuse
+    struct wfs_io_opts io_opts = {WFS_IO_MMAP, WFS_IO_DEFAULT_CACHE_BLOCKS, 0, 0};
+    char **fuse_args = (char **)malloc((argc + 2) * sizeof(char *));
+    int fuse_argc = 0;
+    fuse_args[fuse_argc++] = argv[0];
+    for (int i = 2; i < argc; i++)
     {
-        // no more blocks needed
-        if (data_left_to_write <= 0)
+        if (strcmp(argv[i], "--io=mmap") == 0)
         {
-            break;
+            io_opts.backend = WFS_IO_MMAP;
         }
-        // if the offset it zero, need to allocate the block
-        if (inode->blocks[i] == 0)
+        else if (strcmp(argv[i], "--io=pread") == 0)
         {
-            // printf("allocating a datablock in write, iteration: %d\n", i);
-            datablock = allocate_datablock();
-            if (datablock == -1)
-            {
-                return -ENOSPC;
-            }
-            inode->blocks[i] = datablock;
+            io_opts.backend = WFS_IO_PREAD;
         }
-        // otherwise, grab the data at the address
-        else
+        else if (strcmp(argv[i], "--io=uring") == 0)
         {
-            datablock = inode->blocks[i] + (starting_offset % BLOCK_SIZE);
+            io_opts.backend = WFS_IO_URING;
         }
-
-        datablock_ptr = file_system + datablock;
-
-        // calculate how much can be fit into this pointer
-        size_t bytes_left_in_block = BLOCK_SIZE - ((datablock - super_block->d_blocks_ptr) % BLOCK_SIZE);
-        size_t bytes_to_be_written = size - offset_in_buffer;
-        size_t bytes_that_will_be_written = min(bytes_left_in_block, bytes_to_be_written);
-        // printf("BLOCK: %d, BYTES LEFT IN BLOCK: %ld, BYTES TO BE WRITTEN: %ld, BYTES THAT WILL BE WRITTEN %ld WRITTEN TO: %ld\n",
-        // i, bytes_left_in_block, bytes_to_be_written, bytes_that_will_be_written, datablock);
-
-        // copy over memory
-        memcpy(datablock_ptr, buf + offset_in_buffer, bytes_that_will_be_written);
-
-        // mark block as allocated
-
-        // update size
-        inode->size += bytes_that_will_be_written;
-        offset_in_buffer += bytes_that_will_be_written;
-        starting_offset += bytes_that_will_be_written;
-        starting_block++;
-        data_left_to_write -= bytes_that_will_be_written;
-    }
-
-    // if there is still more, use an indirect block
-    if (data_left_to_write > 0)
-    {
-        // check to see if the block is currently free
-        // if it is not, allocate it
-        if (inode->blocks[7] == 0)
+        else if (strncmp(argv[i], "--cache-blocks=", strlen("--cache-blocks=")) == 0)
         {
-            inode->blocks[7] = allocate_datablock();
-            if (inode->blocks[7] == -1)
-            {
-                return -ENOSPC;
-            }
+            io_opts.cache_blocks = strtoul(argv[i] + strlen("--cache-blocks="), NULL, 10);
         }
-        // find the start inside of the indirect blocks
-        int index_in_indirect = starting_block - 7;
-        // printf("the starting block is: %ld\n", starting_block);
-        // printf("the current index is:%d\n ", index_in_indirect);
-        // loop through each block in the indirect block
-        printf("size of an offse it: %ld\n", sizeof(off_t));
-        off_t *offsets = (off_t *)(file_system + inode->blocks[7]);
-
-        for (int i = index_in_indirect; i < BLOCK_SIZE / sizeof(off_t); i++)
+        else if (strncmp(argv[i], "--mem-budget=", strlen("--mem-budget=")) == 0)
         {
-            // no more blocks needed
-            if (data_left_to_write <= 0)
-            {
-                break;
-            }
-            // if the offset it zero, need to allocate the block
-            if (offsets[i] == 0)
-            {
-                // printf("allocating a datablock in write, iteration: %d\n", i);
-                datablock = allocate_datablock();
-                if (datablock == -1)
-                {
-                    return -ENOSPC;
-                }
-                offsets[i] = datablock;
-            }
-            // otherwise, grab the data at the address
-            else
+            mem_budget = parse_size(argv[i] + strlen("--mem-budget="));
+            io_opts.mem_budget = mem_budget;
+        }
+        else if (strcmp(argv[i], "--direct") == 0)
+        {
+            io_opts.direct = 1;
+        }
+        else if (strcmp(argv[i], "--discard") == 0)
+        {
+            io_opts.discard = 1;
+        }
+        else if (strcmp(argv[i], "--kernel-cache") == 0)
+        {
+            kernel_cache = 1;
+            cache_timeout = WFS_CACHE_TIMEOUT;
+        }
+        else if (strncmp(argv[i], "--kernel-cache=", strlen("--kernel-cache=")) == 0)
+        {
+            kernel_cache = 1;
+            cache_timeout = strtod(argv[i] + strlen("--kernel-cache="), NULL);
+        }
+        else if (strncmp(argv[i], "--negative-timeout=", strlen("--negative-timeout=")) == 0)
+        {
+            negative_timeout = strtod(argv[i] + strlen("--negative-timeout="), NULL);
+        }
+        else if (strcmp(argv[i], "--large-io") == 0)
+        {
+            large_io = 1;
+        }
+        else if (strncmp(argv[i], "--trace=", strlen("--trace=")) == 0)
+        {
+            // opened here, fuse changes to / when it daemonizes
+            const char *trace_path = argv[i] + strlen("--trace=");
+            int trace_fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (trace_fd < 0 || wfs_trace_open(trace_fd) != 0)
             {
-                datablock = offsets[i] + (starting_offset % BLOCK_SIZE);
+                printf("ERROR: cannot write trace to %s\n", trace_path);
+                exit(1);
             }
-
-            datablock_ptr = file_system + datablock;
-
-            // calculate how much can be fit into this pointer
-            size_t bytes_left_in_block = BLOCK_SIZE - ((datablock - super_block->d_blocks_ptr) % BLOCK_SIZE);
-            size_t bytes_to_be_written = size - offset_in_buffer;
-            size_t bytes_that_will_be_written = min(bytes_left_in_block, bytes_to_be_written);
-            // printf("BLOCK: %d, BYTES LEFT IN BLOCK: %ld, BYTES TO BE WRITTEN: %ld, BYTES THAT WILL BE WRITTEN %ld WRITTEN TO: %ld\n",
-            // i, bytes_left_in_block, bytes_to_be_written, bytes_that_will_be_written, datablock);
-
-            // copy over memory
-            memcpy(datablock_ptr, buf + offset_in_buffer, bytes_that_will_be_written);
-
-            // mark block as allocated
-
-            // update size
-            inode->size += bytes_that_will_be_written;
-            offset_in_buffer += bytes_that_will_be_written;
-            starting_offset += bytes_that_will_be_written;
-            starting_block++;
-            data_left_to_write -= bytes_that_will_be_written;
+        }
+        else
+        {
+            fuse_args[fuse_argc++] = argv[i];
         }
     }
-    if (data_left_to_write > 0)
-    {
-        return -ENOSPC;
-    }
-    // printf("everything written...\n");
-    return size;
-}
-
-// add fuse ops here
-static struct fuse_operations ops = {
-    .getattr = wfs_getattr,
-    .mknod = wfs_mknod,
-    .mkdir = wfs_mkdir,
-    .unlink = wfs_unlink,
-    .rmdir = wfs_rmdir,
-    .read = wfs_read,
-    .write = wfs_write,
-    .readdir = wfs_readdir,
-};
-
-int main(int argc, char **argv)
-{
 
-    if (argc < 3)
+    // max_read has to be given to the mount as well as set in init
+    char max_read_opt[64];
+    if (large_io)
     {
-        printf("USAGE: ./wfs disk_path [FUSE options] mount_point\n");
-        exit(1);
+        snprintf(max_read_opt, sizeof(max_read_opt), "max_read=%d", WFS_LARGE_IO);
+        fuse_args[fuse_argc++] = "-o";
+        fuse_args[fuse_argc++] = max_read_opt;
     }
 
-    // get disk image path and remove from fuse args
-
-    char *disk_img_path = strdup(argv[1]);
-
     // attempt to open disk img to verify path
-    int fd = open(disk_img_path, O_RDWR);
-    if (fd < 0)
+    fs = wfs_fs_open_image(disk_img_path, &io_opts);
+    if (fs == NULL)
     {
         printf("ERROR: cannot open disk image, verify the path.\nPATH GIVEN: %s\n", disk_img_path);
         exit(1);
     }
-    struct stat stat;
-    fstat(fd, &stat);
-    off_t size = stat.st_size;
-
-    // setup pointers
-    file_system = mmap(NULL, size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0); // Corrected mmap call
-    super_block = (struct wfs_sb *)file_system;
 
-    printf("the super block inode count is: %ld\n", super_block->num_inodes);
-    printf("super block dblock count: %ld\n", super_block->num_data_blocks);
-    close(fd);
-    // remove disk image path from args to give to fuse main
-    char **fuse_args = (char **)malloc((argc - 1) * sizeof(char *));
-    fuse_args[0] = argv[0];
-    for (int i = 1; i < argc - 1; i++)
-    {
-        fuse_args[i] = argv[i + 1];
-    }
-    // printf("the free inode is %d\n", allocate_inode()->num);
-    for (int i = 0; i < argc - 1; i++)
+    struct statvfs geometry;
+    wfs_fs_statfs(fs, &geometry);
+    wfs_info("%s: %lu inodes, %lu data blocks", disk_img_path, geometry.f_files, geometry.f_blocks);
+    for (int i = 0; i < fuse_argc; i++)
     {
-        printf("%s\n", fuse_args[i]);
+        wfs_debug("fuse arg %d: %s", i, fuse_args[i]);
     }
-    return fuse_main(argc - 1, fuse_args, &ops, NULL);
+    // SIGUSR1 is only taken by the stats thread wfs_init starts, every
+    // thread fuse creates inherits the mask
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+    return fuse_main(fuse_argc, fuse_args, &ops, NULL);
 }
@@ -1,4 +1,6 @@
 #include <time.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
 
 #define FUSE_USE_VERSION 30
 
@@ -56,3 +58,127 @@ struct wfs_dentry {
     char name[MAX_NAME];
     int num;
 };
+
+/*
+  Optional superblock extension. mkfs only writes it when a feature is
+  asked for, between the superblock and the inode bitmap, so images made
+  without features keep the layout above with i_bitmap_ptr right after
+  the superblock.
+*/
+#define WFS_EXT_MAGIC (0x31534657) // "WFS1"
+
+#define WFS_FEATURE_COMPRESS (1u << 0) // file data is stored in compressed clusters
+#define WFS_FEATURE_REFCOUNT (1u << 1) // data blocks carry reference counts and can be shared
+#define WFS_FEATURE_DEDUP    (1u << 2) // identical file blocks are shared as they are written
+#define WFS_FEATURE_CSUM     (1u << 3) // bitmaps, inodes and directory blocks carry checksums
+
+struct wfs_sb_ext {
+    uint32_t magic;
+    uint32_t features;
+    uint64_t refcount_ptr; // WFS_FEATURE_REFCOUNT, see below
+    uint64_t csum_ptr;     // WFS_FEATURE_CSUM, see below
+    uint64_t csum_pending; // WFS_FEATURE_CSUM, nonzero while the table may lag behind
+    uint64_t reserved[28]; // room for later fields without moving the bitmaps
+};
+
+/*
+  Reference counts (WFS_FEATURE_REFCOUNT). One wfs_refcount_t per data
+  block sits between the data bitmap and the inodes at refcount_ptr. A
+  block in use has a count of at least 1 and is only cleared from the
+  data bitmap when the count drops to 0. A block with a count above 1 is
+  shared and never written in place.
+*/
+typedef uint16_t wfs_refcount_t;
+#define WFS_REFCOUNT_MAX (UINT16_MAX)
+
+/*
+  Metadata checksums (WFS_FEATURE_CSUM). A table of CRC32C values sits
+  after the refcount table, or the data bitmap, at csum_ptr, right
+  before the inodes. It has one entry per BLOCK_SIZE piece of the inode
+  bitmap, then of the data bitmap, then one per inode covering its
+  struct wfs_inode, then one per data block. Data block entries are
+  only kept up to date for blocks holding directory entries, file data
+  is not checksummed. A mount recomputes the entries of what it changed
+  when it syncs or closes the image, and keeps csum_pending set in
+  between. An image opened with csum_pending still set was not closed
+  cleanly, and all its entries are recomputed rather than checked.
+*/
+typedef uint32_t wfs_csum_t;
+#define WFS_CSUM_PIECES(bytes)     (((bytes) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+#define WFS_CSUM_IBITMAP(sb, i)    (i)
+#define WFS_CSUM_DBITMAP(sb, i)    (WFS_CSUM_PIECES((sb)->num_inodes / 8) + (i))
+#define WFS_CSUM_INODE(sb, num)    (WFS_CSUM_DBITMAP(sb, WFS_CSUM_PIECES((sb)->num_data_blocks / 8)) + (num))
+#define WFS_CSUM_DATA(sb, idx)     (WFS_CSUM_INODE(sb, (sb)->num_inodes) + (idx))
+#define WFS_CSUM_ENTRIES(sb)       (WFS_CSUM_DATA(sb, (sb)->num_data_blocks))
+
+/*
+  Striped sets. mkfs given several images lays one file system over all
+  of them, RAID-0 style. Every member starts with a wfs_stripe_label in
+  its first WFS_STRIPE_LABEL_SIZE bytes. Right after it member 0 holds
+  everything before i_blocks_ptr. The inodes and data blocks from there
+  on are dealt out stripe_unit bytes at a time, member 0 first, and sit
+  from grid_base on in every member. Offsets in the superblock and in
+  block pointers are offsets into this striped image, not into a member.
+  A single image has no label and starts with the superblock.
+*/
+#define WFS_STRIPE_MAGIC      (0x3044494152534657ULL) // "WFSRAID0"
+#define WFS_STRIPE_LABEL_SIZE (4096)
+
+struct wfs_stripe_label {
+    uint64_t magic;
+    uint32_t disks;       // members in the set
+    uint32_t index;       // place of this member in the set
+    uint64_t set_id;      // the same on every member of one set
+    uint64_t stripe_unit; // bytes, a multiple of BLOCK_SIZE
+    uint64_t grid_base;   // member offset of the first stripe
+    uint64_t grid_bytes;  // stripes on each member, in bytes
+    struct wfs_sb sb;     // copy of the superblock
+};
+
+/*
+  Clone ioctl, needs WFS_FEATURE_REFCOUNT. Issued on an open regular file
+  it replaces the file's contents with those of src, a path inside the
+  mount, by sharing src's data blocks. FICLONE itself is handled by the
+  VFS and never reaches a FUSE file system, so wfs has its own number.
+*/
+struct wfs_clone_arg {
+    char src[256];
+};
+
+#define WFS_IOC_CLONE _IOW('W', 1, struct wfs_clone_arg)
+
+/*
+  Defragment ioctl. Issued on a regular file it moves the file's blocks
+  into one contiguous run if they are spread over several, on a
+  directory it does that for every file and directory in the image. An
+  extent is a run of blocks that follow each other on disk in file
+  order. Files with shared blocks are left where they are. The daemon
+  runs it under the lock every other request takes, so a reader sees
+  either the old or the new layout, never a mix.
+*/
+struct wfs_defrag_arg {
+    uint32_t files;          // files and directories with blocks looked at
+    uint32_t fragmented;     // of those, the ones in more than one extent
+    uint32_t moved;          // fragmented ones now in a single extent
+    uint32_t reserved;
+    uint64_t extents_before;
+    uint64_t extents_after;
+};
+
+#define WFS_IOC_DEFRAG _IOR('W', 2, struct wfs_defrag_arg)
+
+/*
+  Compressed clusters (WFS_FEATURE_COMPRESS). File blocks are grouped into
+  clusters of CLUSTER_BLOCKS, starting at file block 0. A cluster that
+  compressed well has COMPRESSED_CLUSTER in its first block pointer and
+  the blocks holding a wfs_cluster_hdr plus the compressed bytes in the
+  pointers after it. Any other cluster is stored as plain blocks.
+*/
+#define CLUSTER_BLOCKS (8)
+#define CLUSTER_SIZE   (CLUSTER_BLOCKS * BLOCK_SIZE)
+#define COMPRESSED_CLUSTER ((off_t)1) // never a real block, those start at d_blocks_ptr
+
+struct wfs_cluster_hdr {
+    uint16_t clen;   // compressed bytes after the header
+    uint16_t rawlen; // bytes they expand to
+};
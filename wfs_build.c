@@ -0,0 +1,442 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "wfs.h"
+#include "wfs_io.h"
+#include "wfs_build.h"
+
+#define DENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(struct wfs_dentry))
+// directories only use their direct blocks for regular file entries
+#define DIR_MAX_BLOCKS (IND_BLOCK)
+#define FILE_MAX_BLOCKS (IND_BLOCK + (BLOCK_SIZE / sizeof(off_t)))
+#define INODE_BATCH (256)
+
+// one file or directory of the host tree, its index is its inode number
+struct node
+{
+    char *path; // on the host
+    const char *name; // points into path
+    int is_dir;
+    int first_child; // directories: children are [first_child, first_child + children)
+    int children;
+    struct stat st;
+    long first_block; // index of the first data block, -1 without blocks
+    int n_blocks;     // data blocks, for files without the indirect block
+};
+
+struct build
+{
+    const struct wfs_stripe *set;
+    const struct wfs_sb *sb;
+    struct node *nodes;
+    int n_nodes;
+    int cap;
+    int next; // next node a worker takes, atomically
+    int failed;
+};
+
+static int add_node(struct build *b, char *path, int is_dir)
+{
+    if (b->n_nodes == b->cap)
+    {
+        int cap = b->cap ? b->cap * 2 : 1024;
+        struct node *grown = realloc(b->nodes, cap * sizeof(struct node));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        b->nodes = grown;
+        b->cap = cap;
+    }
+    struct node *n = &b->nodes[b->n_nodes++];
+    memset(n, 0, sizeof(struct node));
+    n->path = path;
+    const char *slash = strrchr(path, '/');
+    n->name = slash ? slash + 1 : path;
+    n->is_dir = is_dir;
+    n->first_block = -1;
+    return 0;
+}
+
+// lists every directory in node order and appends its children, so the
+// tree ends up breadth first with each directory's children together
+static int walk(struct build *b, int max_inodes)
+{
+    for (int i = 0; i < b->n_nodes; i++)
+    {
+        if (!b->nodes[i].is_dir)
+        {
+            continue;
+        }
+        DIR *dir = opendir(b->nodes[i].path);
+        if (dir == NULL)
+        {
+            fprintf(stderr, "ERROR: cannot list %s: %s\n", b->nodes[i].path, strerror(errno));
+            return -1;
+        }
+        b->nodes[i].first_child = b->n_nodes;
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL)
+        {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            {
+                continue;
+            }
+            char *path;
+            if (asprintf(&path, "%s/%s", b->nodes[i].path, de->d_name) < 0)
+            {
+                closedir(dir);
+                return -1;
+            }
+            int type = de->d_type;
+            if (type == DT_UNKNOWN)
+            {
+                struct stat st;
+                type = (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type != DT_DIR && type != DT_REG)
+            {
+                fprintf(stderr, "WARNING: skipping %s, only files and directories are copied\n", path);
+                free(path);
+                continue;
+            }
+            if (strlen(de->d_name) >= MAX_NAME)
+            {
+                fprintf(stderr, "ERROR: %s: names are at most %d characters\n", path, MAX_NAME - 1);
+                free(path);
+                closedir(dir);
+                return -1;
+            }
+            if (b->n_nodes == max_inodes)
+            {
+                fprintf(stderr, "ERROR: %s has more than the %d files and directories the image has inodes for\n",
+                        b->nodes[0].path, max_inodes - 1);
+                free(path);
+                closedir(dir);
+                return -1;
+            }
+            if (add_node(b, path, type == DT_DIR) != 0)
+            {
+                free(path);
+                closedir(dir);
+                return -1;
+            }
+            b->nodes[i].children++;
+        }
+        closedir(dir);
+        if (b->nodes[i].children > DIR_MAX_BLOCKS * (int)DENTRIES_PER_BLOCK)
+        {
+            fprintf(stderr, "ERROR: %s has %d entries, a directory holds at most %d\n", b->nodes[i].path,
+                    b->nodes[i].children, DIR_MAX_BLOCKS * (int)DENTRIES_PER_BLOCK);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static off_t block_offset(struct build *b, long block)
+{
+    return b->sb->d_blocks_ptr + (off_t)block * BLOCK_SIZE;
+}
+
+static int stat_node(struct build *b, struct node *n)
+{
+    if (lstat(n->path, &n->st) != 0)
+    {
+        fprintf(stderr, "ERROR: cannot stat %s: %s\n", n->path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// writes a file's data as one extent, then its indirect block, or a
+// directory's dentry blocks
+static int copy_node(struct build *b, struct node *n)
+{
+    int idx = n - b->nodes;
+    if (n->first_block < 0)
+    {
+        return 0;
+    }
+    size_t len = (size_t)n->n_blocks * BLOCK_SIZE;
+    char *buf = calloc(1, len);
+    if (buf == NULL)
+    {
+        return -1;
+    }
+    if (n->is_dir)
+    {
+        struct wfs_dentry *entries = (struct wfs_dentry *)buf;
+        for (int c = 0; c < n->children; c++)
+        {
+            strcpy(entries[c].name, b->nodes[n->first_child + c].name);
+            entries[c].num = n->first_child + c;
+        }
+    }
+    else
+    {
+        int in = open(n->path, O_RDONLY);
+        if (in < 0)
+        {
+            fprintf(stderr, "ERROR: cannot read %s: %s\n", n->path, strerror(errno));
+            free(buf);
+            return -1;
+        }
+        // a file that shrank since it was stat'ed reads back zeroes
+        size_t done = 0;
+        ssize_t got;
+        while (done < (size_t)n->st.st_size && (got = read(in, buf + done, n->st.st_size - done)) > 0)
+        {
+            done += got;
+        }
+        close(in);
+    }
+    int err = wfs_stripe_pwrite(b->set, buf, len, block_offset(b, n->first_block)) == 0 ? 0 : -1;
+    free(buf);
+
+    if (err == 0 && !n->is_dir && n->n_blocks > IND_BLOCK)
+    {
+        off_t indirect[BLOCK_SIZE / sizeof(off_t)] = {0};
+        for (int k = IND_BLOCK; k < n->n_blocks; k++)
+        {
+            indirect[k - IND_BLOCK] = block_offset(b, n->first_block + k);
+        }
+        long ind = n->first_block + n->n_blocks;
+        err = wfs_stripe_pwrite(b->set, indirect, BLOCK_SIZE, block_offset(b, ind)) == 0 ? 0 : -1;
+    }
+    if (err != 0)
+    {
+        fprintf(stderr, "ERROR: cannot write %s (inode %d) into the image: %s\n", n->path, idx, strerror(errno));
+    }
+    return err;
+}
+
+struct pool_job
+{
+    struct build *b;
+    int (*fn)(struct build *, struct node *);
+};
+
+static void *pool_worker(void *arg)
+{
+    struct pool_job *job = arg;
+    struct build *b = job->b;
+    int i;
+    while (!__atomic_load_n(&b->failed, __ATOMIC_RELAXED) && (i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->n_nodes)
+    {
+        if (job->fn(b, &b->nodes[i]) != 0)
+        {
+            __atomic_store_n(&b->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// runs fn on every node, spread over threads
+static int run_pool(struct build *b, int threads, int (*fn)(struct build *, struct node *))
+{
+    struct pool_job job = {b, fn};
+    pthread_t tids[threads];
+    int started = 0;
+    b->next = 0;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&tids[started], NULL, pool_worker, &job) != 0)
+        {
+            break;
+        }
+    }
+    // with no thread at all the caller does the work itself
+    if (started == 0)
+    {
+        pool_worker(&job);
+    }
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    return b->failed ? -1 : 0;
+}
+
+// data blocks in node order: a directory's dentry blocks, a file's data
+// then its indirect block. returns the number of blocks used or -1.
+static long assign_blocks(struct build *b)
+{
+    long next = 0;
+    for (int i = 0; i < b->n_nodes; i++)
+    {
+        struct node *n = &b->nodes[i];
+        if (n->is_dir)
+        {
+            n->n_blocks = (n->children + DENTRIES_PER_BLOCK - 1) / DENTRIES_PER_BLOCK;
+        }
+        else
+        {
+            n->n_blocks = (n->st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            if (n->n_blocks > (int)FILE_MAX_BLOCKS)
+            {
+                fprintf(stderr, "ERROR: %s is %ld bytes, a file holds at most %ld\n", n->path, (long)n->st.st_size,
+                        (long)FILE_MAX_BLOCKS * BLOCK_SIZE);
+                return -1;
+            }
+        }
+        if (n->n_blocks == 0)
+        {
+            continue;
+        }
+        n->first_block = next;
+        next += n->n_blocks + ((!n->is_dir && n->n_blocks > IND_BLOCK) ? 1 : 0);
+    }
+    return next;
+}
+
+static void fill_inode(struct build *b, int num, struct wfs_inode *inode)
+{
+    struct node *n = &b->nodes[num];
+    inode->num = num;
+    inode->mode = n->st.st_mode;
+    inode->uid = n->st.st_uid;
+    inode->gid = n->st.st_gid;
+    inode->size = n->is_dir ? 0 : n->st.st_size;
+    inode->nlinks = n->is_dir ? 2 : 1;
+    inode->atim = n->st.st_atime;
+    inode->mtim = n->st.st_mtime;
+    inode->ctim = n->st.st_ctime;
+    int direct = n->n_blocks < IND_BLOCK ? n->n_blocks : IND_BLOCK;
+    for (int k = 0; k < direct; k++)
+    {
+        inode->blocks[k] = block_offset(b, n->first_block + k);
+    }
+    if (!n->is_dir && n->n_blocks > IND_BLOCK)
+    {
+        inode->blocks[IND_BLOCK] = block_offset(b, n->first_block + n->n_blocks);
+    }
+}
+
+// every inode slot in order, INODE_BATCH of them per write
+static int write_inodes(struct build *b)
+{
+    static char slots[INODE_BATCH * BLOCK_SIZE];
+    for (int first = 0; first < b->n_nodes; first += INODE_BATCH)
+    {
+        int count = (b->n_nodes - first < INODE_BATCH) ? b->n_nodes - first : INODE_BATCH;
+        memset(slots, 0, sizeof(slots));
+        for (int k = 0; k < count; k++)
+        {
+            struct wfs_inode *inode = (struct wfs_inode *)(slots + k * BLOCK_SIZE);
+            if (first + k == 0)
+            {
+                // the root keeps what mkfs gave it, only its blocks are new
+                if (wfs_stripe_pread(b->set, inode, sizeof(struct wfs_inode), b->sb->i_blocks_ptr) != 0)
+                {
+                    return -1;
+                }
+                struct wfs_inode root = *inode;
+                fill_inode(b, 0, inode);
+                inode->mode = root.mode;
+                inode->uid = root.uid;
+                inode->gid = root.gid;
+                inode->size = root.size;
+                inode->nlinks = root.nlinks;
+                continue;
+            }
+            fill_inode(b, first + k, inode);
+        }
+        size_t len = (size_t)count * BLOCK_SIZE;
+        if (wfs_stripe_pwrite(b->set, slots, len, b->sb->i_blocks_ptr + (off_t)first * BLOCK_SIZE) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// sets the first used bits of a bitmap of bits entries at ptr
+static int write_bitmap(struct build *b, off_t ptr, long bits, long used)
+{
+    size_t len = bits / 8;
+    unsigned char *map = calloc(1, len);
+    if (map == NULL)
+    {
+        return -1;
+    }
+    for (long i = 0; i < used; i++)
+    {
+        map[i / 8] |= 1 << (i % 8);
+    }
+    int err = wfs_stripe_pwrite(b->set, map, len, ptr) == 0 ? 0 : -1;
+    free(map);
+    return err;
+}
+
+static int write_refcounts(struct build *b, const struct wfs_sb_ext *ext, long used)
+{
+    wfs_refcount_t *counts = malloc(used * sizeof(wfs_refcount_t));
+    if (counts == NULL)
+    {
+        return -1;
+    }
+    for (long i = 0; i < used; i++)
+    {
+        counts[i] = 1;
+    }
+    size_t len = used * sizeof(wfs_refcount_t);
+    int err = wfs_stripe_pwrite(b->set, counts, len, ext->refcount_ptr) == 0 ? 0 : -1;
+    free(counts);
+    return err;
+}
+
+int wfs_build(const struct wfs_stripe *set, const struct wfs_sb *sb, const struct wfs_sb_ext *ext, const char *src, int threads)
+{
+    if (ext != NULL && (ext->features & WFS_FEATURE_COMPRESS))
+    {
+        fprintf(stderr, "ERROR: -r cannot fill a compressed image, mount it and copy instead.\n");
+        return -1;
+    }
+    struct build b = {set, sb};
+    int err = -1;
+    char *root = strdup(src);
+    if (root == NULL || add_node(&b, root, 1) != 0)
+    {
+        free(root);
+        return -1;
+    }
+
+    long used;
+    if (walk(&b, sb->num_inodes) != 0 || run_pool(&b, threads, stat_node) != 0 || (used = assign_blocks(&b)) < 0)
+    {
+        goto out;
+    }
+    if (used > sb->num_data_blocks)
+    {
+        fprintf(stderr, "ERROR: %s needs %ld data blocks, the image has %ld\n", src, used, (long)sb->num_data_blocks);
+        goto out;
+    }
+    if (run_pool(&b, threads, copy_node) != 0)
+    {
+        goto out;
+    }
+    if (write_inodes(&b) != 0 || write_bitmap(&b, sb->i_bitmap_ptr, sb->num_inodes, b.n_nodes) != 0 ||
+        write_bitmap(&b, sb->d_bitmap_ptr, sb->num_data_blocks, used) != 0 ||
+        (ext != NULL && (ext->features & WFS_FEATURE_REFCOUNT) && write_refcounts(&b, ext, used) != 0))
+    {
+        perror("ERROR: failed to write the image metadata");
+        goto out;
+    }
+    printf("copied %d files and directories in %ld data blocks from %s\n", b.n_nodes - 1, used, src);
+    err = 0;
+out:
+    for (int i = 0; i < b.n_nodes; i++)
+    {
+        free(b.nodes[i].path);
+    }
+    free(b.nodes);
+    return err;
+}
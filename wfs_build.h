@@ -0,0 +1,35 @@
+#ifndef WFS_BUILD_H
+#define WFS_BUILD_H
+
+// wfs.h has no include guard, so it is left to the includer
+struct wfs_sb;
+struct wfs_sb_ext;
+struct wfs_stripe;
+
+/*
+  Populates a freshly formatted image from a host directory tree, for
+  mkfs -r. It does not go through the file system code: on an empty
+  image every inode number and data block can be handed out in order up
+  front, so the builder lays the whole tree out in memory and then
+  writes it with large sequential writes.
+
+  The host tree is walked breadth first, so every directory's entries
+  are neighbours and inode numbers follow the tree level by level. Each
+  directory gets its dentry blocks in one run and each file its data
+  blocks followed by its indirect block, so a file reads back from one
+  contiguous extent. Stat calls and file copies are spread over
+  threads. Inodes, bitmaps and the refcount table are written last, in
+  order.
+
+  Only regular files and directories are copied. Everything else, like
+  symlinks and devices, is skipped with a warning. Mode, owner and
+  times come from the host. Compressed images are not supported.
+*/
+
+// copies the tree below src into the image open as set, whose superblock
+// and root inode mkfs has just written. ext is NULL for images without
+// features. uses up to threads threads. returns 0, or -1 after printing
+// what went wrong.
+int wfs_build(const struct wfs_stripe *set, const struct wfs_sb *sb, const struct wfs_sb_ext *ext, const char *src, int threads);
+
+#endif
@@ -0,0 +1,147 @@
+#include <string.h>
+#include <pthread.h>
+#include "wfs_crc.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// the Castagnoli polynomial, bit reversed
+#define CRC32C_POLY (0x82f63b78u)
+// the crc32 instruction takes three cycles to produce its result but can
+// start a new one every cycle, so the hardware kernel runs three streams
+// this long side by side. three of them cover a 512 byte block but for
+// one word.
+#define CRC_STRIPE (168)
+
+static uint32_t crc_table[8][256];
+// crc_stripe[k][i] is the state (i << 8k) advances to over CRC_STRIPE
+// zero bytes, which is how a stream's state is carried past the next one
+static uint32_t crc_stripe[4][256];
+static uint32_t (*crc_kernel)(uint32_t crc, const unsigned char *p, size_t n);
+static const char *crc_name;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// slicing by 8: one lookup per byte, but the eight of a word are
+// independent so they overlap instead of waiting on each other
+static uint32_t crc_slice8(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n >= 8)
+    {
+        uint32_t lo = crc ^ load32(p);
+        uint32_t hi = load32(p + 4);
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^ crc_table[5][(lo >> 16) & 0xff] ^
+              crc_table[4][lo >> 24] ^ crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+              crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0)
+    {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// the state crc moves to over CRC_STRIPE zero bytes
+static uint32_t crc_shift(uint32_t crc)
+{
+    return crc_stripe[0][crc & 0xff] ^ crc_stripe[1][(crc >> 8) & 0xff] ^ crc_stripe[2][(crc >> 16) & 0xff] ^
+           crc_stripe[3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+    // three stripes at a time, the later two start from 0 and the state of
+    // the one before is shifted past them when they are joined
+    while (n >= 3 * CRC_STRIPE)
+    {
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < CRC_STRIPE; i += 8)
+        {
+            uint64_t v0, v1, v2;
+            memcpy(&v0, p + i, sizeof(v0));
+            memcpy(&v1, p + CRC_STRIPE + i, sizeof(v1));
+            memcpy(&v2, p + 2 * CRC_STRIPE + i, sizeof(v2));
+            crc0 = _mm_crc32_u64(crc0, v0);
+            crc1 = _mm_crc32_u64(crc1, v1);
+            crc2 = _mm_crc32_u64(crc2, v2);
+        }
+        crc = crc_shift(crc_shift(crc0) ^ crc1) ^ crc2;
+        p += 3 * CRC_STRIPE;
+        n -= 3 * CRC_STRIPE;
+    }
+    uint64_t crc64 = crc;
+    while (n >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        n -= 8;
+    }
+    crc = crc64;
+    while (n-- > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc_init(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        for (int t = 1; t < 8; t++)
+        {
+            uint32_t prev = crc_table[t - 1][i];
+            crc_table[t][i] = (prev >> 8) ^ crc_table[0][prev & 0xff];
+        }
+    }
+    static const unsigned char zeroes[CRC_STRIPE];
+    for (int k = 0; k < 4; k++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            crc_stripe[k][i] = crc_slice8((uint32_t)i << (8 * k), zeroes, CRC_STRIPE);
+        }
+    }
+    crc_kernel = crc_slice8;
+    crc_name = "table";
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc_kernel = crc_sse42;
+        crc_name = "sse4.2";
+    }
+#endif
+}
+
+uint32_t wfs_crc32c(uint32_t crc, const void *buf, size_t n)
+{
+    pthread_once(&crc_once, crc_init);
+    return ~crc_kernel(~crc, buf, n);
+}
+
+const char *wfs_crc32c_impl(void)
+{
+    pthread_once(&crc_once, crc_init);
+    return crc_name;
+}
@@ -0,0 +1,20 @@
+#ifndef WFS_CRC_H
+#define WFS_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  CRC32C (Castagnoli) for the metadata checksums. On x86-64 CPUs with
+  SSE4.2 it runs on the crc32 instruction, eight bytes at a time, and
+  everywhere else on a slicing-by-8 table. The choice is made once, on
+  first use, so callers never see which one ran except in the speed.
+*/
+
+// the CRC32C of n bytes at buf. crc is 0 to start, or the result for
+// the bytes before them to continue a checksum over several buffers.
+uint32_t wfs_crc32c(uint32_t crc, const void *buf, size_t n);
+// "sse4.2" or "table", for benchmarks and the log
+const char *wfs_crc32c_impl(void);
+
+#endif
@@ -0,0 +1,726 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "wfs.h"
+#include "wfs_io.h"
+#include "wfs_lz.h"
+
+// reads files out of an image without mounting it. the image is opened
+// read only and parsed straight from the on-disk structures with pread,
+// so several workers can copy files at once and a damaged image is
+// reported instead of followed. file blocks that sit next to each other
+// on disk are read with one call. a striped set is named like wfs takes
+// it, the members separated by commas.
+// USAGE: ./wfs_dump image ls [path]
+//        ./wfs_dump image stat path
+//        ./wfs_dump image cat path
+//        ./wfs_dump image tar [path]             ustar archive on stdout
+//        ./wfs_dump image extract path host_dir [-j threads]
+// tar and extract copy the contents of a directory path, or the file
+// itself. only files and directories exist in an image.
+
+#define MAX_FILE_BLOCKS (IND_BLOCK + (BLOCK_SIZE / sizeof(off_t)))
+#define MAX_FILE_SIZE (MAX_FILE_BLOCKS * BLOCK_SIZE)
+#define SNAPSHOT_DIR ".snapshots"
+
+struct image
+{
+    struct wfs_stripe set;
+    struct wfs_sb sb;
+    uint32_t features;
+};
+
+// one file or directory below the path being dumped
+struct entry
+{
+    char *rel; // relative to that path, "" for the path itself
+    struct wfs_inode inode;
+};
+
+struct tree
+{
+    struct entry *entries;
+    int n;
+    int cap;
+};
+
+static struct image img;
+
+static int bad_block(off_t ptr)
+{
+    off_t end = img.sb.d_blocks_ptr + (off_t)img.sb.num_data_blocks * BLOCK_SIZE;
+    return ptr < img.sb.d_blocks_ptr || ptr >= end || (ptr - img.sb.d_blocks_ptr) % BLOCK_SIZE != 0;
+}
+
+static int read_inode(int num, struct wfs_inode *inode)
+{
+    if (num < 0 || (size_t)num >= img.sb.num_inodes)
+    {
+        return -EIO;
+    }
+    if (wfs_stripe_pread(&img.set, inode, sizeof(*inode), img.sb.i_blocks_ptr + (off_t)num * BLOCK_SIZE) != 0)
+    {
+        return -EIO;
+    }
+    return (inode->num == num) ? 0 : -EIO;
+}
+
+// reads n blocks given by ptrs into buf, one pread per run of adjacent
+// blocks. a pointer of 0 is a hole and reads back as zeroes.
+static int read_blocks(const off_t *ptrs, int n, char *buf)
+{
+    int i = 0;
+    while (i < n)
+    {
+        if (ptrs[i] == 0)
+        {
+            memset(buf + (size_t)i * BLOCK_SIZE, 0, BLOCK_SIZE);
+            i++;
+            continue;
+        }
+        if (bad_block(ptrs[i]))
+        {
+            return -EIO;
+        }
+        int run = 1;
+        while (i + run < n && ptrs[i + run] == ptrs[i] + (off_t)run * BLOCK_SIZE && !bad_block(ptrs[i + run]))
+        {
+            run++;
+        }
+        size_t len = (size_t)run * BLOCK_SIZE;
+        if (wfs_stripe_pread(&img.set, buf + (size_t)i * BLOCK_SIZE, len, ptrs[i]) != 0)
+        {
+            return -EIO;
+        }
+        i += run;
+    }
+    return 0;
+}
+
+// every block pointer of a file, the indirect ones included
+static int block_map(const struct wfs_inode *inode, off_t *ptrs)
+{
+    memset(ptrs, 0, MAX_FILE_BLOCKS * sizeof(off_t));
+    memcpy(ptrs, inode->blocks, IND_BLOCK * sizeof(off_t));
+    if (inode->blocks[IND_BLOCK] == 0)
+    {
+        return 0;
+    }
+    if (bad_block(inode->blocks[IND_BLOCK]))
+    {
+        return -EIO;
+    }
+    size_t len = (MAX_FILE_BLOCKS - IND_BLOCK) * sizeof(off_t);
+    return wfs_stripe_pread(&img.set, ptrs + IND_BLOCK, len, inode->blocks[IND_BLOCK]);
+}
+
+// the whole contents of a regular file into buf, which holds
+// MAX_FILE_SIZE bytes
+static int read_file(const struct wfs_inode *inode, char *buf)
+{
+    if (inode->size < 0 || inode->size > MAX_FILE_SIZE)
+    {
+        return -EIO;
+    }
+    off_t ptrs[MAX_FILE_BLOCKS];
+    int err = block_map(inode, ptrs);
+    int nblocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (err != 0 || !(img.features & WFS_FEATURE_COMPRESS))
+    {
+        return err ? err : read_blocks(ptrs, nblocks, buf);
+    }
+
+    // same cluster format libwfs writes, see wfs.h
+    for (int c = 0; c * CLUSTER_BLOCKS < nblocks; c++)
+    {
+        const off_t *slots = ptrs + c * CLUSTER_BLOCKS;
+        int nslots = (MAX_FILE_BLOCKS - c * CLUSTER_BLOCKS < CLUSTER_BLOCKS) ? MAX_FILE_BLOCKS - c * CLUSTER_BLOCKS : CLUSTER_BLOCKS;
+        char *data = buf + (size_t)c * CLUSTER_SIZE;
+        if (slots[0] != COMPRESSED_CLUSTER)
+        {
+            if ((err = read_blocks(slots, nslots, data)) != 0)
+            {
+                return err;
+            }
+            continue;
+        }
+        unsigned char packed[CLUSTER_SIZE];
+        int npacked = 0;
+        while (npacked + 1 < nslots && slots[npacked + 1] != 0)
+        {
+            npacked++;
+        }
+        if ((err = read_blocks(slots + 1, npacked, (char *)packed)) != 0)
+        {
+            return err;
+        }
+        struct wfs_cluster_hdr hdr;
+        memcpy(&hdr, packed, sizeof(hdr));
+        int room = nslots * BLOCK_SIZE;
+        if (hdr.clen + sizeof(hdr) > (size_t)npacked * BLOCK_SIZE || hdr.rawlen > room ||
+            wfs_lz_decompress(packed + sizeof(hdr), hdr.clen, (unsigned char *)data, room) != hdr.rawlen)
+        {
+            return -EIO;
+        }
+        memset(data + hdr.rawlen, 0, room - hdr.rawlen);
+    }
+    return 0;
+}
+
+typedef int (*entry_fn)(void *ctx, const struct wfs_dentry *dentry);
+
+// calls fn for every entry of a directory, stops at the first nonzero
+static int for_each_entry(const struct wfs_inode *dir, entry_fn fn, void *ctx)
+{
+    char blocks[N_BLOCKS * BLOCK_SIZE];
+    int err = read_blocks(dir->blocks, N_BLOCKS, blocks);
+    if (err != 0)
+    {
+        return err;
+    }
+    struct wfs_dentry *entries = (struct wfs_dentry *)blocks;
+    for (int i = 0; i < N_BLOCKS * (int)(BLOCK_SIZE / sizeof(struct wfs_dentry)); i++)
+    {
+        if (dir->blocks[i / (BLOCK_SIZE / sizeof(struct wfs_dentry))] == 0 || entries[i].name[0] == '\0')
+        {
+            continue;
+        }
+        entries[i].name[MAX_NAME - 1] = '\0';
+        if ((err = fn(ctx, &entries[i])) != 0)
+        {
+            return err;
+        }
+    }
+    return 0;
+}
+
+struct find_ctx
+{
+    const char *name;
+    size_t len;
+    int num;
+};
+
+static int match_entry(void *ctx, const struct wfs_dentry *dentry)
+{
+    struct find_ctx *find = ctx;
+    if (strlen(dentry->name) == find->len && strncmp(dentry->name, find->name, find->len) == 0)
+    {
+        find->num = dentry->num;
+        return 1;
+    }
+    return 0;
+}
+
+static int lookup(const char *path, struct wfs_inode *inode)
+{
+    int err = read_inode(0, inode);
+    while (err == 0)
+    {
+        while (*path == '/')
+        {
+            path++;
+        }
+        if (*path == '\0')
+        {
+            return 0;
+        }
+        if (!S_ISDIR(inode->mode))
+        {
+            return -ENOTDIR;
+        }
+        struct find_ctx find = {path, strcspn(path, "/"), -1};
+        if ((err = for_each_entry(inode, match_entry, &find)) < 0)
+        {
+            return err;
+        }
+        if (find.num < 0)
+        {
+            return -ENOENT;
+        }
+        path += find.len;
+        err = read_inode(find.num, inode);
+    }
+    return err;
+}
+
+struct list_ctx
+{
+    struct tree *tree;
+    int parent;
+};
+
+static int add_entry(void *ctx, const struct wfs_dentry *dentry)
+{
+    struct list_ctx *list = ctx;
+    struct tree *tree = list->tree;
+    const char *parent = tree->entries[list->parent].rel;
+    // libwfs hides the snapshots of refcounted images from the root too
+    if (list->parent == 0 && tree->entries[0].inode.num == 0 && (img.features & WFS_FEATURE_REFCOUNT) &&
+        strcmp(dentry->name, SNAPSHOT_DIR) == 0)
+    {
+        return 0;
+    }
+    // a tree cannot hold more entries than there are inodes, unless a
+    // damaged directory points back up
+    if ((size_t)tree->n >= img.sb.num_inodes)
+    {
+        fprintf(stderr, "%s: directory loop\n", parent);
+        return -EIO;
+    }
+    if (tree->n == tree->cap)
+    {
+        int cap = tree->cap ? tree->cap * 2 : 256;
+        struct entry *grown = realloc(tree->entries, cap * sizeof(struct entry));
+        if (grown == NULL)
+        {
+            return -ENOMEM;
+        }
+        tree->entries = grown;
+        tree->cap = cap;
+    }
+    struct entry *e = &tree->entries[tree->n];
+    parent = tree->entries[list->parent].rel; // may have moved
+    if (asprintf(&e->rel, "%s%s%s", parent, parent[0] ? "/" : "", dentry->name) < 0)
+    {
+        return -ENOMEM;
+    }
+    int err = read_inode(dentry->num, &e->inode);
+    if (err != 0)
+    {
+        fprintf(stderr, "%s: bad inode %d\n", e->rel, dentry->num);
+        free(e->rel);
+        return err;
+    }
+    tree->n++;
+    return 0;
+}
+
+// everything below path breadth first, so parents come before children
+static int walk(const char *path, struct tree *tree)
+{
+    memset(tree, 0, sizeof(*tree));
+    tree->cap = 256;
+    tree->entries = malloc(tree->cap * sizeof(struct entry));
+    if (tree->entries == NULL)
+    {
+        return -ENOMEM;
+    }
+    // counted from here so the caller frees it whatever happens next
+    tree->entries[0].rel = strdup("");
+    tree->n = 1;
+    if (tree->entries[0].rel == NULL)
+    {
+        return -ENOMEM;
+    }
+    int err = lookup(path, &tree->entries[0].inode);
+    if (err != 0)
+    {
+        return err;
+    }
+    for (int i = 0; i < tree->n && err == 0; i++)
+    {
+        if (S_ISDIR(tree->entries[i].inode.mode))
+        {
+            struct list_ctx list = {tree, i};
+            err = for_each_entry(&tree->entries[i].inode, add_entry, &list);
+        }
+    }
+    return err;
+}
+
+static int print_entry(void *ctx, const struct wfs_dentry *dentry)
+{
+    struct wfs_inode inode;
+    if (*(int *)ctx && (img.features & WFS_FEATURE_REFCOUNT) && strcmp(dentry->name, SNAPSHOT_DIR) == 0)
+    {
+        return 0;
+    }
+    if (read_inode(dentry->num, &inode) != 0)
+    {
+        printf("?????? %6d %8s %s\n", dentry->num, "?", dentry->name);
+        return 0;
+    }
+    printf("%06o %6d %8ld %s%s\n", inode.mode, inode.num, (long)inode.size, dentry->name, S_ISDIR(inode.mode) ? "/" : "");
+    return 0;
+}
+
+static int cmd_ls(const char *path)
+{
+    struct wfs_inode inode;
+    int err = lookup(path, &inode);
+    if (err != 0 || !S_ISDIR(inode.mode))
+    {
+        return err ? err : -ENOTDIR;
+    }
+    int is_root = (inode.num == 0);
+    return for_each_entry(&inode, print_entry, &is_root);
+}
+
+static int cmd_stat(const char *path)
+{
+    struct wfs_inode inode;
+    int err = lookup(path, &inode);
+    if (err != 0)
+    {
+        return err;
+    }
+    printf("inode=%d\nmode=%06o\nuid=%d\ngid=%d\nsize=%ld\nnlinks=%d\natime=%ld\nmtime=%ld\nctime=%ld\n", inode.num, inode.mode,
+           inode.uid, inode.gid, (long)inode.size, inode.nlinks, (long)inode.atim, (long)inode.mtim, (long)inode.ctim);
+    for (int i = 0; i < N_BLOCKS; i++)
+    {
+        printf("block%d=%ld\n", i, (long)inode.blocks[i]);
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -errno;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int cmd_cat(const char *path)
+{
+    struct wfs_inode inode;
+    static char buf[MAX_FILE_SIZE];
+    int err = lookup(path, &inode);
+    if (err == 0 && S_ISDIR(inode.mode))
+    {
+        err = -EISDIR;
+    }
+    if (err == 0)
+    {
+        err = read_file(&inode, buf);
+    }
+    return err ? err : write_all(STDOUT_FILENO, buf, inode.size);
+}
+
+// ustar header for one entry, 0 if its name does not fit
+static int tar_header(const struct entry *e, char *hdr)
+{
+    int dir = S_ISDIR(e->inode.mode);
+    char name[PATH_MAX];
+    size_t len = snprintf(name, sizeof(name), "%s%s", e->rel, dir ? "/" : "");
+    memset(hdr, 0, BLOCK_SIZE);
+    if (len <= 100)
+    {
+        memcpy(hdr, name, len);
+    }
+    else
+    {
+        // split at a slash into the 155 byte prefix and the 100 byte name
+        char *split = name;
+        while ((split = strchr(split + 1, '/')) != NULL && (size_t)(split - name) <= 155 && len - (split - name) - 1 > 100)
+        {
+        }
+        if (split == NULL || (size_t)(split - name) > 155 || split + 1 == name + len)
+        {
+            return 0;
+        }
+        memcpy(hdr + 345, name, split - name);
+        memcpy(hdr, split + 1, len - (split - name) - 1);
+    }
+    snprintf(hdr + 100, 8, "%07o", e->inode.mode & 07777);
+    snprintf(hdr + 108, 8, "%07o", e->inode.uid);
+    snprintf(hdr + 116, 8, "%07o", e->inode.gid);
+    snprintf(hdr + 124, 12, "%011lo", dir ? 0ul : (unsigned long)e->inode.size);
+    snprintf(hdr + 136, 12, "%011lo", (unsigned long)e->inode.mtim);
+    hdr[156] = dir ? '5' : '0';
+    memcpy(hdr + 257, "ustar", 6);
+    memcpy(hdr + 263, "00", 2);
+    memset(hdr + 148, ' ', 8);
+    unsigned sum = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+        sum += (unsigned char)hdr[i];
+    }
+    snprintf(hdr + 148, 8, "%06o", sum);
+    hdr[155] = ' ';
+    return 1;
+}
+
+static int cmd_tar(const char *path)
+{
+    struct tree tree;
+    int err = walk(path, &tree);
+    static char buf[MAX_FILE_SIZE + BLOCK_SIZE];
+    char hdr[BLOCK_SIZE];
+    for (int i = 0; i < tree.n && err == 0; i++)
+    {
+        struct entry *e = &tree.entries[i];
+        if (e->rel[0] == '\0' && S_ISDIR(e->inode.mode))
+        {
+            continue;
+        }
+        if (e->rel[0] == '\0')
+        {
+            // a single file goes in under its own name
+            free(e->rel);
+            const char *slash = strrchr(path, '/');
+            e->rel = strdup(slash ? slash + 1 : path);
+        }
+        if (!tar_header(e, hdr))
+        {
+            fprintf(stderr, "%s: name too long for tar, skipped\n", e->rel);
+            continue;
+        }
+        if ((err = write_all(STDOUT_FILENO, hdr, BLOCK_SIZE)) != 0 || S_ISDIR(e->inode.mode))
+        {
+            continue;
+        }
+        if ((err = read_file(&e->inode, buf)) != 0)
+        {
+            fprintf(stderr, "%s: cannot read\n", e->rel);
+            break;
+        }
+        size_t padded = (e->inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        memset(buf + e->inode.size, 0, padded - e->inode.size);
+        err = write_all(STDOUT_FILENO, buf, padded);
+    }
+    // two empty blocks end the archive
+    memset(hdr, 0, BLOCK_SIZE);
+    if (err == 0 && (err = write_all(STDOUT_FILENO, hdr, BLOCK_SIZE)) == 0)
+    {
+        err = write_all(STDOUT_FILENO, hdr, BLOCK_SIZE);
+    }
+    for (int i = 0; i < tree.n; i++)
+    {
+        free(tree.entries[i].rel);
+    }
+    free(tree.entries);
+    return err;
+}
+
+struct extract
+{
+    struct tree *tree;
+    const char *dest;
+    const char *single; // name of a lone file, NULL for a directory
+    int next;
+    int failed;
+};
+
+static void host_path(struct extract *x, const struct entry *e, char *out, size_t cap)
+{
+    const char *rel = x->single ? x->single : e->rel;
+    snprintf(out, cap, "%s%s%s", x->dest, rel[0] ? "/" : "", rel);
+}
+
+static int extract_file(struct extract *x, const struct entry *e, char *buf)
+{
+    char dst[PATH_MAX];
+    host_path(x, e, dst, sizeof(dst));
+    if (read_file(&e->inode, buf) != 0)
+    {
+        fprintf(stderr, "%s: cannot read from the image\n", e->rel[0] ? e->rel : x->single);
+        return -1;
+    }
+    int fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, e->inode.mode & 07777);
+    if (fd < 0 || write_all(fd, buf, e->inode.size) != 0)
+    {
+        perror(dst);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    struct timespec times[2] = {{e->inode.atim, 0}, {e->inode.mtim, 0}};
+    futimens(fd, times);
+    close(fd);
+    return 0;
+}
+
+static void *extract_worker(void *arg)
+{
+    struct extract *x = arg;
+    char *buf = malloc(MAX_FILE_SIZE);
+    int i;
+    while (buf != NULL && !__atomic_load_n(&x->failed, __ATOMIC_RELAXED) &&
+           (i = __atomic_fetch_add(&x->next, 1, __ATOMIC_RELAXED)) < x->tree->n)
+    {
+        const struct entry *e = &x->tree->entries[i];
+        if (!S_ISDIR(e->inode.mode) && extract_file(x, e, buf) != 0)
+        {
+            __atomic_store_n(&x->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (buf == NULL)
+    {
+        __atomic_store_n(&x->failed, 1, __ATOMIC_RELAXED);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int cmd_extract(const char *path, const char *dest, int threads)
+{
+    struct tree tree;
+    int err = walk(path, &tree);
+    struct extract x = {&tree, dest, NULL, 0, 0};
+    if (err == 0 && !S_ISDIR(tree.entries[0].inode.mode))
+    {
+        const char *slash = strrchr(path, '/');
+        x.single = slash ? slash + 1 : path;
+    }
+    // directories first, the walk has every parent before its children
+    for (int i = 0; i < tree.n && err == 0; i++)
+    {
+        char dir[PATH_MAX];
+        host_path(&x, &tree.entries[i], dir, sizeof(dir));
+        if (S_ISDIR(tree.entries[i].inode.mode) && mkdir(dir, 0700) != 0 && errno != EEXIST)
+        {
+            perror(dir);
+            err = -errno;
+        }
+    }
+    if (err == 0)
+    {
+        pthread_t tids[threads];
+        int started = 0;
+        while (started < threads && pthread_create(&tids[started], NULL, extract_worker, &x) == 0)
+        {
+            started++;
+        }
+        if (started == 0)
+        {
+            extract_worker(&x);
+        }
+        for (int t = 0; t < started; t++)
+        {
+            pthread_join(tids[t], NULL);
+        }
+        err = x.failed ? -EIO : 0;
+    }
+    // directory modes and times last, deepest first, so filling them in
+    // neither fails on a read only mode nor moves their times
+    for (int i = tree.n - 1; i >= 0 && err == 0; i--)
+    {
+        const struct entry *e = &tree.entries[i];
+        char dir[PATH_MAX];
+        host_path(&x, e, dir, sizeof(dir));
+        struct timespec times[2] = {{e->inode.atim, 0}, {e->inode.mtim, 0}};
+        if (S_ISDIR(e->inode.mode) && (chmod(dir, e->inode.mode & 07777) != 0 || utimensat(AT_FDCWD, dir, times, 0) != 0))
+        {
+            perror(dir);
+        }
+    }
+    for (int i = 0; i < tree.n; i++)
+    {
+        free(tree.entries[i].rel);
+    }
+    free(tree.entries);
+    if (err == 0)
+    {
+        fprintf(stderr, "extracted %d files and directories into %s\n", tree.n, dest);
+    }
+    return err;
+}
+
+static int open_image(const char *path)
+{
+    // checks the labels of a striped set, a member on its own is refused
+    if (wfs_stripe_open(path, O_RDONLY, &img.set) != 0)
+    {
+        return -errno;
+    }
+    if (wfs_stripe_pread(&img.set, &img.sb, sizeof(img.sb), 0) != 0)
+    {
+        return -EINVAL;
+    }
+    // same checks libwfs makes before it trusts the extension
+    struct wfs_sb_ext ext;
+    if ((size_t)img.sb.i_bitmap_ptr >= sizeof(struct wfs_sb) + sizeof(struct wfs_sb_ext) &&
+        wfs_stripe_pread(&img.set, &ext, sizeof(ext), sizeof(struct wfs_sb)) == 0 && ext.magic == WFS_EXT_MAGIC)
+    {
+        img.features = ext.features;
+    }
+    if (img.sb.num_inodes == 0 || img.sb.i_blocks_ptr <= img.sb.i_bitmap_ptr || img.sb.d_blocks_ptr <= img.sb.i_blocks_ptr)
+    {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "USAGE: %s image ls|stat|cat|tar|extract [path] [host_dir] [-j threads]\n", argv[0]);
+        return 1;
+    }
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 3; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            threads = atoi(argv[i + 1]);
+            argc = i;
+        }
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    int err = open_image(argv[1]);
+    if (err != 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], (err == -EINVAL) ? "not a wfs image" : strerror(-err));
+        return 1;
+    }
+
+    const char *cmd = argv[2];
+    const char *path = (argc > 3) ? argv[3] : "/";
+    if (strcmp(cmd, "ls") == 0)
+    {
+        err = cmd_ls(path);
+    }
+    else if (strcmp(cmd, "stat") == 0 && argc > 3)
+    {
+        err = cmd_stat(path);
+    }
+    else if (strcmp(cmd, "cat") == 0 && argc > 3)
+    {
+        err = cmd_cat(path);
+    }
+    else if (strcmp(cmd, "tar") == 0)
+    {
+        err = cmd_tar(path);
+    }
+    else if (strcmp(cmd, "extract") == 0 && argc > 4)
+    {
+        err = cmd_extract(path, argv[4], threads);
+    }
+    else
+    {
+        fprintf(stderr, "%s: unknown command or missing path\n", cmd);
+        err = -EINVAL;
+    }
+    if (err != 0 && err != -EINVAL)
+    {
+        fprintf(stderr, "%s %s: %s\n", cmd, path, strerror(-err));
+    }
+    wfs_stripe_close(&img.set);
+    return err ? 1 : 0;
+}
@@ -0,0 +1,1216 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#undef BLOCK_SIZE // linux/fs.h has its own, wfs blocks are 512 bytes
+#include "wfs.h"
+#include "wfs_io.h"
+#include "wfs_uring.h"
+
+#define WFS_IO_DIRECT_ALIGN (4096)
+#define WFS_IO_MIN_CACHE_BLOCKS (16)
+#define WFS_IO_URING_ENTRIES (128)
+// mem_budget tracks the data area of a mapping in regions this big
+#define REGION_SHIFT (16)
+#define REGION_SIZE ((off_t)1 << REGION_SHIFT)
+#define REGION_RESIDENT (1)
+#define REGION_REF (2)
+
+// what a frame is waiting on in the io_uring backend
+#define FRAME_IDLE (0)
+#define FRAME_READING (1)
+#define FRAME_WRITING (2)
+
+// one cached block of the image
+struct wfs_frame
+{
+    off_t off;           // image offset of the block, -1 if unused
+    int pins;            // outstanding pins, pinned frames are never evicted
+    int next;            // next frame in the same hash bucket, -1 ends the chain
+    unsigned char ref;   // CLOCK reference bit
+    unsigned char dirty; // block differs from the image
+    unsigned char busy;  // FRAME_READING or FRAME_WRITING while io_uring owns it
+    unsigned char error; // the last read into the frame failed
+};
+
+struct wfs_io
+{
+    struct wfs_stripe set;
+    enum wfs_io_backend backend;
+    int direct;
+    int discard;
+    off_t size;
+
+    // superblock and bitmaps, resident for the whole mount
+    char *header;
+    off_t header_len;
+    int header_dirty;
+
+    // mmap backend, a mapping of each member
+    char *maps[WFS_IO_MAX_DISKS];
+    size_t map_lens[WFS_IO_MAX_DISKS];
+    // mem_budget: a REGION_* byte per region from data_start on
+    off_t data_start;
+    unsigned char *regions;
+    size_t nregions;
+    size_t max_resident; // regions
+    size_t resident;
+    size_t region_hand;
+
+    // pread backend buffer cache
+    struct wfs_frame *frames;
+    char *frame_data;
+    size_t nframes;
+    int *buckets;
+    size_t nbuckets;
+    size_t hand;
+
+    // io_uring backend, misses and writebacks go through the ring
+    struct wfs_uring *ring;
+    unsigned long write_errors;
+
+    struct wfs_io_stats stats;
+};
+
+// pread or pwrite of all len bytes, retrying short transfers
+static int fd_transfer(int fd, void *buf, size_t len, off_t off, int write)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write ? pwrite(fd, (const char *)buf + done, len - done, off + done)
+                          : pread(fd, (char *)buf + done, len - done, off + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -EIO;
+        done += n;
+    }
+    return 0;
+}
+
+// the member and member offset of off, and how many bytes up to end
+// stay in that member
+static off_t segment(const struct wfs_stripe *set, off_t off, off_t end, int *disk, off_t *phys)
+{
+    off_t n = wfs_stripe_locate(set, off, disk, phys);
+    return (n < end - off) ? n : end - off;
+}
+
+static int stripe_transfer(const struct wfs_stripe *set, void *buf, size_t len, off_t off, int write)
+{
+    if (off < 0 || off + (off_t)len > set->size)
+        return -EIO;
+    for (off_t pos = off, end = off + len; pos < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t n = segment(set, pos, end, &disk, &phys);
+        if (fd_transfer(set->fds[disk], (char *)buf + (pos - off), n, phys, write) != 0)
+            return -EIO;
+        pos += n;
+    }
+    return 0;
+}
+
+int wfs_stripe_pread(const struct wfs_stripe *set, void *buf, size_t len, off_t off)
+{
+    return stripe_transfer(set, buf, len, off, 0);
+}
+
+int wfs_stripe_pwrite(const struct wfs_stripe *set, const void *buf, size_t len, off_t off)
+{
+    return stripe_transfer(set, (void *)buf, len, off, 1);
+}
+
+// O_DIRECT pread from one member, through a bounce buffer covering the
+// aligned window around the range
+static int direct_pread(struct wfs_io *io, int disk, void *buf, size_t len, off_t off)
+{
+    size_t align = io->set.geo[disk].align;
+    off_t start = off - (off % align);
+    off_t end = off + len;
+    if (end % align != 0)
+        end += align - (end % align);
+
+    void *bounce;
+    if (posix_memalign(&bounce, align, end - start) != 0)
+        return -ENOMEM;
+    ssize_t n = pread(io->set.fds[disk], bounce, end - start, start);
+    if (n < (off - start) + (ssize_t)len)
+    {
+        free(bounce);
+        return -EIO;
+    }
+    memcpy(buf, (char *)bounce + (off - start), len);
+    free(bounce);
+    return 0;
+}
+
+// pwrite counterpart of direct_pread, read-modify-writes the window
+static int direct_pwrite(struct wfs_io *io, int disk, const void *buf, size_t len, off_t off)
+{
+    size_t align = io->set.geo[disk].align;
+    int fd = io->set.fds[disk];
+    off_t start = off - (off % align);
+    off_t end = off + len;
+    if (end % align != 0)
+        end += align - (end % align);
+
+    void *bounce;
+    if (posix_memalign(&bounce, align, end - start) != 0)
+        return -ENOMEM;
+    if (start != off || end != off + (off_t)len)
+    {
+        // the member may end inside the window, the tail past it stays zero
+        memset(bounce, 0, end - start);
+        if (pread(fd, bounce, end - start, start) < 0)
+        {
+            free(bounce);
+            return -EIO;
+        }
+    }
+    memcpy((char *)bounce + (off - start), buf, len);
+    ssize_t n = pwrite(fd, bounce, end - start, start);
+    free(bounce);
+    return (n == end - start) ? 0 : -EIO;
+}
+
+// pread of an image range that handles short reads, the members it spans
+// and the alignment O_DIRECT needs
+static int io_pread(struct wfs_io *io, void *buf, size_t len, off_t off)
+{
+    if (!io->direct)
+        return wfs_stripe_pread(&io->set, buf, len, off);
+    if (off < 0 || off + (off_t)len > io->size)
+        return -EIO;
+    for (off_t pos = off, end = off + len; pos < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t n = segment(&io->set, pos, end, &disk, &phys);
+        int err = direct_pread(io, disk, (char *)buf + (pos - off), n, phys);
+        if (err != 0)
+            return err;
+        pos += n;
+    }
+    return 0;
+}
+
+// pwrite counterpart of io_pread
+static int io_pwrite(struct wfs_io *io, const void *buf, size_t len, off_t off)
+{
+    if (!io->direct)
+        return wfs_stripe_pwrite(&io->set, buf, len, off);
+    if (off < 0 || off + (off_t)len > io->size)
+        return -EIO;
+    for (off_t pos = off, end = off + len; pos < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t n = segment(&io->set, pos, end, &disk, &phys);
+        int err = direct_pwrite(io, disk, (const char *)buf + (pos - off), n, phys);
+        if (err != 0)
+            return err;
+        pos += n;
+    }
+    return 0;
+}
+
+// where off is in the member mappings
+static char *map_ptr(struct wfs_io *io, off_t off)
+{
+    int disk;
+    off_t phys;
+    wfs_stripe_locate(&io->set, off, &disk, &phys);
+    return io->maps[disk] + phys;
+}
+
+static size_t frame_hash(struct wfs_io *io, off_t off)
+{
+    return ((size_t)(off - io->header_len) / BLOCK_SIZE) & (io->nbuckets - 1);
+}
+
+static char *frame_ptr(struct wfs_io *io, int idx)
+{
+    return io->frame_data + (size_t)idx * BLOCK_SIZE;
+}
+
+static void frame_unhash(struct wfs_io *io, int idx)
+{
+    int *link = &io->buckets[frame_hash(io, io->frames[idx].off)];
+    while (*link != idx)
+    {
+        link = &io->frames[*link].next;
+    }
+    *link = io->frames[idx].next;
+}
+
+static int frame_writeback(struct wfs_io *io, int idx)
+{
+    struct wfs_frame *frame = &io->frames[idx];
+    if (!frame->dirty)
+        return 0;
+    int err = io_pwrite(io, frame_ptr(io, idx), BLOCK_SIZE, frame->off);
+    if (err != 0)
+        return err;
+    frame->dirty = 0;
+    io->stats.writebacks++;
+    return 0;
+}
+
+// completion handler for the ring, tags are the frame index and a write bit
+static void frame_done(void *arg, unsigned long long tag, int res)
+{
+    struct wfs_io *io = arg;
+    struct wfs_frame *frame = &io->frames[tag >> 1];
+    int write = tag & 1;
+    if (res != BLOCK_SIZE)
+    {
+        if (write)
+        {
+            frame->dirty = 1; // try again on the next writeback
+            io->write_errors++;
+        }
+        else
+            frame->error = 1;
+    }
+    frame->busy = FRAME_IDLE;
+}
+
+// submits what is queued and waits for at least one request to finish
+static int ring_wait(struct wfs_io *io)
+{
+    if (wfs_uring_pending(io->ring) == 0)
+        return -1;
+    if (wfs_uring_submit(io->ring, 1) != 0)
+        return -1;
+    wfs_uring_reap(io->ring, frame_done, io);
+    return 0;
+}
+
+// queues a read or write of a frame, making room in the ring if it is full.
+// a block never spans members, each request goes to the one holding it.
+static int ring_queue(struct wfs_io *io, int idx, int write)
+{
+    int disk;
+    off_t phys;
+    wfs_stripe_locate(&io->set, io->frames[idx].off, &disk, &phys);
+    while (wfs_uring_queue(io->ring, write, io->set.fds[disk], frame_ptr(io, idx), BLOCK_SIZE, phys, ((unsigned long long)idx << 1) | write) != 0)
+    {
+        if (ring_wait(io) != 0)
+            return -1;
+    }
+    io->frames[idx].busy = write ? FRAME_WRITING : FRAME_READING;
+    return 0;
+}
+
+// starts writing a dirty frame back without waiting for it, the frame
+// cannot be reused until the write completes. a frame already being
+// written stays dirty and is picked up by the next writeback.
+static int frame_start_writeback(struct wfs_io *io, int idx)
+{
+    struct wfs_frame *frame = &io->frames[idx];
+    if (!frame->dirty || frame->busy != FRAME_IDLE)
+        return 0;
+    if (ring_queue(io, idx, 1) != 0)
+        return -1;
+    frame->dirty = 0;
+    io->stats.writebacks++;
+    return 0;
+}
+
+// CLOCK sweep for a frame to reuse, skipping pinned frames and
+// giving recently referenced ones a second chance. with io_uring dirty
+// frames are queued for writeback as the hand passes and the sweep only
+// blocks when nothing clean is left.
+static int frame_victim(struct wfs_io *io)
+{
+    for (;;)
+    {
+        for (size_t scanned = 0; scanned < 2 * io->nframes; scanned++)
+        {
+            int idx = io->hand;
+            io->hand = (io->hand + 1) % io->nframes;
+            struct wfs_frame *frame = &io->frames[idx];
+
+            if (frame->pins > 0 || frame->busy != FRAME_IDLE)
+                continue;
+            if (frame->ref)
+            {
+                frame->ref = 0;
+                continue;
+            }
+            if (frame->off != -1)
+            {
+                if (io->ring != NULL && frame->dirty)
+                {
+                    frame_start_writeback(io, idx);
+                    continue;
+                }
+                if (frame_writeback(io, idx) != 0)
+                    continue;
+                frame_unhash(io, idx);
+                io->stats.evictions++;
+            }
+            return idx;
+        }
+        if (io->ring == NULL)
+            return -1;
+        // kick the queued writebacks and wait for one of them to free a frame
+        if (ring_wait(io) != 0)
+            return -1;
+    }
+}
+
+static int frame_lookup(struct wfs_io *io, off_t off)
+{
+    for (int idx = io->buckets[frame_hash(io, off)]; idx != -1; idx = io->frames[idx].next)
+    {
+        if (io->frames[idx].off == off)
+            return idx;
+    }
+    return -1;
+}
+
+static void frame_install(struct wfs_io *io, int idx, off_t off)
+{
+    struct wfs_frame *frame = &io->frames[idx];
+    frame->off = off;
+    frame->pins = 0;
+    frame->ref = 1;
+    frame->dirty = 0;
+    frame->error = 0;
+    size_t bucket = frame_hash(io, off);
+    frame->next = io->buckets[bucket];
+    io->buckets[bucket] = idx;
+}
+
+// waits for a read queued on the ring to land in the frame
+static int frame_wait_read(struct wfs_io *io, int idx)
+{
+    while (io->frames[idx].busy == FRAME_READING)
+    {
+        if (ring_wait(io) != 0)
+            return -1;
+    }
+    if (io->frames[idx].error)
+    {
+        frame_unhash(io, idx);
+        io->frames[idx].off = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// finds or loads the frame for the block at off and pins it.
+// fill is 0 when the caller is about to overwrite the whole block.
+static int frame_get(struct wfs_io *io, off_t off, int fill)
+{
+    int idx = frame_lookup(io, off);
+    if (idx != -1)
+    {
+        if (frame_wait_read(io, idx) != 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        io->frames[idx].pins++;
+        io->frames[idx].ref = 1;
+        io->stats.hits++;
+        return idx;
+    }
+
+    io->stats.misses++;
+    idx = frame_victim(io);
+    if (idx == -1)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    struct wfs_frame *frame = &io->frames[idx];
+    if (fill && io->ring != NULL)
+    {
+        frame_install(io, idx, off);
+        if (ring_queue(io, idx, 0) != 0 || frame_wait_read(io, idx) != 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        frame->pins = 1;
+        return idx;
+    }
+
+    frame->off = -1;
+    if (fill && io_pread(io, frame_ptr(io, idx), BLOCK_SIZE, off) != 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+    frame_install(io, idx, off);
+    frame->pins = 1;
+    return idx;
+}
+
+static int cache_init(struct wfs_io *io, size_t nframes)
+{
+    if (nframes < WFS_IO_MIN_CACHE_BLOCKS)
+        nframes = WFS_IO_MIN_CACHE_BLOCKS;
+    io->nframes = nframes;
+    io->nbuckets = 1;
+    while (io->nbuckets < nframes)
+        io->nbuckets <<= 1;
+
+    io->frames = malloc(nframes * sizeof(struct wfs_frame));
+    io->buckets = malloc(io->nbuckets * sizeof(int));
+    if (io->frames == NULL || io->buckets == NULL)
+        return -1;
+    if (posix_memalign((void **)&io->frame_data, WFS_IO_DIRECT_ALIGN, nframes * BLOCK_SIZE) != 0)
+        return -1;
+
+    for (size_t i = 0; i < nframes; i++)
+    {
+        io->frames[i].off = -1;
+        io->frames[i].pins = 0;
+        io->frames[i].next = -1;
+        io->frames[i].ref = 0;
+        io->frames[i].dirty = 0;
+        io->frames[i].busy = FRAME_IDLE;
+        io->frames[i].error = 0;
+    }
+    for (size_t i = 0; i < io->nbuckets; i++)
+    {
+        io->buckets[i] = -1;
+    }
+    return 0;
+}
+
+static void io_free(struct wfs_io *io)
+{
+    wfs_uring_free(io->ring);
+    if (io->backend == WFS_IO_MMAP)
+    {
+        for (int i = 0; i < io->set.ndisks; i++)
+        {
+            if (io->maps[i] != NULL)
+                munmap(io->maps[i], io->map_lens[i]);
+        }
+    }
+    else
+        free(io->header);
+    free(io->regions);
+    free(io->frames);
+    free(io->frame_data);
+    free(io->buckets);
+    wfs_stripe_close(&io->set);
+    free(io);
+}
+
+int wfs_io_probe(int fd, struct wfs_io_geometry *geo)
+{
+    struct stat stat;
+    if (fstat(fd, &stat) != 0)
+        return -1;
+    geo->size = stat.st_size;
+    geo->align = WFS_IO_DIRECT_ALIGN;
+    geo->is_device = S_ISBLK(stat.st_mode);
+    if (!geo->is_device)
+        return 0;
+
+    // st_size is 0 for block devices, the driver knows the real size
+    uint64_t bytes;
+    int sector;
+    if (ioctl(fd, BLKGETSIZE64, &bytes) != 0)
+        return -1;
+    geo->size = bytes;
+    if (ioctl(fd, BLKSSZGET, &sector) == 0 && sector >= 512)
+        geo->align = sector;
+    return 0;
+}
+
+int wfs_io_discard_range(int fd, const struct wfs_io_geometry *geo, off_t off, off_t len)
+{
+    if (!geo->is_device)
+    {
+        // holes read back as zeroes, which is all a freed block needs
+        return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) == 0 ? 0 : -errno;
+    }
+
+    // a device can only drop whole sectors, shrink the range to them
+    off_t start = off;
+    if (start % geo->align != 0)
+        start += geo->align - (start % geo->align);
+    off_t end = off + len;
+    end -= end % geo->align;
+    if (end <= start)
+        return 0;
+    uint64_t range[2] = {start, end - start};
+    return ioctl(fd, BLKDISCARD, &range) == 0 ? 0 : -errno;
+}
+
+off_t wfs_stripe_locate(const struct wfs_stripe *set, off_t off, int *disk, off_t *phys)
+{
+    if (set->ndisks == 1)
+    {
+        *disk = 0;
+        *phys = off;
+        return set->size - off;
+    }
+    if (off < set->header_len)
+    {
+        *disk = 0;
+        *phys = WFS_STRIPE_LABEL_SIZE + off;
+        return set->header_len - off;
+    }
+    off_t grid = off - set->header_len;
+    off_t stripe = grid / set->unit;
+    *disk = stripe % set->ndisks;
+    *phys = set->grid_base + (stripe / set->ndisks) * set->unit + grid % set->unit;
+    return set->unit - grid % set->unit;
+}
+
+void wfs_stripe_close(struct wfs_stripe *set)
+{
+    for (int i = 0; i < set->ndisks; i++)
+    {
+        close(set->fds[i]);
+    }
+    set->ndisks = 0;
+}
+
+// reads the label at the start of a member, into a zeroed label when the
+// member is too short to have one. the buffer is aligned for O_DIRECT.
+static int read_label(int fd, struct wfs_stripe_label *label)
+{
+    void *buf;
+    if (posix_memalign(&buf, WFS_IO_DIRECT_ALIGN, WFS_STRIPE_LABEL_SIZE) != 0)
+        return -1;
+    memset(buf, 0, WFS_STRIPE_LABEL_SIZE);
+    ssize_t n = pread(fd, buf, WFS_STRIPE_LABEL_SIZE, 0);
+    memcpy(label, buf, sizeof(*label));
+    free(buf);
+    return n < 0 ? -1 : 0;
+}
+
+// checks that the labels describe one whole set and puts every member
+// in its place
+static int stripe_assemble(struct wfs_stripe *set, const int *fds, const struct wfs_io_geometry *geo,
+                           const struct wfs_stripe_label *labels, int n)
+{
+    const struct wfs_stripe_label *first = &labels[0];
+    off_t header_len = first->sb.i_blocks_ptr;
+    if (first->stripe_unit == 0 || first->stripe_unit % BLOCK_SIZE != 0 ||
+        (off_t)(WFS_STRIPE_LABEL_SIZE + header_len) > (off_t)first->grid_base)
+        return -1;
+    int seen = 0;
+    for (int i = 0; i < n; i++)
+    {
+        const struct wfs_stripe_label *label = &labels[i];
+        if (label->magic != WFS_STRIPE_MAGIC || label->disks != (uint32_t)n || label->set_id != first->set_id ||
+            label->index >= (uint32_t)n || (seen & (1 << label->index)) || label->stripe_unit != first->stripe_unit ||
+            label->grid_base != first->grid_base || label->grid_bytes != first->grid_bytes ||
+            geo[i].size < (off_t)(label->grid_base + label->grid_bytes))
+            return -1;
+        seen |= 1 << label->index;
+        set->fds[label->index] = fds[i];
+        set->geo[label->index] = geo[i];
+    }
+    set->ndisks = n;
+    set->unit = first->stripe_unit;
+    set->header_len = header_len;
+    set->grid_base = first->grid_base;
+    set->size = header_len + (off_t)n * first->grid_bytes;
+    return 0;
+}
+
+int wfs_stripe_open(const char *path, int flags, struct wfs_stripe *set)
+{
+    memset(set, 0, sizeof(*set));
+    char *names = strdup(path);
+    if (names == NULL)
+        return -1;
+
+    int fds[WFS_IO_MAX_DISKS];
+    struct wfs_io_geometry geo[WFS_IO_MAX_DISKS];
+    struct wfs_stripe_label labels[WFS_IO_MAX_DISKS];
+    int n = 0, err = 0;
+    char *save;
+    for (char *name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+    {
+        if (n == WFS_IO_MAX_DISKS)
+        {
+            err = EINVAL;
+            break;
+        }
+        fds[n] = open(name, flags);
+        if (fds[n] < 0)
+        {
+            err = errno;
+            break;
+        }
+        n++;
+        if (wfs_io_probe(fds[n - 1], &geo[n - 1]) != 0 || read_label(fds[n - 1], &labels[n - 1]) != 0)
+        {
+            err = errno;
+            break;
+        }
+    }
+    free(names);
+
+    if (err == 0 && n == 1 && labels[0].magic != WFS_STRIPE_MAGIC)
+    {
+        // a plain image
+        set->ndisks = 1;
+        set->fds[0] = fds[0];
+        set->geo[0] = geo[0];
+        set->size = geo[0].size;
+        return 0;
+    }
+    // a member on its own would look like an image missing its header
+    if (err == 0 && (n == 0 || stripe_assemble(set, fds, geo, labels, n) != 0))
+        err = EINVAL;
+    if (err != 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            close(fds[i]);
+        }
+        memset(set, 0, sizeof(*set));
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+struct wfs_io *wfs_io_open(const char *path, const struct wfs_io_opts *opts)
+{
+    struct wfs_io *io = calloc(1, sizeof(struct wfs_io));
+    if (io == NULL)
+        return NULL;
+    io->backend = opts->backend;
+    // io_uring requests go straight at frame offsets, which are not
+    // sector aligned, so only the pread backend can use O_DIRECT
+    io->direct = (opts->backend == WFS_IO_PREAD) && opts->direct;
+
+    int flags = O_RDWR;
+    if (io->direct)
+        flags |= O_DIRECT;
+    if (wfs_stripe_open(path, flags, &io->set) != 0)
+    {
+        free(io);
+        return NULL;
+    }
+    io->size = io->set.size;
+    io->discard = opts->discard;
+
+    struct wfs_sb sb;
+    if ((size_t)io->size < sizeof(sb) || io_pread(io, &sb, sizeof(sb), 0) != 0)
+    {
+        io_free(io);
+        errno = EINVAL;
+        return NULL;
+    }
+    io->header_len = sb.i_blocks_ptr;
+    if (io->header_len < (off_t)sizeof(sb) || io->header_len > io->size ||
+        (io->set.ndisks > 1 && io->header_len != io->set.header_len))
+    {
+        io_free(io);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (io->backend == WFS_IO_MMAP)
+    {
+        for (int i = 0; i < io->set.ndisks; i++)
+        {
+            io->map_lens[i] = (io->set.ndisks == 1) ? io->size
+                                                    : io->set.grid_base + (io->size - io->header_len) / io->set.ndisks;
+            io->maps[i] = mmap(NULL, io->map_lens[i], PROT_WRITE | PROT_READ, MAP_SHARED, io->set.fds[i], 0);
+            if (io->maps[i] == MAP_FAILED)
+            {
+                io->maps[i] = NULL;
+                io_free(io);
+                return NULL;
+            }
+        }
+        io->header = map_ptr(io, 0);
+        if (opts->mem_budget > 0 && sb.d_blocks_ptr >= io->header_len && sb.d_blocks_ptr < io->size)
+        {
+            io->data_start = sb.d_blocks_ptr;
+            io->nregions = ((io->size - io->data_start) + REGION_SIZE - 1) >> REGION_SHIFT;
+            io->regions = calloc(io->nregions, 1);
+            if (io->regions == NULL)
+            {
+                io_free(io);
+                errno = ENOMEM;
+                return NULL;
+            }
+            io->max_resident = opts->mem_budget >> REGION_SHIFT;
+            if (io->max_resident == 0)
+                io->max_resident = 1;
+        }
+        return io;
+    }
+
+    io->header = malloc(io->header_len);
+    if (io->header == NULL || io_pread(io, io->header, io->header_len, 0) != 0)
+    {
+        io_free(io);
+        errno = EIO;
+        return NULL;
+    }
+    size_t cache_blocks = opts->cache_blocks ? opts->cache_blocks : WFS_IO_DEFAULT_CACHE_BLOCKS;
+    if (cache_init(io, cache_blocks) != 0)
+    {
+        io_free(io);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (io->backend == WFS_IO_URING)
+    {
+        io->ring = wfs_uring_init(WFS_IO_URING_ENTRIES);
+        if (io->ring == NULL)
+        {
+            io_free(io);
+            errno = ENOSYS;
+            return NULL;
+        }
+    }
+    return io;
+}
+
+int wfs_io_sync(struct wfs_io *io)
+{
+    int err = 0;
+    if (io->backend == WFS_IO_MMAP)
+    {
+        for (int i = 0; i < io->set.ndisks; i++)
+        {
+            if (msync(io->maps[i], io->map_lens[i], MS_SYNC) != 0)
+                err = -EIO;
+        }
+        return err;
+    }
+
+    if (io->header_dirty)
+    {
+        err = io_pwrite(io, io->header, io->header_len, 0);
+        if (err == 0)
+            io->header_dirty = 0;
+    }
+    if (io->ring != NULL)
+    {
+        // queue every dirty frame, then keep going until none are left
+        // in flight or dirtied again by a failed write
+        int dirty;
+        unsigned long write_errors = io->write_errors;
+        do
+        {
+            dirty = 0;
+            for (size_t i = 0; i < io->nframes; i++)
+            {
+                if (io->frames[i].off == -1 || !io->frames[i].dirty)
+                    continue;
+                dirty = 1;
+                if (io->frames[i].busy == FRAME_IDLE && frame_start_writeback(io, i) != 0)
+                    err = -EIO;
+            }
+            while (wfs_uring_pending(io->ring) > 0)
+            {
+                if (ring_wait(io) != 0)
+                {
+                    err = -EIO;
+                    break;
+                }
+            }
+            if (io->write_errors != write_errors)
+                err = -EIO;
+        } while (dirty && err == 0);
+    }
+    else
+    {
+        for (size_t i = 0; i < io->nframes; i++)
+        {
+            if (io->frames[i].off != -1 && frame_writeback(io, i) != 0)
+                err = -EIO;
+        }
+    }
+    for (int i = 0; i < io->set.ndisks; i++)
+    {
+        if (fsync(io->set.fds[i]) != 0)
+            err = -EIO;
+    }
+    return err;
+}
+
+void wfs_io_close(struct wfs_io *io)
+{
+    if (io == NULL)
+        return;
+    if (wfs_io_sync(io) != 0)
+        fprintf(stderr, "wfs: failed to write back the image on close\n");
+    io_free(io);
+}
+
+static int in_header(struct wfs_io *io, off_t off, size_t len)
+{
+    return off + (off_t)len <= io->header_len;
+}
+
+// returns the image offset of the grid block holding off
+static off_t block_start(struct wfs_io *io, off_t off)
+{
+    return off - ((off - io->header_len) % BLOCK_SIZE);
+}
+
+static int range_ok(struct wfs_io *io, off_t off, size_t len)
+{
+    if (off < 0 || off + (off_t)len > io->size)
+        return 0;
+    if (in_header(io, off, len))
+        return 1;
+    return off >= io->header_len && off - block_start(io, off) + len <= BLOCK_SIZE;
+}
+
+// gives a region's pages back: unmapped from the daemon and dropped from
+// the page cache once clean. dirty pages stay cached until written back,
+// a mapping is never the only copy, so nothing is lost.
+static void region_drop(struct wfs_io *io, size_t r)
+{
+    off_t off = io->data_start + ((off_t)r << REGION_SHIFT);
+    size_t len = (off + REGION_SIZE <= io->size) ? REGION_SIZE : io->size - off;
+    // madvise wants a page aligned start, data_start may not be
+    static long page;
+    if (page == 0)
+        page = sysconf(_SC_PAGESIZE);
+    for (off_t end = off + len; off < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t n = segment(&io->set, off, end, &disk, &phys);
+        off_t start = (phys + page - 1) & ~(off_t)(page - 1);
+        if (start < phys + n)
+            madvise(io->maps[disk] + start, phys + n - start, MADV_DONTNEED);
+        posix_fadvise(io->set.fds[disk], phys, n, POSIX_FADV_DONTNEED);
+        off += n;
+    }
+    io->regions[r] = 0;
+    io->resident--;
+    io->stats.dropped++;
+}
+
+// marks the regions of [off, off + len) as used, and when that takes the
+// mapping over budget sweeps for regions unused since the hand last came.
+// only accesses count as hits and misses, readahead does not.
+static void regions_touch(struct wfs_io *io, off_t off, size_t len, int access)
+{
+    if (off + (off_t)len <= io->data_start)
+        return;
+    if (off < io->data_start)
+        off = io->data_start;
+    size_t last = (off + len - 1 - io->data_start) >> REGION_SHIFT;
+    for (size_t r = (off - io->data_start) >> REGION_SHIFT; r <= last && r < io->nregions; r++)
+    {
+        if (!(io->regions[r] & REGION_RESIDENT))
+            io->resident++;
+        if (access && (io->regions[r] & REGION_RESIDENT))
+            io->stats.hits++;
+        else if (access)
+            io->stats.misses++;
+        io->regions[r] = REGION_RESIDENT | REGION_REF;
+    }
+    for (size_t scanned = 0; io->resident > io->max_resident && scanned < 2 * io->nregions; scanned++)
+    {
+        size_t r = io->region_hand;
+        io->region_hand = (io->region_hand + 1) % io->nregions;
+        if (io->regions[r] & REGION_REF)
+            io->regions[r] &= ~REGION_REF;
+        else if (io->regions[r] & REGION_RESIDENT)
+            region_drop(io, r);
+    }
+}
+
+void *wfs_io_pin(struct wfs_io *io, off_t off, size_t len)
+{
+    if (!range_ok(io, off, len))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (io->backend == WFS_IO_MMAP)
+    {
+        if (io->regions != NULL)
+            regions_touch(io, off, len, 1);
+        return map_ptr(io, off);
+    }
+    if (in_header(io, off, len))
+        return io->header + off;
+
+    off_t start = block_start(io, off);
+    int idx = frame_get(io, start, 1);
+    if (idx == -1)
+        return NULL;
+    return frame_ptr(io, idx) + (off - start);
+}
+
+void wfs_io_unpin(struct wfs_io *io, void *ptr, int dirty)
+{
+    if (io->backend == WFS_IO_MMAP || ptr == NULL)
+        return;
+    char *p = ptr;
+    if (p >= io->header && p < io->header + io->header_len)
+    {
+        io->header_dirty |= dirty;
+        return;
+    }
+    struct wfs_frame *frame = &io->frames[(p - io->frame_data) / BLOCK_SIZE];
+    frame->dirty |= dirty;
+    frame->pins--;
+}
+
+int wfs_io_prefetch(struct wfs_io *io, const off_t *offs, int n)
+{
+    if (io->ring == NULL)
+        return 0;
+
+    // never queue more than half the cache so the batch cannot evict itself
+    int budget = io->nframes / 2;
+    int queued = 0;
+    for (int i = 0; i < n && queued < budget; i++)
+    {
+        // unallocated block pointers are 0, nothing to fetch
+        if (offs[i] == 0 || !range_ok(io, offs[i], 1) || in_header(io, offs[i], 1))
+            continue;
+        off_t start = block_start(io, offs[i]);
+        if (frame_lookup(io, start) != -1)
+            continue;
+        int idx = frame_victim(io);
+        if (idx == -1)
+            break;
+        frame_install(io, idx, start);
+        if (ring_queue(io, idx, 0) != 0)
+        {
+            frame_unhash(io, idx);
+            io->frames[idx].off = -1;
+            break;
+        }
+        io->stats.misses++;
+        queued++;
+    }
+
+    // one submission for the whole batch, then wait for all of it
+    while (wfs_uring_pending(io->ring) > 0)
+    {
+        if (ring_wait(io) != 0)
+            return -EIO;
+    }
+    return 0;
+}
+
+// the next run of adjacent blocks among offs starting at *i, skipping
+// offsets of 0 and any outside the data area. returns 0 when none is left.
+static int next_run(struct wfs_io *io, const off_t *offs, int n, int *i, off_t *off, size_t *len)
+{
+    while (*i < n && (offs[*i] == 0 || !range_ok(io, offs[*i], 1) || in_header(io, offs[*i], 1)))
+        (*i)++;
+    if (*i >= n)
+        return 0;
+    *off = block_start(io, offs[*i]);
+    *len = BLOCK_SIZE;
+    for ((*i)++; *i < n && offs[*i] != 0 && block_start(io, offs[*i]) == *off + (off_t)*len && range_ok(io, offs[*i], 1); (*i)++)
+        *len += BLOCK_SIZE;
+    return 1;
+}
+
+// madvise of a byte range of the mappings, widened to whole pages
+static int map_advise(struct wfs_io *io, off_t off, size_t len, int advice)
+{
+    static long page;
+    if (page == 0)
+        page = sysconf(_SC_PAGESIZE);
+    for (off_t end = off + len; off < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t n = segment(&io->set, off, end, &disk, &phys);
+        off_t start = phys & ~(off_t)(page - 1);
+        if (madvise(io->maps[disk] + start, n + (phys - start), advice) != 0)
+            return -errno;
+        off += n;
+    }
+    return 0;
+}
+
+// readahead hint to each member for its part of a byte range
+static int fd_advise(struct wfs_io *io, off_t off, size_t len, int advice)
+{
+    for (off_t end = off + len; off < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t n = segment(&io->set, off, end, &disk, &phys);
+        if (posix_fadvise(io->set.fds[disk], phys, n, advice) != 0)
+            return -EIO;
+        off += n;
+    }
+    return 0;
+}
+
+int wfs_io_readahead(struct wfs_io *io, off_t prev, const off_t *offs, int n)
+{
+    // a quarter of the cache at most, readahead must not push out what
+    // the reads in between still need
+    int budget = io->nframes / 4;
+    int i = 0, err = 0;
+    off_t off;
+    size_t len;
+    while (next_run(io, offs, n, &i, &off, &len))
+    {
+        int follows = prev != 0 && off == block_start(io, prev) + BLOCK_SIZE;
+        prev = off + len - BLOCK_SIZE;
+        if (follows && io->ring == NULL)
+            continue;
+        if (io->backend == WFS_IO_MMAP)
+        {
+            // pages read in ahead count against the budget like any other
+            if (io->regions != NULL)
+                regions_touch(io, off, len, 0);
+            err = map_advise(io, off, len, MADV_WILLNEED);
+            if (err == 0)
+                io->stats.readahead += len / BLOCK_SIZE;
+        }
+        else if (io->ring == NULL && !io->direct)
+        {
+            err = fd_advise(io, off, len, POSIX_FADV_WILLNEED);
+            if (err == 0)
+                io->stats.readahead += len / BLOCK_SIZE;
+        }
+        else if (io->ring != NULL)
+        {
+            // the frames stay busy until their read is reaped
+            for (off_t start = off; start < off + (off_t)len && budget > 0; start += BLOCK_SIZE)
+            {
+                if (frame_lookup(io, start) != -1)
+                    continue;
+                int idx = frame_victim(io);
+                if (idx == -1)
+                    break;
+                frame_install(io, idx, start);
+                if (ring_queue(io, idx, 0) != 0)
+                {
+                    frame_unhash(io, idx);
+                    io->frames[idx].off = -1;
+                    break;
+                }
+                // not a miss, nobody asked for the block yet
+                io->stats.readahead++;
+                budget--;
+            }
+        }
+    }
+    // hand the reads to the kernel, frame_get waits for the ones it needs
+    if (io->ring != NULL && wfs_uring_submit(io->ring, 0) != 0)
+        err = -EIO;
+    return err;
+}
+
+int wfs_io_advise_random(struct wfs_io *io, const off_t *offs, int n, int random)
+{
+    if (io->backend != WFS_IO_MMAP)
+        return 0;
+    int i = 0, err = 0;
+    off_t off;
+    size_t len;
+    while (next_run(io, offs, n, &i, &off, &len) && err == 0)
+        err = map_advise(io, off, len, random ? MADV_RANDOM : MADV_NORMAL);
+    return err;
+}
+
+int wfs_io_discard(struct wfs_io *io, off_t off, size_t len)
+{
+    if (!range_ok(io, off, len) || in_header(io, off, len))
+        return -EINVAL;
+
+    // whatever is cached for the range is garbage now, never write it back
+    if (io->backend != WFS_IO_MMAP)
+    {
+        for (off_t start = block_start(io, off); start < off + (off_t)len; start += BLOCK_SIZE)
+        {
+            int idx = frame_lookup(io, start);
+            if (idx == -1 || io->frames[idx].pins > 0 || io->frames[idx].busy != FRAME_IDLE)
+                continue;
+            frame_unhash(io, idx);
+            io->frames[idx].off = -1;
+            io->frames[idx].dirty = 0;
+        }
+    }
+    if (!io->discard)
+        return 0;
+
+    int err = 0;
+    for (off_t end = off + len; off < end;)
+    {
+        int disk;
+        off_t phys;
+        off_t n = segment(&io->set, off, end, &disk, &phys);
+        int ret = wfs_io_discard_range(io->set.fds[disk], &io->set.geo[disk], phys, n);
+        if (ret != 0)
+            err = ret;
+        off += n;
+    }
+    return err;
+}
+
+int wfs_io_read(struct wfs_io *io, off_t off, void *buf, size_t len)
+{
+    void *src = wfs_io_pin(io, off, len);
+    if (src == NULL)
+        return -EIO;
+    memcpy(buf, src, len);
+    wfs_io_unpin(io, src, 0);
+    return 0;
+}
+
+int wfs_io_write(struct wfs_io *io, off_t off, const void *buf, size_t len)
+{
+    if (!range_ok(io, off, len))
+        return -EIO;
+    if (io->backend == WFS_IO_MMAP || in_header(io, off, len))
+    {
+        void *dst = wfs_io_pin(io, off, len);
+        memcpy(dst, buf, len);
+        wfs_io_unpin(io, dst, 1);
+        return 0;
+    }
+
+    // whole-block writes do not need the old contents read in first
+    off_t start = block_start(io, off);
+    int idx = frame_get(io, start, !(off == start && len == BLOCK_SIZE));
+    if (idx == -1)
+        return -EIO;
+    memcpy(frame_ptr(io, idx) + (off - start), buf, len);
+    io->frames[idx].dirty = 1;
+    io->frames[idx].pins--;
+    return 0;
+}
+
+off_t wfs_io_size(struct wfs_io *io)
+{
+    return io->size;
+}
+
+void wfs_io_get_stats(struct wfs_io *io, struct wfs_io_stats *stats)
+{
+    *stats = io->stats;
+    stats->resident = (size_t)io->resident << REGION_SHIFT;
+}
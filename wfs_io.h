@@ -0,0 +1,153 @@
+#ifndef WFS_IO_H
+#define WFS_IO_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/*
+  Block I/O layer between the filesystem and the disk image.
+
+  Everything before i_blocks_ptr (superblock and both bitmaps) is the
+  "header" and stays resident for the life of the mount. Past that point
+  the image is a grid of BLOCK_SIZE blocks (inode slots, then data blocks)
+  and every access has to stay inside one of them.
+
+  The mmap backend maps the whole image like wfs always did. With a
+  mem_budget it keeps the mapped data blocks under that size: the data
+  area is tracked in regions, every access marks its region, and once
+  too many are resident a CLOCK sweep hands the unmarked ones back with
+  MADV_DONTNEED and POSIX_FADV_DONTNEED. The superblock, bitmaps and
+  inodes are never dropped, and hits and misses count region accesses.
+  The pread
+  backend keeps a fixed number of blocks in a CLOCK buffer cache and does
+  its own I/O, optionally with O_DIRECT, so memory use does not grow with
+  the size of the image. The io_uring backend shares that cache but sends
+  misses and writebacks through a ring: dirty blocks are written behind
+  as the CLOCK hand passes them and callers can prefetch a batch of
+  blocks with a single submission. A caller still waits for its own
+  reads before returning, so the ring overlaps the I/O of one request
+  and writeback behind it, not the I/O of separate requests.
+
+  The image can also be a striped set of several files or devices, see
+  struct wfs_stripe_label in wfs.h, named as one path with the members
+  separated by commas. Offsets stay those of the striped image, the
+  layer maps every request onto the member holding it: the mmap backend
+  maps each member, the others send each block to its member's fd, so a
+  prefetch or readahead batch goes out to all members at once.
+*/
+
+enum wfs_io_backend
+{
+    WFS_IO_MMAP,
+    WFS_IO_PREAD,
+    WFS_IO_URING,
+};
+
+struct wfs_io_opts
+{
+    enum wfs_io_backend backend;
+    size_t cache_blocks; // frames in the buffer cache, pread and io_uring backends
+    int direct;          // open the image with O_DIRECT, pread backend only
+    int discard;         // hand freed blocks back to the device or file system
+    size_t mem_budget;   // mmap backend, bytes of file data kept mapped, 0 for no limit
+};
+
+// what wfs_io_probe learns about an image file or raw block device
+struct wfs_io_geometry
+{
+    off_t size;    // usable bytes
+    size_t align;  // alignment O_DIRECT needs, the sector size for devices
+    int is_device; // raw block device rather than a regular file
+};
+
+struct wfs_io_stats
+{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long writebacks;
+    unsigned long readahead; // blocks wfs_io_readahead advised or queued, not in misses
+    unsigned long dropped;   // mmap regions given back to stay in mem_budget
+    size_t resident;         // bytes of file data mapped as far as mem_budget knows
+};
+
+struct wfs_io;
+
+#define WFS_IO_MAX_DISKS (16)
+
+// the members of an open image, a plain image is a set of one that
+// maps every offset to itself
+struct wfs_stripe
+{
+    int ndisks;
+    int fds[WFS_IO_MAX_DISKS];
+    struct wfs_io_geometry geo[WFS_IO_MAX_DISKS];
+    off_t size;       // of the striped image
+    off_t unit;       // stripe unit in bytes
+    off_t header_len; // bytes before the first stripe, all on member 0
+    off_t grid_base;  // member offset of the first stripe
+};
+
+#define WFS_IO_DEFAULT_CACHE_BLOCKS (4096)
+
+// sizes an open image, block devices report st_size as 0 so they are
+// asked through BLKGETSIZE64 and BLKSSZGET instead
+int wfs_io_probe(int fd, struct wfs_io_geometry *geo);
+// discards a byte range of an open image: BLKDISCARD of the whole
+// sectors inside it on a device, a punched hole in a regular file
+int wfs_io_discard_range(int fd, const struct wfs_io_geometry *geo, off_t off, off_t len);
+
+// opens the image, or with a comma separated path every member of a
+// striped set in any order. flags go to open(2). returns 0, or -1 with
+// errno set and nothing left open.
+int wfs_stripe_open(const char *path, int flags, struct wfs_stripe *set);
+void wfs_stripe_close(struct wfs_stripe *set);
+// finds the member and member offset holding image offset off, returns
+// how many bytes from off on stay contiguous in that member
+off_t wfs_stripe_locate(const struct wfs_stripe *set, off_t off, int *disk, off_t *phys);
+// pread and pwrite of an image range that may span members, 0 or -EIO
+int wfs_stripe_pread(const struct wfs_stripe *set, void *buf, size_t len, off_t off);
+int wfs_stripe_pwrite(const struct wfs_stripe *set, const void *buf, size_t len, off_t off);
+
+// opens the image at path, returns NULL and sets errno on failure
+struct wfs_io *wfs_io_open(const char *path, const struct wfs_io_opts *opts);
+// writes back everything dirty and releases the image
+void wfs_io_close(struct wfs_io *io);
+// writes back everything dirty and waits for it to reach the image
+int wfs_io_sync(struct wfs_io *io);
+
+// returns a pointer to len bytes at off that stays valid until unpinned,
+// or NULL if the range is outside the image or crosses a block
+void *wfs_io_pin(struct wfs_io *io, off_t off, size_t len);
+// releases a pinned pointer, dirty marks the block as modified
+void wfs_io_unpin(struct wfs_io *io, void *ptr, int dirty);
+
+// brings the blocks holding each offset into the cache with one batch of
+// reads and waits for them, offsets of 0 are skipped. no-op unless the
+// backend is io_uring.
+int wfs_io_prefetch(struct wfs_io *io, const off_t *offs, int n);
+
+// starts reading the blocks holding each offset and returns without
+// waiting for them: MADV_WILLNEED on the mapping, POSIX_FADV_WILLNEED
+// under the pread cache unless it is O_DIRECT, reads queued on the ring
+// for io_uring. offsets of 0 are skipped. prev is the block the stream
+// read last, the kernel already reads ahead of it on disk for the first
+// two, so blocks right after it are left to the kernel there.
+int wfs_io_readahead(struct wfs_io *io, off_t prev, const off_t *offs, int n);
+// tells the backend the blocks holding each offset are read at random,
+// or with random 0 that they no longer are. only the mapping reads
+// around a miss by itself, MADV_RANDOM turns that off.
+int wfs_io_advise_random(struct wfs_io *io, const off_t *offs, int n, int random);
+
+// drops any cached copy of a freed range and, if the image was opened
+// with discard, passes the range down with wfs_io_discard_range
+int wfs_io_discard(struct wfs_io *io, off_t off, size_t len);
+
+// copy len bytes between the image and buf, same range rules as pin
+int wfs_io_read(struct wfs_io *io, off_t off, void *buf, size_t len);
+int wfs_io_write(struct wfs_io *io, off_t off, const void *buf, size_t len);
+
+off_t wfs_io_size(struct wfs_io *io);
+void wfs_io_get_stats(struct wfs_io *io, struct wfs_io_stats *stats);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "wfs_log.h"
+
+#define LOG_SLOTS (1024) // a power of two
+#define LOG_MSG_MAX (160)
+#define LOG_FLUSH_INTERVAL_MS (100)
+
+struct log_slot
+{
+    uint64_t seq; // 2 * pos + 1 while being written, 2 * pos + 2 once done
+    struct timespec ts;
+    int level;
+    char msg[LOG_MSG_MAX];
+};
+
+static const char *level_names[] = {"ERROR", "WARN", "INFO", "DEBUG", "TRACE"};
+
+static struct log_slot ring[LOG_SLOTS];
+static uint64_t head; // next position a writer claims
+static uint64_t tail; // next position to drain, under drain_lock
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static int log_fd = STDERR_FILENO;
+
+void wfs_log_write(int level, const char *fmt, ...)
+{
+    uint64_t pos = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    struct log_slot *slot = &ring[pos & (LOG_SLOTS - 1)];
+
+    // mark the slot busy before touching it, like a seqlock writer
+    __atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    clock_gettime(CLOCK_REALTIME, &slot->ts);
+    slot->level = level;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&slot->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+}
+
+// formats one drained message as a line of the log
+static int format_line(char *line, size_t cap, const struct log_slot *slot)
+{
+    struct tm tm;
+    char when[32];
+    localtime_r(&slot->ts.tv_sec, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    int level = (slot->level >= 0 && slot->level <= WFS_LOG_TRACE) ? slot->level : WFS_LOG_TRACE;
+    return snprintf(line, cap, "%s.%06ld wfs %s: %s\n", when, slot->ts.tv_nsec / 1000, level_names[level], slot->msg);
+}
+
+// best effort, there is nowhere to report a failing log fd
+static void emit(const char *line, int len)
+{
+    ssize_t done = write(log_fd, line, len);
+    (void)done;
+}
+
+void wfs_log_flush(void)
+{
+    char line[LOG_MSG_MAX + 64];
+    unsigned long dropped = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    // anything more than a ring behind has been overwritten already
+    if (end - tail > LOG_SLOTS)
+    {
+        dropped += end - LOG_SLOTS - tail;
+        tail = end - LOG_SLOTS;
+    }
+    while (tail < end)
+    {
+        struct log_slot *slot = &ring[tail & (LOG_SLOTS - 1)];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq < 2 * tail + 2)
+        {
+            // the writer that claimed it is still formatting, next time
+            break;
+        }
+        struct log_slot copy;
+        memcpy(&copy, slot, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq != 2 * tail + 2 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+        {
+            // lapped by a newer message while it waited or was copied
+            dropped++;
+            tail++;
+            continue;
+        }
+        copy.msg[LOG_MSG_MAX - 1] = '\0';
+        int len = format_line(line, sizeof(line), &copy);
+        if (len > (int)sizeof(line) - 1)
+            len = sizeof(line) - 1;
+        emit(line, len);
+        tail++;
+    }
+    if (dropped > 0)
+    {
+        int len = snprintf(line, sizeof(line), "wfs WARN: %lu log messages dropped\n", dropped);
+        emit(line, len);
+    }
+    pthread_mutex_unlock(&drain_lock);
+}
+
+static void *flush_loop(void *arg)
+{
+    struct timespec interval = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+    while (1)
+    {
+        nanosleep(&interval, NULL);
+        wfs_log_flush();
+    }
+    return NULL;
+}
+
+int wfs_log_start(int fd)
+{
+    log_fd = fd;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, flush_loop, NULL) != 0)
+        return -1;
+    pthread_detach(thread);
+    return 0;
+}
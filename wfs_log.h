@@ -0,0 +1,48 @@
+#ifndef WFS_LOG_H
+#define WFS_LOG_H
+
+/*
+  Leveled logging for the daemon.
+
+  Levels above WFS_LOG_LEVEL are removed at compile time: the call still
+  type checks its arguments but the compiler drops it, so a production
+  build pays nothing for debug and trace messages on the request path.
+  Messages that are compiled in are formatted into a fixed ring of slots
+  that threads claim with one atomic add, no lock and no stdio. A
+  background thread drains the ring to the log fd. If the ring wraps
+  before it is drained, the oldest messages are dropped and counted.
+*/
+
+#define WFS_LOG_ERROR (0)
+#define WFS_LOG_WARN (1)
+#define WFS_LOG_INFO (2)
+#define WFS_LOG_DEBUG (3)
+#define WFS_LOG_TRACE (4)
+
+// build with -DWFS_LOG_LEVEL=WFS_LOG_TRACE (make LOG_LEVEL=4) for tracing
+#ifndef WFS_LOG_LEVEL
+#define WFS_LOG_LEVEL WFS_LOG_INFO
+#endif
+
+#define wfs_log(level, ...)                   \
+    do                                        \
+    {                                         \
+        if ((level) <= WFS_LOG_LEVEL)         \
+            wfs_log_write(level, __VA_ARGS__); \
+    } while (0)
+
+#define wfs_error(...) wfs_log(WFS_LOG_ERROR, __VA_ARGS__)
+#define wfs_warn(...) wfs_log(WFS_LOG_WARN, __VA_ARGS__)
+#define wfs_info(...) wfs_log(WFS_LOG_INFO, __VA_ARGS__)
+#define wfs_debug(...) wfs_log(WFS_LOG_DEBUG, __VA_ARGS__)
+#define wfs_trace(...) wfs_log(WFS_LOG_TRACE, __VA_ARGS__)
+
+// formats one message into the ring, use the macros above instead
+void wfs_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// starts the thread that drains the ring to fd
+int wfs_log_start(int fd);
+// drains whatever is in the ring to the log fd now
+void wfs_log_flush(void);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <string.h>
+#include "wfs_lz.h"
+
+#define LZ_MIN_MATCH (4)
+#define LZ_LAST_LITERALS (5) // the format ends every block with literals
+#define LZ_HASH_BITS (12)
+#define LZ_MAX_OFFSET (65535)
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// writes the continuation bytes of a length that did not fit its nibble
+static int put_length(unsigned char **op, unsigned char *oend, int len)
+{
+    len -= 15;
+    while (len >= 255)
+    {
+        if (*op >= oend)
+            return -1;
+        *(*op)++ = 255;
+        len -= 255;
+    }
+    if (*op >= oend)
+        return -1;
+    *(*op)++ = len;
+    return 0;
+}
+
+// emits one sequence: literals from anchor, then a match unless mlen is 0
+static int put_sequence(unsigned char **op, unsigned char *oend, const unsigned char *anchor, int lit, int offset, int mlen)
+{
+    if (*op >= oend)
+        return -1;
+    unsigned char *token = (*op)++;
+    int mcode = (mlen > 0) ? mlen - LZ_MIN_MATCH : 0;
+    *token = ((lit >= 15 ? 15 : lit) << 4) | (mcode >= 15 ? 15 : mcode);
+    if (lit >= 15 && put_length(op, oend, lit) != 0)
+        return -1;
+    if (lit > oend - *op)
+        return -1;
+    memcpy(*op, anchor, lit);
+    *op += lit;
+    if (mlen == 0)
+        return 0;
+
+    if (oend - *op < 2)
+        return -1;
+    *(*op)++ = offset & 0xff;
+    *(*op)++ = offset >> 8;
+    if (mcode >= 15 && put_length(op, oend, mcode) != 0)
+        return -1;
+    return 0;
+}
+
+int wfs_lz_compress(const unsigned char *src, int n, unsigned char *dst, int cap)
+{
+    int table[1 << LZ_HASH_BITS];
+    for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+    {
+        table[i] = -1;
+    }
+
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *end = src + n;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + cap;
+
+    // a match needs 4 readable bytes and has to leave the last literals
+    while (end - ip >= LZ_MIN_MATCH + LZ_LAST_LITERALS)
+    {
+        uint32_t seq = read32(ip);
+        unsigned h = hash32(seq);
+        int ref = table[h];
+        table[h] = ip - src;
+        if (ref < 0 || (ip - src) - ref > LZ_MAX_OFFSET || read32(src + ref) != seq)
+        {
+            ip++;
+            continue;
+        }
+
+        const unsigned char *p = ip + LZ_MIN_MATCH;
+        const unsigned char *m = src + ref + LZ_MIN_MATCH;
+        while (p < end - LZ_LAST_LITERALS && *p == *m)
+        {
+            p++;
+            m++;
+        }
+        if (put_sequence(&op, oend, anchor, ip - anchor, (ip - src) - ref, p - ip) != 0)
+            return -1;
+        ip = p;
+        anchor = p;
+    }
+
+    if (put_sequence(&op, oend, anchor, end - anchor, 0, 0) != 0)
+        return -1;
+    return op - dst;
+}
+
+int wfs_lz_decompress(const unsigned char *src, int n, unsigned char *dst, int cap)
+{
+    const unsigned char *ip = src;
+    const unsigned char *iend = src + n;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + cap;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+        int lit = token >> 4;
+        if (lit == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > iend - ip || lit > oend - op)
+            return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        // the last sequence is literals only
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - dst)
+            return -1;
+        int mlen = token & 15;
+        if (mlen == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (mlen > oend - op)
+            return -1;
+        // byte at a time, matches may overlap what they are producing
+        const unsigned char *m = op - offset;
+        while (mlen-- > 0)
+        {
+            *op++ = *m++;
+        }
+    }
+    return op - dst;
+}
@@ -0,0 +1,18 @@
+#ifndef WFS_LZ_H
+#define WFS_LZ_H
+
+/*
+  Small in-tree LZ77 codec for compressed clusters, byte compatible with
+  the LZ4 block format: a token with 4-bit literal and match lengths,
+  literals, a 2-byte little-endian offset, and 255-continued lengths.
+  Inputs are at most a few KiB so there is no frame format or checksum.
+*/
+
+// compresses n bytes of src into dst, returns the compressed size or -1
+// if it would not fit in cap bytes
+int wfs_lz_compress(const unsigned char *src, int n, unsigned char *dst, int cap);
+// decompresses n bytes of src into dst, returns the decompressed size or
+// -1 if the input is corrupt or would overflow cap bytes
+int wfs_lz_decompress(const unsigned char *src, int n, unsigned char *dst, int cap);
+
+#endif
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "libwfs.h"
+#include "wfs_stats.h"
+#include "wfs_trace.h"
+
+// runs a trace recorded with wfs --trace=FILE against an image through
+// libwfs, one operation at a time in the order the daemon finished them.
+// without --timed it goes as fast as it can, with it every operation
+// waits for its original start time. writes carry a fill pattern, traces
+// have no data. prints the wfs_stats latency report of the replay and
+// how many operations returned something else than they did when traced.
+// USAGE: ./wfs_replay trace_file image [--timed] [--io=mmap|pread|uring]
+
+#define HANDLE_SLOTS (1 << 16) // a power of two, more than files open at once
+
+// recorded fi->fh values to the files open in the replay
+struct handle_slot
+{
+    uint64_t handle; // 0 when the slot is empty
+    struct wfs_file *file;
+};
+
+static struct handle_slot handles[HANDLE_SLOTS];
+
+static struct handle_slot *find_handle(uint64_t handle)
+{
+    size_t i = (handle >> 4) & (HANDLE_SLOTS - 1);
+    while (handles[i].handle != 0 && handles[i].handle != handle)
+        i = (i + 1) & (HANDLE_SLOTS - 1);
+    return &handles[i];
+}
+
+static struct wfs_file *lookup_handle(uint64_t handle)
+{
+    if (handle == 0)
+        return NULL;
+    struct handle_slot *slot = find_handle(handle);
+    return (slot->handle == handle) ? slot->file : NULL;
+}
+
+static void forget_handle(uint64_t handle)
+{
+    struct handle_slot *slot = find_handle(handle);
+    if (slot->handle != handle)
+        return;
+    slot->handle = 0;
+    slot->file = NULL;
+    // pull later members of the probe chain back over the hole
+    size_t hole = slot - handles;
+    for (size_t i = (hole + 1) & (HANDLE_SLOTS - 1); handles[i].handle != 0; i = (i + 1) & (HANDLE_SLOTS - 1))
+    {
+        struct handle_slot moved = handles[i];
+        handles[i].handle = 0;
+        *find_handle(moved.handle) = moved;
+    }
+}
+
+static int ignore_entry(void *ctx, const char *name, const struct stat *st)
+{
+    return 0;
+}
+
+// grows the shared data buffer to at least size bytes
+static char *data_buffer(size_t size)
+{
+    static char *buf;
+    static size_t cap;
+    if (size > cap)
+    {
+        char *grown = realloc(buf, size);
+        if (grown == NULL)
+            return NULL;
+        memset(grown + cap, 'R', size - cap);
+        buf = grown;
+        cap = size;
+    }
+    return buf;
+}
+
+static long replay(struct wfs_fs *fs, const struct wfs_trace_rec *rec, const char *path, const char *path2)
+{
+    struct wfs_file *file = NULL;
+    struct stat st;
+    char *buf;
+    long ret;
+    switch (rec->op)
+    {
+    case WFS_STATS_GETATTR:
+        return wfs_fs_getattr(fs, path, &st);
+    case WFS_STATS_MKNOD:
+        return wfs_fs_mknod(fs, path, rec->mode);
+    case WFS_STATS_MKDIR:
+        return wfs_fs_mkdir(fs, path, rec->mode);
+    case WFS_STATS_UNLINK:
+        return wfs_fs_unlink(fs, path);
+    case WFS_STATS_RMDIR:
+        return wfs_fs_rmdir(fs, path);
+    case WFS_STATS_READ:
+        if ((buf = data_buffer(rec->size)) == NULL)
+            return -ENOMEM;
+        return wfs_fs_read(fs, path, lookup_handle(rec->handle), buf, rec->size, rec->offset);
+    case WFS_STATS_WRITE:
+        if ((buf = data_buffer(rec->size)) == NULL)
+            return -ENOMEM;
+        return wfs_fs_write(fs, path, lookup_handle(rec->handle), buf, rec->size, rec->offset);
+    case WFS_STATS_READDIR:
+        return wfs_fs_readdir(fs, path, ignore_entry, NULL);
+    case WFS_STATS_FSYNC:
+        return wfs_fs_sync(fs);
+    case WFS_STATS_OPEN:
+    case WFS_STATS_CREATE:
+        ret = (rec->op == WFS_STATS_OPEN) ? wfs_fs_open(fs, path, rec->flags, &file)
+                                          : wfs_fs_create(fs, path, rec->mode, rec->flags, &file);
+        // only handles the daemon really gave out come back in the trace
+        if (ret == 0 && rec->result == 0 && rec->handle != 0)
+        {
+            struct handle_slot *slot = find_handle(rec->handle);
+            if (slot->handle == rec->handle)
+                wfs_fs_release(fs, slot->file);
+            slot->handle = rec->handle;
+            slot->file = file;
+        }
+        else if (ret == 0)
+        {
+            wfs_fs_release(fs, file);
+        }
+        return ret;
+    case WFS_STATS_RELEASE:
+        wfs_fs_release(fs, lookup_handle(rec->handle));
+        forget_handle(rec->handle);
+        return 0;
+    case WFS_STATS_IOCTL:
+        if (rec->mode == WFS_IOC_DEFRAG)
+        {
+            // issued on a directory it went over the whole image
+            struct wfs_defrag_arg report = {0};
+            if (wfs_fs_getattr(fs, path, &st) == 0 && S_ISDIR(st.st_mode))
+                return wfs_fs_defrag_all(fs, &report);
+            return wfs_fs_defrag(fs, path, &report);
+        }
+        if (rec->mode != WFS_IOC_CLONE || path2 == NULL)
+            return -ENOTTY;
+        return wfs_fs_clone(fs, path2, path);
+    case WFS_STATS_COPY_FILE_RANGE:
+        return wfs_fs_copy_file_range(fs, path, rec->offset, path2, rec->offset2, rec->size);
+    default:
+        return -ENOSYS;
+    }
+}
+
+static void sleep_until(uint64_t deadline)
+{
+    uint64_t now = wfs_stats_now();
+    if (deadline <= now)
+        return;
+    struct timespec ts = {(deadline - now) / 1000000000, (deadline - now) % 1000000000};
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "USAGE: %s trace_file image [--timed] [--io=mmap|pread|uring]\n", argv[0]);
+        return 1;
+    }
+    int timed = 0;
+    struct wfs_io_opts opts = {WFS_IO_MMAP, WFS_IO_DEFAULT_CACHE_BLOCKS, 0, 0};
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--timed") == 0)
+            timed = 1;
+        else if (strcmp(argv[i], "--io=pread") == 0)
+            opts.backend = WFS_IO_PREAD;
+        else if (strcmp(argv[i], "--io=uring") == 0)
+            opts.backend = WFS_IO_URING;
+    }
+
+    FILE *trace = fopen(argv[1], "r");
+    char magic[8];
+    if (trace == NULL || fread(magic, 1, sizeof(magic), trace) != sizeof(magic) || memcmp(magic, WFS_TRACE_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s: not a wfs trace\n", argv[1]);
+        return 1;
+    }
+    struct wfs_fs *fs = wfs_fs_open_image(argv[2], &opts);
+    if (fs == NULL)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    wfs_stats_init();
+    uint64_t begin = wfs_stats_now();
+    unsigned long ops = 0, diverged = 0;
+    uint64_t traced_ns = 0;
+    struct wfs_trace_rec rec;
+    char path[UINT16_MAX + 1], path2[UINT16_MAX + 1];
+    while (fread(&rec, sizeof(rec), 1, trace) == 1)
+    {
+        if (fread(path, 1, rec.path_len, trace) != rec.path_len || fread(path2, 1, rec.path2_len, trace) != rec.path2_len)
+        {
+            fprintf(stderr, "%s: truncated after %lu records\n", argv[1], ops);
+            break;
+        }
+        path[rec.path_len] = '\0';
+        path2[rec.path2_len] = '\0';
+        if (rec.op >= WFS_STATS_GET_INODE)
+            continue;
+        if (timed)
+            sleep_until(begin + rec.ts_ns);
+
+        uint64_t start = wfs_stats_now();
+        long ret = replay(fs, &rec, path, rec.path2_len ? path2 : NULL);
+        wfs_stats_record(rec.op, start, ret < 0);
+        traced_ns += rec.duration_ns;
+        ops++;
+        if (ret != rec.result)
+            diverged++;
+    }
+    double secs = (wfs_stats_now() - begin) / 1e9;
+
+    char report[8192];
+    int len = wfs_stats_report(report, sizeof(report));
+    fwrite(report, 1, len < (int)sizeof(report) ? len : (int)sizeof(report) - 1, stdout);
+    printf("replayed %lu ops in %.3f s, %.0f ops/s, %.3f s inside the traced daemon, %lu diverged\n", ops, secs, ops / secs,
+           traced_ns / 1e9, diverged);
+
+    for (size_t i = 0; i < HANDLE_SLOTS; i++)
+    {
+        if (handles[i].handle != 0)
+            wfs_fs_release(fs, handles[i].file);
+    }
+    wfs_fs_close_image(fs);
+    fclose(trace);
+    return 0;
+}
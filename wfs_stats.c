@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "wfs_stats.h"
+
+#define SUB_BITS (4)
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+#define REPORT_MAX (8192)
+
+struct op_stats
+{
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[NUM_BUCKETS];
+};
+
+static const char *op_names[WFS_STATS_OPS] = {
+    [WFS_STATS_GETATTR] = "getattr",
+    [WFS_STATS_MKNOD] = "mknod",
+    [WFS_STATS_MKDIR] = "mkdir",
+    [WFS_STATS_UNLINK] = "unlink",
+    [WFS_STATS_RMDIR] = "rmdir",
+    [WFS_STATS_READ] = "read",
+    [WFS_STATS_WRITE] = "write",
+    [WFS_STATS_READDIR] = "readdir",
+    [WFS_STATS_FSYNC] = "fsync",
+    [WFS_STATS_OPEN] = "open",
+    [WFS_STATS_CREATE] = "create",
+    [WFS_STATS_RELEASE] = "release",
+    [WFS_STATS_IOCTL] = "ioctl",
+    [WFS_STATS_COPY_FILE_RANGE] = "copy_file_range",
+    [WFS_STATS_GET_INODE] = "get_inode",
+    [WFS_STATS_ALLOCATE_DATABLOCK] = "allocate_datablock",
+    [WFS_STATS_INSERT_ENTRY] = "insert_entry",
+};
+
+static struct op_stats stats[WFS_STATS_OPS];
+static uint64_t started_ns;
+
+// values below SUB_BUCKETS get a bucket each, above that every power of
+// two is cut into SUB_BUCKETS equal slices
+static int bucket_of(uint64_t v)
+{
+    if (v < SUB_BUCKETS)
+        return v;
+    int e = 63 - __builtin_clzll(v);
+    return (e - SUB_BITS + 1) * SUB_BUCKETS + (int)((v >> (e - SUB_BITS)) - SUB_BUCKETS);
+}
+
+// the largest value that lands in bucket b
+static uint64_t bucket_limit(int b)
+{
+    if (b < SUB_BUCKETS)
+        return b;
+    int shift = b / SUB_BUCKETS - 1;
+    uint64_t m = b % SUB_BUCKETS + SUB_BUCKETS;
+    return ((m + 1) << shift) - 1;
+}
+
+void wfs_stats_init(void)
+{
+    started_ns = wfs_stats_now();
+}
+
+uint64_t wfs_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void wfs_stats_record(enum wfs_stats_op op, uint64_t start, int failed)
+{
+    uint64_t ns = wfs_stats_now() - start;
+    struct op_stats *s = &stats[op];
+    if (failed)
+        __atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&s->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// walks a copy of the buckets up to the given fraction of count
+static uint64_t percentile(const uint64_t *buckets, uint64_t count, double p, uint64_t max)
+{
+    uint64_t target = (uint64_t)(p * count);
+    if (target == 0)
+        target = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < NUM_BUCKETS; b++)
+    {
+        seen += buckets[b];
+        if (seen >= target)
+            return bucket_limit(b) < max ? bucket_limit(b) : max;
+    }
+    return max;
+}
+
+int wfs_stats_report(char *buf, size_t cap)
+{
+    static uint64_t buckets[WFS_STATS_OPS][NUM_BUCKETS];
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    int len = 0;
+
+    // snprintf returns the length it wanted, clamp what is left to write into
+#define APPEND(...) len += snprintf(buf + ((size_t)len < cap ? (size_t)len : cap), (size_t)len < cap ? cap - len : 0, __VA_ARGS__)
+    APPEND("uptime_s %.3f\n", (wfs_stats_now() - started_ns) / 1e9);
+    APPEND("%-20s %10s %8s %10s %10s %10s %10s %10s %10s\n", "op", "calls", "errors", "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns");
+
+    pthread_mutex_lock(&lock);
+    for (int op = 0; op < WFS_STATS_OPS; op++)
+    {
+        struct op_stats *s = &stats[op];
+        // calls are counted from the buckets so the percentiles add up
+        // even while other threads keep recording
+        uint64_t count = 0;
+        for (int b = 0; b < NUM_BUCKETS; b++)
+        {
+            buckets[op][b] = __atomic_load_n(&s->buckets[b], __ATOMIC_RELAXED);
+            count += buckets[op][b];
+        }
+        uint64_t errors = __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+        uint64_t total = __atomic_load_n(&s->total_ns, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+        APPEND("%-20s %10lu %8lu %10lu %10lu %10lu %10lu %10lu %10lu\n", op_names[op], count, errors, count ? total / count : 0,
+               percentile(buckets[op], count, 0.5, max), percentile(buckets[op], count, 0.9, max),
+               percentile(buckets[op], count, 0.99, max), percentile(buckets[op], count, 0.999, max), max);
+    }
+    pthread_mutex_unlock(&lock);
+#undef APPEND
+    return len;
+}
+
+struct dumper
+{
+    sigset_t set;
+    int fd;
+};
+
+static void *dump_loop(void *arg)
+{
+    struct dumper *d = arg;
+    char report[REPORT_MAX];
+    int sig;
+    while (sigwait(&d->set, &sig) == 0)
+    {
+        int len = wfs_stats_report(report, sizeof(report));
+        if (len > (int)sizeof(report) - 1)
+            len = sizeof(report) - 1;
+        // nobody is listening any more
+        if (write(d->fd, report, len) < 0)
+            break;
+    }
+    return NULL;
+}
+
+int wfs_stats_dump_on(int signo, int fd)
+{
+    struct dumper *d = malloc(sizeof(struct dumper));
+    if (d == NULL)
+        return -1;
+    sigemptyset(&d->set);
+    sigaddset(&d->set, signo);
+    d->fd = fd;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, dump_loop, d) != 0)
+    {
+        free(d);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef WFS_STATS_H
+#define WFS_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+  Per-operation counters and latency histograms for the daemon.
+
+  Every operation keeps a call count, an error count and a log-linear
+  histogram of latencies in nanoseconds: each power of two is split into
+  16 linear buckets, so a reported percentile is within about 6% of the
+  real value anywhere in the 64-bit range. Updates are relaxed atomics,
+  cheap enough to leave on in production, and a report can be taken at
+  any time while other threads keep recording.
+*/
+
+enum wfs_stats_op
+{
+    // fuse callbacks
+    WFS_STATS_GETATTR,
+    WFS_STATS_MKNOD,
+    WFS_STATS_MKDIR,
+    WFS_STATS_UNLINK,
+    WFS_STATS_RMDIR,
+    WFS_STATS_READ,
+    WFS_STATS_WRITE,
+    WFS_STATS_READDIR,
+    WFS_STATS_FSYNC,
+    WFS_STATS_OPEN,
+    WFS_STATS_CREATE,
+    WFS_STATS_RELEASE,
+    WFS_STATS_IOCTL,
+    WFS_STATS_COPY_FILE_RANGE,
+    // internal hot spots, also counted inside the callbacks above
+    WFS_STATS_GET_INODE,
+    WFS_STATS_ALLOCATE_DATABLOCK,
+    WFS_STATS_INSERT_ENTRY,
+    WFS_STATS_OPS,
+};
+
+// starts the uptime clock the report measures rates against
+void wfs_stats_init(void);
+// monotonic nanoseconds, the start of a timed call
+uint64_t wfs_stats_now(void);
+// records one call of op that began at start
+void wfs_stats_record(enum wfs_stats_op op, uint64_t start, int failed);
+
+// formats every operation as one line of text into buf, returns the
+// length the full report needs like snprintf
+int wfs_stats_report(char *buf, size_t cap);
+// writes a report to fd each time signo arrives, from a thread of its
+// own. signo has to be blocked in every thread before this is called.
+int wfs_stats_dump_on(int signo, int fd);
+
+#endif
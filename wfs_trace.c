@@ -0,0 +1,74 @@
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "wfs_trace.h"
+#include "wfs_stats.h"
+
+#define TRACE_BUFFER (1 << 20)
+
+static int trace_fd = -1;
+static uint64_t opened_ns;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char buffer[TRACE_BUFFER];
+static size_t used;
+
+// best effort like the log, a full disk only costs the trace
+static void drain(void)
+{
+    size_t done = 0;
+    while (done < used)
+    {
+        ssize_t n = write(trace_fd, buffer + done, used - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    used = 0;
+}
+
+int wfs_trace_open(int fd)
+{
+    if (write(fd, WFS_TRACE_MAGIC, 8) != 8)
+        return -1;
+    opened_ns = wfs_stats_now();
+    trace_fd = fd;
+    return 0;
+}
+
+int wfs_trace_enabled(void)
+{
+    return trace_fd >= 0;
+}
+
+void wfs_trace_record(struct wfs_trace_rec *rec, const char *path, const char *path2)
+{
+    size_t len = strnlen(path, UINT16_MAX);
+    size_t len2 = (path2 != NULL) ? strnlen(path2, UINT16_MAX) : 0;
+    rec->ts_ns -= opened_ns;
+    rec->path_len = len;
+    rec->path2_len = len2;
+    rec->reserved = 0;
+
+    size_t need = sizeof(*rec) + len + len2;
+    pthread_mutex_lock(&lock);
+    if (used + need > TRACE_BUFFER)
+        drain();
+    if (need <= TRACE_BUFFER)
+    {
+        memcpy(buffer + used, rec, sizeof(*rec));
+        memcpy(buffer + used + sizeof(*rec), path, len);
+        if (len2 > 0)
+            memcpy(buffer + used + sizeof(*rec) + len, path2, len2);
+        used += need;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void wfs_trace_flush(void)
+{
+    if (trace_fd < 0)
+        return;
+    pthread_mutex_lock(&lock);
+    drain();
+    pthread_mutex_unlock(&lock);
+}
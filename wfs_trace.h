@@ -0,0 +1,47 @@
+#ifndef WFS_TRACE_H
+#define WFS_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+  Binary trace of the operations a daemon served, for wfs_replay.
+
+  A trace is the 8 byte WFS_TRACE_MAGIC followed by one record per
+  operation, each a struct wfs_trace_rec and then its path and second
+  path, without terminators. Data is never recorded, only offsets and
+  sizes, so a trace can leave a machine the image cannot. Records are
+  appended in the order operations finish, into a buffer that is written
+  out when it fills and at unmount. Integers are in host byte order.
+*/
+
+#define WFS_TRACE_MAGIC "WFSTRC01"
+
+struct wfs_trace_rec
+{
+    uint64_t ts_ns;       // start of the call, since the trace was opened
+    uint64_t duration_ns; // how long the daemon took
+    uint64_t handle;      // fi->fh of the call, 0 without an open file
+    int64_t offset;       // read, write, copy_file_range input
+    int64_t offset2;      // copy_file_range output
+    uint64_t size;
+    uint32_t mode;   // mknod, mkdir and create; the ioctl command
+    uint32_t flags;  // open and create
+    int32_t result;  // what the call returned, clamped to 32 bits
+    uint32_t op;     // enum wfs_stats_op
+    uint16_t path_len;
+    uint16_t path2_len; // copy_file_range output, ioctl clone source
+    uint32_t reserved;
+};
+
+// starts recording to fd, which stays open and owned by the caller
+int wfs_trace_open(int fd);
+// nonzero once wfs_trace_open succeeded
+int wfs_trace_enabled(void);
+// appends one record, rec's ts_ns is the wfs_stats_now() the call began
+// at and path_len and path2_len are filled in here. path2 may be NULL.
+void wfs_trace_record(struct wfs_trace_rec *rec, const char *path, const char *path2);
+// writes out whatever is buffered
+void wfs_trace_flush(void);
+
+#endif
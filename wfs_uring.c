@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "wfs_uring.h"
+
+struct wfs_uring
+{
+    int fd;
+    unsigned entries;
+
+    // submission queue
+    void *sq_ring;
+    size_t sq_ring_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    // completion queue
+    void *cq_ring;
+    size_t cq_ring_len;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned queued;  // in the sq, not yet handed to the kernel
+    unsigned pending; // queued or submitted, not yet reaped
+};
+
+static int ring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+struct wfs_uring *wfs_uring_init(unsigned entries)
+{
+    struct wfs_uring *ring = calloc(1, sizeof(struct wfs_uring));
+    if (ring == NULL)
+        return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = ring_setup(entries, &params);
+    if (ring->fd < 0)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        wfs_uring_free(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+void wfs_uring_free(struct wfs_uring *ring)
+{
+    if (ring == NULL)
+        return;
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_len);
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED)
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+    close(ring->fd);
+    free(ring);
+}
+
+int wfs_uring_queue(struct wfs_uring *ring, int write, int fd, void *buf, size_t len, off_t off, unsigned long long tag)
+{
+    // the completion queue is twice the sq, keep everything in flight reapable
+    if (ring->pending >= ring->entries)
+        return -1;
+
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ring->entries)
+        return -1;
+
+    unsigned slot = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = tag;
+    ring->sq_array[slot] = slot;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    ring->pending++;
+    return 0;
+}
+
+int wfs_uring_submit(struct wfs_uring *ring, unsigned min_complete)
+{
+    unsigned flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    if (ring->queued == 0 && min_complete == 0)
+        return 0;
+    for (;;)
+    {
+        int ret = ring_enter(ring->fd, ring->queued, min_complete, flags);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return -errno;
+        ring->queued -= ret;
+        return 0;
+    }
+}
+
+int wfs_uring_reap(struct wfs_uring *ring, void (*done)(void *arg, unsigned long long tag, int res), void *arg)
+{
+    int reaped = 0;
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        done(arg, cqe->user_data, cqe->res);
+        head++;
+        reaped++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    ring->pending -= reaped;
+    return reaped;
+}
+
+unsigned wfs_uring_pending(struct wfs_uring *ring)
+{
+    return ring->pending;
+}
@@ -0,0 +1,28 @@
+#ifndef WFS_URING_H
+#define WFS_URING_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/*
+  Minimal io_uring ring for the io layer, talking to the kernel directly
+  so the daemon has no liburing dependency. Requests are queued, handed to
+  the kernel in one io_uring_enter and completed by tag.
+*/
+
+struct wfs_uring;
+
+// sets up a ring with room for entries requests, NULL if unsupported
+struct wfs_uring *wfs_uring_init(unsigned entries);
+void wfs_uring_free(struct wfs_uring *ring);
+
+// queues a read or write of len bytes at off, returns -1 if the queue is full
+int wfs_uring_queue(struct wfs_uring *ring, int write, int fd, void *buf, size_t len, off_t off, unsigned long long tag);
+// submits everything queued and waits until at least min_complete have finished
+int wfs_uring_submit(struct wfs_uring *ring, unsigned min_complete);
+// hands every finished request to done, returns how many there were
+int wfs_uring_reap(struct wfs_uring *ring, void (*done)(void *arg, unsigned long long tag, int res), void *arg);
+// requests queued or submitted that have not been reaped yet
+unsigned wfs_uring_pending(struct wfs_uring *ring);
+
+#endif